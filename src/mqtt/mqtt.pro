@@ -11,19 +11,36 @@ PUBLIC_HEADERS += \
     qmqttglobal.h \
     qmqttclient.h \
     qmqttmessage.h \
-    qmqttsubscription.h
+    qmqttsubscription.h \
+    qmqtttopicfilter.h \
+    qmqtttopicname.h
 
 PRIVATE_HEADERS += \
     qmqttclient_p.h \
     qmqttconnection_p.h \
     qmqttcontrolpacket_p.h \
-    qmqttsubscription_p.h
+    qmqttframedecoder_p.h \
+    qmqttofflinequeue_p.h \
+    qmqttpacketidallocator_p.h \
+    qmqttpacketidtable_p.h \
+    qmqttreadbuffer_p.h \
+    qmqttsessionstore_p.h \
+    qmqttsubscription_p.h \
+    qmqtttopicname_p.h \
+    qmqtttopictrie_p.h
 
 SOURCES += \
     qmqttclient.cpp \
     qmqttconnection.cpp \
     qmqttcontrolpacket.cpp \
+    qmqttframedecoder.cpp \
+    qmqttofflinequeue.cpp \
+    qmqttpacketidallocator.cpp \
+    qmqttreadbuffer.cpp \
+    qmqttsessionstore.cpp \
     qmqttsubscription.cpp \
+    qmqtttopicfilter.cpp \
+    qmqtttopicname.cpp \
     qmqttmessage.cpp
 
 HEADERS += $$PUBLIC_HEADERS $$PRIVATE_HEADERS
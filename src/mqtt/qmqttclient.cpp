@@ -164,6 +164,57 @@ QT_BEGIN_NAMESPACE
            MQTT Standard 3.1.1, publicly referred to as version 4
 */
 
+/*!
+    \enum QMqttClient::WriteBufferPolicy
+
+    This enum type specifies how publish() behaves while the write buffer is full.
+
+    \value RejectWhenFull
+           publish() fails and returns -1.
+    \value QueueWhenFull
+           The message is kept by the client and written once the write buffer drained.
+           If the messages kept exceed writeBufferQueueLimit(), publish() fails and
+           returns -1.
+
+    \sa setWriteBufferHighWatermark(), writeBufferFull()
+*/
+
+/*!
+    \enum QMqttClient::DisconnectMode
+
+    This enum type specifies what disconnectFromHost() does with the subscriptions.
+
+    \value UnsubscribeAll
+           The client unsubscribes from all topic filters before sending the DISCONNECT, with
+           as few UNSUBSCRIBE packets as possible. All subscriptions change to
+           QMqttSubscription::Unsubscribed.
+    \value DiscardSubscriptions
+           Only the DISCONNECT is sent. All subscriptions change to
+           QMqttSubscription::Unsubscribed without notifying the broker, which drops them at
+           the end of a clean session.
+    \value KeepSubscriptions
+           Only the DISCONNECT is sent and the subscriptions are kept. With cleanSession set to
+           false, the broker keeps them as well. The next connection subscribes again to the
+           topic filters the broker did not keep, and the same QMqttSubscription objects receive
+           the messages.
+*/
+
+/*!
+    \enum QMqttClient::MessageDispatch
+
+    This enum type specifies which receivers incoming messages are dispatched to.
+
+    \value ClientAndSubscriptions
+           Messages are reported by the client and by the matching subscriptions.
+    \value ClientOnly
+           Messages are only reported by the client, via messageReceived() and the message
+           handler of the client.
+    \value SubscriptionsOnly
+           Messages are only reported by the matching subscriptions.
+
+    \sa setMessageDispatch()
+*/
+
 /*!
     \fn QMqttClient::connected()
 
@@ -208,6 +259,24 @@ QT_BEGIN_NAMESPACE
     Sessions can be restored if a client has connected previously using the same clientId.
 */
 
+/*!
+    \fn QMqttClient::writeBufferFull()
+
+    This signal is emitted when the data not yet written to the transport reaches one of the
+    high watermarks. Publishers should pause until writeBufferDrained() is emitted.
+
+    \sa setWriteBufferHighWatermark(), setWriteBufferPacketHighWatermark()
+*/
+
+/*!
+    \fn QMqttClient::writeBufferDrained()
+
+    This signal is emitted when the data not yet written to the transport fell below the low
+    watermarks after writeBufferFull() has been emitted.
+
+    \sa setWriteBufferLowWatermark(), setWriteBufferPacketLowWatermark()
+*/
+
 /*!
     Creates a new QMqttClient instance with the specified \a parent
  */
@@ -215,6 +284,10 @@ QMqttClient::QMqttClient(QObject *parent) : QObject(*(new QMqttClientPrivate), p
 {
     Q_D(QMqttClient);
     d->m_connection.setClient(this);
+
+    // Allows queued connections to the message signals
+    qRegisterMetaType<QMqttMessage>();
+    qRegisterMetaType<QVector<QMqttMessage>>();
 }
 
 /*!
@@ -251,27 +324,90 @@ QIODevice *QMqttClient::transport() const
 
     This functions returns a \l QSharedPointer to a \l QMqttSubscription. If a subscription to
     the same topic is made twice, the return value is pointing to the same subscription instance.
+
+    Subscriptions can be made while the client is \l Connecting. They are sent right after the
+    CONNECT, so that the broker knows them by the time it acknowledges the connection. If the
+    broker rejects the connection or it cannot be established, these subscriptions change to
+    QMqttSubscription::Unsubscribed. A null pointer is returned while the client is
+    \l Disconnected.
  */
 QSharedPointer<QMqttSubscription> QMqttClient::subscribe(const QString &topic, quint8 qos)
+{
+    return subscribe(QMqttTopicFilter(topic), qos);
+}
+
+/*!
+    \overload
+
+    Adds a new subscription to receive notifications on the topic filter \a topic. The filter
+    is validated and encoded only once, when \a topic is created. Returns a null pointer if
+    \a topic is not a valid topic filter.
+ */
+QSharedPointer<QMqttSubscription> QMqttClient::subscribe(const QMqttTopicFilter &topic, quint8 qos)
 {
     Q_D(QMqttClient);
 
-    if (d->m_state != QMqttClient::Connected)
+    if (d->m_state == QMqttClient::Disconnected)
         return QSharedPointer<QMqttSubscription>();
 
     return d->m_connection.sendControlSubscribe(topic, qos);
 }
 
+/*!
+    \overload
+
+    Subscribes to all topic filters in \a topics, each paired with the QoS level to subscribe
+    with. The filters are packed into as few SUBSCRIBE packets as possible, each of them
+    acknowledged by a single response of the broker. This is considerably faster than
+    subscribing to many topic filters one by one.
+
+    Returns one subscription per entry of \a topics, in the same order. An entry is a null
+    pointer if its topic filter is not valid, its QoS level is not supported or the request
+    could not be sent. Topic filters subscribed already return the existing subscription.
+    An empty list is returned while the client is \l Disconnected.
+ */
+QList<QSharedPointer<QMqttSubscription>> QMqttClient::subscribe(const QList<QPair<QMqttTopicFilter, quint8>> &topics)
+{
+    Q_D(QMqttClient);
+
+    if (d->m_state == QMqttClient::Disconnected)
+        return QList<QSharedPointer<QMqttSubscription>>();
+
+    return d->m_connection.sendControlSubscribe(topics);
+}
+
 /*!
     Unsubscribes from \a topic. No notifications will be sent to any of the subscriptions made
     by \l QMqttClient::subscribe().
  */
 void QMqttClient::unsubscribe(const QString &topic)
+{
+    unsubscribe(QMqttTopicFilter(topic));
+}
+
+/*!
+    \overload
+
+    Unsubscribes from the topic filter \a topic.
+ */
+void QMqttClient::unsubscribe(const QMqttTopicFilter &topic)
 {
     Q_D(QMqttClient);
     d->m_connection.sendControlUnsubscribe(topic);
 }
 
+/*!
+    \overload
+
+    Unsubscribes from all topic filters in \a topics. Like subscribe(), the filters are packed
+    into as few UNSUBSCRIBE packets as possible.
+ */
+void QMqttClient::unsubscribe(const QList<QMqttTopicFilter> &topics)
+{
+    Q_D(QMqttClient);
+    d->m_connection.sendControlUnsubscribe(topics);
+}
+
 /*!
     Publishes a \a message to the broker with the specified \a topic. \a qos specifies the level
     of required security that the message is transfered.
@@ -287,9 +423,45 @@ qint32 QMqttClient::publish(const QString &topic, const QByteArray &message, qui
     if (qos > 2)
         return -1;
 
-    if (d->m_state != QMqttClient::Connected)
+    // The offline queue keeps a QMqttTopicName, otherwise the topic is
+    // validated and encoded without creating one
+    if (d->m_state == QMqttClient::Disconnected || !d->m_connection.offlineQueue().isEmpty())
+        return d->m_connection.queueOfflinePublish(QMqttTopicName(topic), message, qos, retain);
+
+    return d->m_connection.sendControlPublish(topic, message, qos, retain);
+}
+
+/*!
+    \overload
+
+    Publishes a \a message to the broker with the topic name \a topic. The topic name is
+    validated and encoded only once, when \a topic is created. Reusing the same
+    \l QMqttTopicName for repeated messages avoids any conversion of the topic.
+
+    Returns -1 if \a topic is not a valid topic name.
+
+    While the client is \l Connecting, the message is sent right after the CONNECT, without
+    waiting for the broker to acknowledge the connection. If the broker rejects the
+    connection or it cannot be established, the message is dropped and messageSent() is
+    not emitted for it.
+
+    If the client is disconnected, the message is put into the offline queue if it is
+    enabled, and 0 is returned. Otherwise the message is rejected and -1 is returned.
+    The delivery of a queued message cannot be tracked, even with a \a qos of 1 or 2: its
+    packet identifier is assigned once it is sent and not reported by publish().
+
+    \sa setOfflineQueueMemoryLimit()
+ */
+qint32 QMqttClient::publish(const QMqttTopicName &topic, const QByteArray &message, quint8 qos, bool retain)
+{
+    Q_D(QMqttClient);
+    if (qos > 2)
         return -1;
 
+    // Messages queued before are sent first
+    if (d->m_state == QMqttClient::Disconnected || !d->m_connection.offlineQueue().isEmpty())
+        return d->m_connection.queueOfflinePublish(topic, message, qos, retain);
+
     return d->m_connection.sendControlPublish(topic, message, qos, retain);
 }
 
@@ -308,6 +480,636 @@ bool QMqttClient::requestPing()
     return d->m_connection.sendControlPingRequest();
 }
 
+/*!
+    Returns \c true if outgoing packets are coalesced.
+
+    \sa setWriteCoalescing()
+ */
+bool QMqttClient::writeCoalescing() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.writeCoalescing();
+}
+
+/*!
+    Enables coalescing of outgoing packets if \a enable is \c true. By default, every packet
+    is written to the transport as soon as it is created.
+
+    With coalescing enabled, all packets created during one iteration of the event loop, for
+    instance by publishing in a loop or by acknowledging a burst of incoming messages, are
+    collected in a single buffer. The buffer is written to the transport at once when control
+    returns to the event loop, or when flush() is called. This reduces the number of writes
+    and system calls at the cost of a delay until the next event loop iteration.
+
+    Disabling coalescing writes all pending packets.
+
+    \sa flush()
+ */
+void QMqttClient::setWriteCoalescing(bool enable)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setWriteCoalescing(enable);
+}
+
+/*!
+    Writes all packets collected while write coalescing is enabled to the transport
+    immediately.
+
+    Returns \c false if the packets could not be written.
+
+    \sa setWriteCoalescing()
+ */
+bool QMqttClient::flush()
+{
+    Q_D(QMqttClient);
+    return d->m_connection.flush();
+}
+
+/*!
+    Returns the number of bytes not yet written to the transport at which the write buffer
+    is considered full. 0 means no limit, which is the default.
+
+    \sa setWriteBufferHighWatermark()
+ */
+qint64 QMqttClient::writeBufferHighWatermark() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.watermarks().highBytes;
+}
+
+/*!
+    Sets the high watermark of the write buffer to \a bytes. Once the data not yet written
+    to the transport reaches \a bytes, writeBufferFull() is emitted and publish() behaves as
+    specified by writeBufferPolicy(). This keeps the memory used for outgoing messages
+    bounded when the connection to the broker is slow.
+
+    Set \a bytes to 0 to disable the limit.
+
+    The amount of pending data is updated when the transport emits
+    \l QIODevice::bytesWritten().
+
+    \sa setWriteBufferLowWatermark(), setWriteBufferPacketHighWatermark()
+ */
+void QMqttClient::setWriteBufferHighWatermark(qint64 bytes)
+{
+    Q_D(QMqttClient);
+    QMqttConnection::Watermarks watermarks = d->m_connection.watermarks();
+    watermarks.highBytes = qMax<qint64>(0, bytes);
+    d->m_connection.setWatermarks(watermarks);
+}
+
+/*!
+    Returns the number of pending bytes below which a full write buffer is considered
+    drained. The default is 0.
+
+    \sa setWriteBufferLowWatermark()
+ */
+qint64 QMqttClient::writeBufferLowWatermark() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.watermarks().lowBytes;
+}
+
+/*!
+    Sets the low watermark of the write buffer to \a bytes. After the write buffer was full,
+    writeBufferDrained() is emitted once at most \a bytes are left to be written. The low
+    watermark should be smaller than the high watermark.
+
+    \sa setWriteBufferHighWatermark()
+ */
+void QMqttClient::setWriteBufferLowWatermark(qint64 bytes)
+{
+    Q_D(QMqttClient);
+    QMqttConnection::Watermarks watermarks = d->m_connection.watermarks();
+    watermarks.lowBytes = qMax<qint64>(0, bytes);
+    d->m_connection.setWatermarks(watermarks);
+}
+
+/*!
+    Returns the number of packets not yet written to the transport at which the write
+    buffer is considered full. 0 means no limit, which is the default.
+
+    \sa setWriteBufferPacketHighWatermark()
+ */
+int QMqttClient::writeBufferPacketHighWatermark() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.watermarks().highPackets;
+}
+
+/*!
+    Sets the high watermark of the write buffer to \a packets. This works like
+    setWriteBufferHighWatermark(), but counts the packets not yet completely written to
+    the transport instead of bytes.
+
+    Set \a packets to 0 to disable the limit.
+
+    \sa setWriteBufferPacketLowWatermark()
+ */
+void QMqttClient::setWriteBufferPacketHighWatermark(int packets)
+{
+    Q_D(QMqttClient);
+    QMqttConnection::Watermarks watermarks = d->m_connection.watermarks();
+    watermarks.highPackets = qMax(0, packets);
+    d->m_connection.setWatermarks(watermarks);
+}
+
+/*!
+    Returns the number of pending packets below which a full write buffer is considered
+    drained. The default is 0.
+
+    \sa setWriteBufferPacketLowWatermark()
+ */
+int QMqttClient::writeBufferPacketLowWatermark() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.watermarks().lowPackets;
+}
+
+/*!
+    Sets the low watermark of the write buffer to \a packets.
+
+    \sa setWriteBufferLowWatermark(), setWriteBufferPacketHighWatermark()
+ */
+void QMqttClient::setWriteBufferPacketLowWatermark(int packets)
+{
+    Q_D(QMqttClient);
+    QMqttConnection::Watermarks watermarks = d->m_connection.watermarks();
+    watermarks.lowPackets = qMax(0, packets);
+    d->m_connection.setWatermarks(watermarks);
+}
+
+/*!
+    Returns how publish() behaves while the write buffer is full.
+
+    \sa setWriteBufferPolicy()
+ */
+QMqttClient::WriteBufferPolicy QMqttClient::writeBufferPolicy() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.writeBufferPolicy();
+}
+
+/*!
+    Sets the behavior of publish() while the write buffer is full to \a policy. By default,
+    publishing fails until the write buffer drained.
+
+    With \l QueueWhenFull, messages published while the write buffer is full are kept in
+    order by the client and written as soon as writeBufferDrained() is emitted. If the
+    connection is closed before, these messages are kept and written once the broker
+    accepted the next connection, ahead of messages published later. The memory they take
+    is limited by writeBufferQueueLimit().
+ */
+void QMqttClient::setWriteBufferPolicy(WriteBufferPolicy policy)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setWriteBufferPolicy(policy);
+}
+
+/*!
+    Returns the maximum number of bytes of messages kept by the client while the write
+    buffer is full. The default is 16 MiB.
+
+    \sa setWriteBufferQueueLimit()
+ */
+qint64 QMqttClient::writeBufferQueueLimit() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.writeBufferQueueLimit();
+}
+
+/*!
+    Sets the maximum number of bytes of messages kept by the client while the write buffer
+    is full to \a bytes. This only applies to the \l QueueWhenFull policy. Once the
+    serialized messages kept reach the limit, publish() fails and returns -1 like with
+    \l RejectWhenFull. The limit covers the memory used in addition to the write buffer
+    of the transport, which is bounded by the high watermarks.
+
+    \sa setWriteBufferPolicy()
+ */
+void QMqttClient::setWriteBufferQueueLimit(qint64 bytes)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setWriteBufferQueueLimit(bytes);
+}
+
+/*!
+    Returns \c true if one of the high watermarks has been reached and the write buffer did
+    not drain yet.
+
+    \sa writeBufferFull(), writeBufferDrained()
+ */
+bool QMqttClient::isWriteBufferFull() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.isWriteBufferFull();
+}
+
+/*!
+    Returns the number of bytes passed to the transport or collected for coalescing, which
+    have not been written yet.
+ */
+qint64 QMqttClient::bytesToWrite() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.bytesToWrite();
+}
+
+/*!
+    Returns the number of packets which have not been written completely yet.
+
+    \sa bytesToWrite()
+ */
+int QMqttClient::packetsToWrite() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.packetsToWrite();
+}
+
+/*!
+    Returns the name of the file the session state is stored in, or an empty string if the
+    session state is only kept in memory.
+
+    \sa setSessionStoreFile()
+ */
+QString QMqttClient::sessionStoreFile() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.sessionStoreFile();
+}
+
+/*!
+    Stores the session state of the client in the file \a fileName. The state consists of
+    the QoS 1 and QoS 2 messages which have not been acknowledged by the broker, and the
+    identifiers of QoS 2 messages received but not released yet. An empty \a fileName
+    closes the file, the state is kept in memory only afterwards.
+
+    If the file contains the state of a previous run, it is restored. Restored messages are
+    sent again with the DUP flag set once the broker acknowledged the next connection, and
+    incoming QoS 2 messages received before are not delivered twice. Use this together with
+    \l cleanSession set to \c false.
+
+    The file is memory-mapped and updated without waiting for the data to reach the disk.
+    A message therefore survives a crash of the application, but not necessarily a crash
+    of the operating system.
+
+    Returns \c false if the file could not be opened, or if the client is not
+    disconnected or has messages in flight.
+
+    \sa sessionStoreFile()
+ */
+bool QMqttClient::setSessionStoreFile(const QString &fileName)
+{
+    Q_D(QMqttClient);
+    return d->m_connection.setSessionStoreFile(fileName);
+}
+
+/*!
+    Returns the number of bytes of messages the offline queue keeps in memory. 0 means the
+    queue does not keep messages in memory, which is the default.
+
+    \sa setOfflineQueueMemoryLimit()
+ */
+qint64 QMqttClient::offlineQueueMemoryLimit() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineQueue().memoryLimit();
+}
+
+/*!
+    Enables the offline queue and keeps up to \a bytes of messages in memory. The size of a
+    message is the size of its topic and payload.
+
+    While the client is not connected, publish() puts messages into the offline queue
+    instead of rejecting them. Once connected, the queued messages are published in the
+    order they have been queued, at the rate set with setOfflineQueueDrainRate(). Messages
+    published while the queue is not empty are queued as well, which keeps the order.
+
+    publish() returns 0 for every queued message. A packet identifier is only assigned when
+    the message is sent, and it is not reported to the application. messageSent() is
+    emitted for queued QoS 1 and QoS 2 messages as well, but its identifier cannot be
+    matched to a message. Do not use the offline queue if the delivery of individual
+    messages has to be tracked.
+
+    If the memory limit is reached, messages are written to the directory set with
+    setOfflineQueueDirectory(). Without a directory, publish() rejects them.
+
+    \sa setOfflineQueueDirectory(), offlineQueueDepth()
+ */
+void QMqttClient::setOfflineQueueMemoryLimit(qint64 bytes)
+{
+    Q_D(QMqttClient);
+    d->m_connection.offlineQueue().setMemoryLimit(bytes);
+}
+
+/*!
+    Returns the directory messages exceeding the memory limit of the offline queue are
+    written to.
+
+    \sa setOfflineQueueDirectory()
+ */
+QString QMqttClient::offlineQueueDirectory() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineQueue().directory();
+}
+
+/*!
+    Writes messages exceeding the memory limit of the offline queue to files in the
+    directory \a path. Setting a directory enables the offline queue. Once a message has
+    been written to the directory, all following messages are written there as well, until
+    the messages have been sent. Files are deleted once all messages in them have been sent.
+
+    Messages left in \a path by a previous run are added to the queue.
+
+    Returns \c false if the directory cannot be created, or if the current directory still
+    contains queued messages.
+
+    \sa setOfflineQueueDiskLimit(), setOfflineQueueMemoryLimit()
+ */
+bool QMqttClient::setOfflineQueueDirectory(const QString &path)
+{
+    Q_D(QMqttClient);
+    return d->m_connection.offlineQueue().setDirectory(path);
+}
+
+/*!
+    Returns the maximum number of bytes written to the offline queue directory. 0 means no
+    limit, which is the default.
+
+    \sa setOfflineQueueDiskLimit()
+ */
+qint64 QMqttClient::offlineQueueDiskLimit() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineQueue().diskLimit();
+}
+
+/*!
+    Limits the size of the files in the offline queue directory to \a bytes. If the limit is
+    reached, publish() rejects messages until the queue has been drained.
+
+    \sa setOfflineQueueDirectory()
+ */
+void QMqttClient::setOfflineQueueDiskLimit(qint64 bytes)
+{
+    Q_D(QMqttClient);
+    d->m_connection.offlineQueue().setDiskLimit(bytes);
+}
+
+/*!
+    Returns the number of queued messages published per second after connecting. 0 means
+    as fast as possible, which is the default.
+
+    \sa setOfflineQueueDrainRate()
+ */
+int QMqttClient::offlineQueueDrainRate() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineDrainRate();
+}
+
+/*!
+    Publishes at most \a messagesPerSecond queued messages per second after connecting, to
+    avoid flooding the broker after a long time offline. 0 removes the limit.
+
+    Independent of the rate, draining pauses while the write buffer is full.
+
+    \sa setWriteBufferHighWatermark()
+ */
+void QMqttClient::setOfflineQueueDrainRate(int messagesPerSecond)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setOfflineDrainRate(messagesPerSecond);
+}
+
+/*!
+    Keeps only the latest queued message of every topic matching \a filter if \a conflate
+    is \c true. This suits topics carrying a state, where only the current value matters.
+    Replaced messages are counted by offlineQueueDiscarded().
+
+    The setting applies to messages queued from now on.
+ */
+void QMqttClient::setOfflineQueueConflation(const QMqttTopicFilter &filter, bool conflate)
+{
+    Q_D(QMqttClient);
+    if (!filter.isValid()) {
+        qWarning("Invalid topic filter for offline queue conflation");
+        return;
+    }
+    d->m_connection.offlineQueue().setConflation(filter.toUtf8(), conflate);
+}
+
+/*!
+    Drops queued messages on topics matching \a filter if they could not be sent within
+    \a msecs milliseconds after they have been published. If several filters match a topic,
+    the shortest expiry applies. 0 removes the expiry of \a filter.
+
+    Expired messages are dropped when they would be sent and counted by
+    offlineQueueDiscarded(). The setting applies to messages queued from now on.
+ */
+void QMqttClient::setOfflineQueueExpiry(const QMqttTopicFilter &filter, int msecs)
+{
+    Q_D(QMqttClient);
+    if (!filter.isValid()) {
+        qWarning("Invalid topic filter for offline queue expiry");
+        return;
+    }
+    d->m_connection.offlineQueue().setExpiry(filter.toUtf8(), msecs);
+}
+
+/*!
+    Returns the number of messages in the offline queue.
+
+    \sa offlineQueueBytes()
+ */
+int QMqttClient::offlineQueueDepth() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineQueue().depth();
+}
+
+/*!
+    Returns the size of the topics and payloads of all messages in the offline queue.
+
+    \sa offlineQueueDepth(), offlineQueueDiskBytes()
+ */
+qint64 QMqttClient::offlineQueueBytes() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineQueue().bytes();
+}
+
+/*!
+    Returns the size of the files in the offline queue directory.
+
+    \sa setOfflineQueueDiskLimit()
+ */
+qint64 QMqttClient::offlineQueueDiskBytes() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineQueue().diskBytes();
+}
+
+/*!
+    Returns the number of queued messages which have been replaced by conflation or have
+    expired.
+
+    \sa setOfflineQueueConflation(), setOfflineQueueExpiry()
+ */
+int QMqttClient::offlineQueueDiscarded() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.offlineQueue().discarded();
+}
+
+/*!
+    Removes all messages from the offline queue, including the ones in the offline queue
+    directory.
+ */
+void QMqttClient::clearOfflineQueue()
+{
+    Q_D(QMqttClient);
+    d->m_connection.offlineQueue().clear();
+}
+
+/*!
+    Returns \c true if the client reconnects automatically after losing the connection.
+
+    \sa setAutoReconnect()
+ */
+bool QMqttClient::autoReconnect() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.autoReconnect();
+}
+
+/*!
+    Enables reconnecting automatically if \a enable is \c true. By default, the client stays
+    disconnected when the connection to the broker is lost.
+
+    With automatic reconnects, the client connects again if the connection is closed by the
+    transport or the broker, or a connection attempt fails, until disconnectFromHost() is
+    called. Attempts are delayed by an exponential backoff, starting at
+    reconnectMinimumInterval() and doubling up to reconnectMaximumInterval() with every
+    failed attempt. The actual delay is chosen randomly between half and all of the
+    backoff, so that clients dropped at the same time do not reconnect at the same time.
+    A broker rejecting the connection stops reconnecting, unless it reported being
+    unavailable.
+
+    After reconnecting, subscriptions unknown to the broker are restored with as few
+    SUBSCRIBE packets as possible. If the broker did not keep the session, these are all
+    subscriptions. The existing QMqttSubscription objects are kept and change to
+    QMqttSubscription::SubscriptionPending until the broker acknowledges them.
+
+    \sa setReconnectMinimumInterval(), setReconnectMaximumInterval()
+ */
+void QMqttClient::setAutoReconnect(bool enable)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setAutoReconnect(enable);
+}
+
+/*!
+    Returns the delay before the first automatic reconnect in milliseconds. The default
+    is 1000.
+
+    \sa setReconnectMinimumInterval()
+ */
+int QMqttClient::reconnectMinimumInterval() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.reconnectMinimumInterval();
+}
+
+/*!
+    Sets the delay before the first automatic reconnect to \a msecs milliseconds.
+
+    \sa setAutoReconnect()
+ */
+void QMqttClient::setReconnectMinimumInterval(int msecs)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setReconnectIntervals(msecs, d->m_connection.reconnectMaximumInterval());
+}
+
+/*!
+    Returns the maximum delay between automatic reconnects in milliseconds. The default
+    is 60000.
+
+    \sa setReconnectMaximumInterval()
+ */
+int QMqttClient::reconnectMaximumInterval() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.reconnectMaximumInterval();
+}
+
+/*!
+    Sets the maximum delay between automatic reconnects to \a msecs milliseconds. It is
+    never less than reconnectMinimumInterval().
+
+    \sa setAutoReconnect()
+ */
+void QMqttClient::setReconnectMaximumInterval(int msecs)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setReconnectIntervals(d->m_connection.reconnectMinimumInterval(), msecs);
+}
+
+/*!
+    Returns the handler called for every message received by the client.
+
+    \sa setMessageHandler()
+ */
+QMqttSubscription::MessageHandler QMqttClient::messageHandler() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.messageHandler();
+}
+
+/*!
+    Sets \a handler to be called for every message received by the client, regardless of
+    the subscription it matches. The handler is called directly, right before
+    messageReceived() is emitted, and receives the complete QMqttMessage.
+
+    Like QMqttSubscription::setMessageHandler(), this avoids the overhead of the signal for
+    clients with a high message rate. Passing an empty handler removes the current one.
+ */
+void QMqttClient::setMessageHandler(const QMqttSubscription::MessageHandler &handler)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setMessageHandler(handler);
+}
+
+/*!
+    Returns which receivers messages are dispatched to.
+
+    \sa setMessageDispatch()
+ */
+QMqttClient::MessageDispatch QMqttClient::messageDispatch() const
+{
+    Q_D(const QMqttClient);
+    return d->m_connection.messageDispatch();
+}
+
+/*!
+    Sets which receivers incoming messages are dispatched to. By default, a message is
+    reported by messageReceived() and by the subscriptions it matches.
+
+    With \l SubscriptionsOnly, messageReceived() is not emitted and the client-wide message
+    handler is not called, which saves preparing their arguments for every message. With
+    \l ClientOnly, incoming topics are not matched against the subscriptions and no
+    subscription receives messages, including streamed ones.
+
+    \sa setMessageHandler()
+ */
+void QMqttClient::setMessageDispatch(MessageDispatch dispatch)
+{
+    Q_D(QMqttClient);
+    d->m_connection.setMessageDispatch(dispatch);
+}
+
 QString QMqttClient::hostname() const
 {
     Q_D(const QMqttClient);
@@ -322,6 +1124,11 @@ quint16 QMqttClient::port() const
 
 /*!
     Initiates a connection to the MQTT broker.
+
+    The function returns immediately. The client enters the \l Connecting state while the
+    transport is opened and the broker acknowledges the connection, then changes to
+    \l Connected. If the connection cannot be established, the state changes back to
+    \l Disconnected. All changes are reported by stateChanged().
  */
 void QMqttClient::connectToHost()
 {
@@ -331,7 +1138,9 @@ void QMqttClient::connectToHost()
 /*!
     Initiates an encrypted connection to the MQTT broker.
 
-    \a sslPeerName specifies the peer name to be passed to the socket.
+    \a sslPeerName specifies the peer name to be passed to the socket. Like connectToHost(),
+    the function returns immediately and the CONNECT is sent once the encryption has been
+    established.
  */
 #ifndef QT_NO_SSL
 void QMqttClient::connectToHostEncrypted(const QString &sslPeerName)
@@ -349,11 +1158,17 @@ void QMqttClient::connectToHost(bool encrypted, const QString &sslPeerName)
         return;
     }
 
+    if (state() == QMqttClient::Connecting) {
+        qWarning("Already connecting to a broker. Rejecting connection request.");
+        return;
+    }
+
     if (!d->m_connection.ensureTransport(encrypted)) {
         qWarning("Could not ensure connection");
         setState(Disconnected);
         return;
     }
+    d->m_connection.setReconnectTarget(sslPeerName);
     setState(Connecting);
 
     if (!d->m_connection.ensureTransportOpen(sslPeerName)) {
@@ -361,26 +1176,47 @@ void QMqttClient::connectToHost(bool encrypted, const QString &sslPeerName)
         setState(Disconnected);
         return;
     }
-
-    if (!d->m_connection.sendControlConnect()) {
-        qWarning("Could not send CONNECT to broker");
-        // ### Who disconnects now? Connection or client?
-        setState(Disconnected);
-        return;
-    }
 }
 
 /*!
     Disconnect from the MQTT broker.
+
+    The function returns immediately. A socket transport is closed after all pending data
+    has been written, which is reported by stateChanged() and disconnected(). Calling this
+    function while connecting cancels the connection attempt. A pending automatic reconnect
+    is canceled as well.
+
+    The client unsubscribes from all topic filters first, see \l UnsubscribeAll.
  */
 void QMqttClient::disconnectFromHost()
 {
-    Q_D(QMqttClient);
+    disconnectFromHost(UnsubscribeAll);
+}
 
-    if (d->m_connection.internalState() != QMqttConnection::BrokerConnected)
-        return;
+/*!
+    \overload
+
+    Disconnects from the MQTT broker. \a mode specifies what happens to the subscriptions.
+    Unlike \l UnsubscribeAll, the other modes do not send anything but the DISCONNECT,
+    which makes disconnecting fast even with many subscriptions.
+ */
+void QMqttClient::disconnectFromHost(DisconnectMode mode)
+{
+    Q_D(QMqttClient);
 
-    d->m_connection.sendControlDisconnect();
+    d->m_connection.cancelReconnect();
+    switch (d->m_connection.internalState()) {
+    case QMqttConnection::BrokerConnected:
+        d->m_connection.sendControlDisconnect(mode);
+        break;
+    case QMqttConnection::BrokerConnecting:
+    case QMqttConnection::BrokerWaitForConnectAck:
+        // Cancels the pending connection attempt
+        d->m_connection.closeTransport();
+        break;
+    case QMqttConnection::BrokerDisconnected:
+        break;
+    }
 }
 
 QMqttClient::State QMqttClient::state() const
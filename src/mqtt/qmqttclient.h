@@ -24,9 +24,13 @@
 
 #include <QtMqtt/qmqttglobal.h>
 #include <QtMqtt/QMqttSubscription>
+#include <QtMqtt/QMqttTopicFilter>
+#include <QtMqtt/QMqttTopicName>
 
 #include <QtCore/QIODevice>
+#include <QtCore/QList>
 #include <QtCore/QObject>
+#include <QtCore/QPair>
 #include <QtCore/QSharedPointer>
 #include <QtNetwork/QTcpSocket>
 
@@ -51,6 +55,20 @@ public:
         MQTT_3_1 = 3,
         MQTT_3_1_1 = 4
     };
+    enum WriteBufferPolicy {
+        RejectWhenFull = 0,
+        QueueWhenFull
+    };
+    enum DisconnectMode {
+        UnsubscribeAll = 0,
+        DiscardSubscriptions,
+        KeepSubscriptions
+    };
+    enum MessageDispatch {
+        ClientAndSubscriptions = 0,
+        ClientOnly,
+        SubscriptionsOnly
+    };
 
 private:
     Q_OBJECT
@@ -75,12 +93,69 @@ public:
     QIODevice *transport() const;
 
     QSharedPointer<QMqttSubscription> subscribe(const QString& topic, quint8 qos = 0);
+    QSharedPointer<QMqttSubscription> subscribe(const QMqttTopicFilter &topic, quint8 qos = 0);
+    QList<QSharedPointer<QMqttSubscription>> subscribe(const QList<QPair<QMqttTopicFilter, quint8>> &topics);
     void unsubscribe(const QString& topic);
+    void unsubscribe(const QMqttTopicFilter &topic);
+    void unsubscribe(const QList<QMqttTopicFilter> &topics);
 
     Q_INVOKABLE qint32 publish(const QString &topic, const QByteArray& message = QByteArray(),
                  quint8 qos = 0, bool retain = false);
+    qint32 publish(const QMqttTopicName &topic, const QByteArray &message = QByteArray(),
+                   quint8 qos = 0, bool retain = false);
     bool requestPing();
 
+    bool writeCoalescing() const;
+    void setWriteCoalescing(bool enable);
+    bool flush();
+
+    qint64 writeBufferHighWatermark() const;
+    void setWriteBufferHighWatermark(qint64 bytes);
+    qint64 writeBufferLowWatermark() const;
+    void setWriteBufferLowWatermark(qint64 bytes);
+    int writeBufferPacketHighWatermark() const;
+    void setWriteBufferPacketHighWatermark(int packets);
+    int writeBufferPacketLowWatermark() const;
+    void setWriteBufferPacketLowWatermark(int packets);
+    WriteBufferPolicy writeBufferPolicy() const;
+    void setWriteBufferPolicy(WriteBufferPolicy policy);
+    qint64 writeBufferQueueLimit() const;
+    void setWriteBufferQueueLimit(qint64 bytes);
+    bool isWriteBufferFull() const;
+    qint64 bytesToWrite() const;
+    int packetsToWrite() const;
+
+    QString sessionStoreFile() const;
+    bool setSessionStoreFile(const QString &fileName);
+
+    qint64 offlineQueueMemoryLimit() const;
+    void setOfflineQueueMemoryLimit(qint64 bytes);
+    QString offlineQueueDirectory() const;
+    bool setOfflineQueueDirectory(const QString &path);
+    qint64 offlineQueueDiskLimit() const;
+    void setOfflineQueueDiskLimit(qint64 bytes);
+    int offlineQueueDrainRate() const;
+    void setOfflineQueueDrainRate(int messagesPerSecond);
+    void setOfflineQueueConflation(const QMqttTopicFilter &filter, bool conflate = true);
+    void setOfflineQueueExpiry(const QMqttTopicFilter &filter, int msecs);
+    int offlineQueueDepth() const;
+    qint64 offlineQueueBytes() const;
+    qint64 offlineQueueDiskBytes() const;
+    int offlineQueueDiscarded() const;
+    void clearOfflineQueue();
+
+    bool autoReconnect() const;
+    void setAutoReconnect(bool enable);
+    int reconnectMinimumInterval() const;
+    void setReconnectMinimumInterval(int msecs);
+    int reconnectMaximumInterval() const;
+    void setReconnectMaximumInterval(int msecs);
+
+    QMqttSubscription::MessageHandler messageHandler() const;
+    void setMessageHandler(const QMqttSubscription::MessageHandler &handler);
+    MessageDispatch messageDispatch() const;
+    void setMessageDispatch(MessageDispatch dispatch);
+
     QString hostname() const;
     quint16 port() const;
     QString clientId() const;
@@ -92,6 +167,7 @@ public:
     Q_INVOKABLE void connectToHostEncrypted(const QString &sslPeerName = QString());
 #endif
     Q_INVOKABLE void disconnectFromHost();
+    void disconnectFromHost(DisconnectMode mode);
 
     State state() const;
 
@@ -111,6 +187,8 @@ Q_SIGNALS:
     void messageSent(qint32 id);
     void pingResponseReceived();
     void brokerSessionRestored();
+    void writeBufferFull();
+    void writeBufferDrained();
 
     void hostnameChanged(QString hostname);
     void portChanged(quint16 port);
@@ -145,6 +223,7 @@ public Q_SLOTS:
 
 private:
     void connectToHost(bool encrypted, const QString &sslPeerName);
+    friend class QMqttConnection;
     Q_DISABLE_COPY(QMqttClient)
     Q_DECLARE_PRIVATE(QMqttClient)
 };
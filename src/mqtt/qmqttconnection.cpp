@@ -22,35 +22,79 @@
 #include "qmqttconnection_p.h"
 #include "qmqttcontrolpacket_p.h"
 #include "qmqttsubscription_p.h"
+#include "qmqtttopicname_p.h"
 
+#include <QtCore/QHash>
 #include <QtCore/QLoggingCategory>
+#include <QtCore/QMetaMethod>
+#include <QtCore/QSet>
 #include <QtNetwork/QSslSocket>
 #include <QtNetwork/QTcpSocket>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
 #include <QtCore/QRandomGenerator>
 #endif
 
-#include <limits>
-#include <cstdint>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <sys/uio.h>
+#endif
 
 QT_BEGIN_NAMESPACE
 
 Q_LOGGING_CATEGORY(lcMqttConnection, "qt.mqtt.connection")
 Q_LOGGING_CATEGORY(lcMqttConnectionVerbose, "qt.mqtt.connection.verbose");
 
+// Payloads of this size are written separately from their frame header
+static const int scatterGatherThreshold = 64 * 1024;
+// Messages sent from the offline queue per event loop iteration without a
+// drain rate
+static const int offlineDrainBatchSize = 1000;
+// Requests for many topic filters are split into SUBSCRIBE and UNSUBSCRIBE
+// packets of about this size
+static const int subscriptionBatchSize = 64 * 1024;
+// Time an owned socket gets to send its pending data after the connection
+// has been destroyed
+static const int closingSocketTimeout = 30000;
+
 QMqttConnection::QMqttConnection(QObject *parent) : QObject(parent)
 {
     m_pingTimer.setSingleShot(false);
     m_pingTimer.connect(&m_pingTimer, &QTimer::timeout, this, &QMqttConnection::sendControlPingRequest);
+
+    // Flushes the packets corked during one event loop iteration
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(0);
+    m_flushTimer.connect(&m_flushTimer, &QTimer::timeout, this, &QMqttConnection::flush);
+
+    m_offlineDrainTimer.setSingleShot(false);
+    m_offlineDrainTimer.connect(&m_offlineDrainTimer, &QTimer::timeout, this, &QMqttConnection::drainOfflineQueue);
+
+    m_reconnectTimer.setSingleShot(true);
+    m_reconnectTimer.connect(&m_reconnectTimer, &QTimer::timeout, this, &QMqttConnection::reconnect);
 }
 
 QMqttConnection::~QMqttConnection()
 {
+    m_reconnectWanted = false;
     if (m_internalState == BrokerConnected)
         sendControlDisconnect();
 
-    if (m_ownTransport && m_transport)
+    if (m_ownTransport && m_transport) {
+        // Deleting the socket would abort it. It is kept until the DISCONNECT
+        // and everything queued before have been written.
+        auto socket = qobject_cast<QAbstractSocket *>(m_transport);
+        if (socket && socket->state() != QAbstractSocket::UnconnectedState) {
+            socket->disconnect(this);
+            connect(socket, &QAbstractSocket::disconnected, socket, &QObject::deleteLater);
+            connect(socket, static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+                    socket, &QObject::deleteLater);
+            QTimer::singleShot(closingSocketTimeout, socket, &QObject::deleteLater);
+            return;
+        }
         delete m_transport;
+    }
 }
 
 void QMqttConnection::setTransport(QIODevice *device, QMqttClient::TransportType transport)
@@ -60,6 +104,7 @@ void QMqttConnection::setTransport(QIODevice *device, QMqttClient::TransportType
     if (m_transport) {
         disconnect(m_transport, &QIODevice::aboutToClose, this, &QMqttConnection::transportConnectionClosed);
         disconnect(m_transport, &QIODevice::readyRead, this, &QMqttConnection::transportReadReady);
+        disconnect(m_transport, &QIODevice::bytesWritten, this, &QMqttConnection::transportBytesWritten);
         if (m_ownTransport)
             delete m_transport;
     }
@@ -70,6 +115,9 @@ void QMqttConnection::setTransport(QIODevice *device, QMqttClient::TransportType
 
     connect(m_transport, &QIODevice::aboutToClose, this, &QMqttConnection::transportConnectionClosed);
     connect(m_transport, &QIODevice::readyRead, this, &QMqttConnection::transportReadReady);
+    connect(m_transport, &QIODevice::bytesWritten, this, &QMqttConnection::transportBytesWritten);
+    if (m_transportType != QMqttClient::IODevice)
+        connectSocketSignals();
 }
 
 QIODevice *QMqttConnection::transport() const
@@ -98,53 +146,68 @@ bool QMqttConnection::ensureTransport(bool createSecureIfNeeded)
     m_ownTransport = true;
     m_transportType = createSecureIfNeeded ? QMqttClient::SecureSocket : QMqttClient::AbstractSocket;
 
-    connect(socket, &QAbstractSocket::disconnected, this, &QMqttConnection::transportConnectionClosed);
     connect(m_transport, &QIODevice::aboutToClose, this, &QMqttConnection::transportConnectionClosed);
     connect(m_transport, &QIODevice::readyRead, this, &QMqttConnection::transportReadReady);
+    connect(m_transport, &QIODevice::bytesWritten, this, &QMqttConnection::transportBytesWritten);
+    connectSocketSignals();
     return true;
 }
 
+void QMqttConnection::connectSocketSignals()
+{
+    auto socket = qobject_cast<QAbstractSocket *>(m_transport);
+    if (!socket)
+        return;
+
+    connect(socket, &QAbstractSocket::disconnected, this, &QMqttConnection::transportConnectionClosed,
+            Qt::UniqueConnection);
+    connect(socket, static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
+            this, &QMqttConnection::transportError, Qt::UniqueConnection);
+#ifndef QT_NO_SSL
+    // The CONNECT is sent once the socket is ready to transport data
+    if (m_transportType == QMqttClient::SecureSocket) {
+        if (auto sslSocket = qobject_cast<QSslSocket *>(socket)) {
+            connect(sslSocket, &QSslSocket::encrypted, this, &QMqttConnection::transportConnected,
+                    Qt::UniqueConnection);
+        }
+        return;
+    }
+#endif
+    connect(socket, &QAbstractSocket::connected, this, &QMqttConnection::transportConnected,
+            Qt::UniqueConnection);
+}
+
+// Opens the transport without blocking. The CONNECT is sent from
+// transportConnected(), either right away or once the socket is connected.
 bool QMqttConnection::ensureTransportOpen(const QString &sslPeerName)
 {
     qCDebug(lcMqttConnection) << Q_FUNC_INFO << m_transportType;
 
-    if (m_transportType == QMqttClient::IODevice) {
-        if (m_transport->isOpen())
-            return true;
+    m_internalState = BrokerConnecting;
 
-        if (m_transport->open(QIODevice::ReadWrite)) {
+    if (m_transportType == QMqttClient::IODevice) {
+        if (!m_transport->isOpen() && !m_transport->open(QIODevice::ReadWrite)) {
             qWarning("Could not open Transport IO device");
+            m_internalState = BrokerDisconnected;
             return false;
         }
+        transportConnected();
     } else if (m_transportType == QMqttClient::AbstractSocket) {
-        auto socket = dynamic_cast<QTcpSocket*>(m_transport);
+        auto socket = qobject_cast<QAbstractSocket *>(m_transport);
         Q_ASSERT(socket);
         if (socket->state() == QAbstractSocket::ConnectedState)
-            return true;
-
-        socket->connectToHost(m_client->hostname(), m_client->port());
-        if (!socket->waitForConnected()) {
-            qWarning("Could not establish socket connection for transport");
-            return false;
-        }
+            transportConnected();
+        else if (socket->state() == QAbstractSocket::UnconnectedState)
+            socket->connectToHost(m_client->hostname(), m_client->port());
     }
 #ifndef QT_NO_SSL
     else if (m_transportType == QMqttClient::SecureSocket) {
-        auto socket = dynamic_cast<QSslSocket*>(m_transport);
+        auto socket = qobject_cast<QSslSocket *>(m_transport);
         Q_ASSERT(socket);
-        if (socket->state() == QAbstractSocket::ConnectedState)
-            return true;
-
-        socket->connectToHostEncrypted(m_client->hostname(), m_client->port(), sslPeerName);
-        if (!socket->waitForConnected()) {
-            qWarning("Could not establish socket connection for transport");
-            return false;
-        }
-
-        if (!socket->waitForEncrypted()) {
-            qWarning("Could not initiate encryption.");
-            return false;
-        }
+        if (socket->isEncrypted())
+            transportConnected();
+        else if (socket->state() == QAbstractSocket::UnconnectedState)
+            socket->connectToHostEncrypted(m_client->hostname(), m_client->port(), sslPeerName);
     }
 #else
     Q_UNUSED(sslPeerName);
@@ -153,6 +216,61 @@ bool QMqttConnection::ensureTransportOpen(const QString &sslPeerName)
     return true;
 }
 
+void QMqttConnection::transportConnected()
+{
+    qCDebug(lcMqttConnection) << Q_FUNC_INFO;
+
+    if (m_internalState != BrokerConnecting)
+        return;
+
+    // Requests made while connecting follow the CONNECT in the same write,
+    // MQTT-3.1.4 allows them before the CONNACK has been received.
+    const bool coalescing = m_writeCoalescing;
+    m_writeCoalescing = true;
+    bool written = sendControlConnect();
+    if (!written)
+        qWarning("Could not send CONNECT to broker");
+
+    const QVector<QMqttControlPacket> pipelined = m_pipelinedPackets;
+    m_pipelinedPackets.clear();
+    for (int i = 0; written && i < pipelined.size(); ++i)
+        written = writePacketToTransport(pipelined.at(i));
+    if (!pipelined.isEmpty())
+        qCDebug(lcMqttConnection) << "Pipelined" << pipelined.size() << "packets after CONNECT";
+
+    m_writeCoalescing = coalescing;
+    if (!flush() || !written)
+        closeTransport();
+}
+
+void QMqttConnection::transportError(QAbstractSocket::SocketError error)
+{
+    qCDebug(lcMqttConnection) << Q_FUNC_INFO << error;
+
+    if (m_internalState != BrokerConnecting)
+        return;
+
+    // The connection could not be established, a closed connection is
+    // reported via disconnected()
+    qWarning("Could not establish socket connection for transport");
+    closeTransport();
+}
+
+void QMqttConnection::closeTransport()
+{
+    qCDebug(lcMqttConnection) << Q_FUNC_INFO;
+
+    rollbackPipelinedRequests();
+    clearDirectSegments();
+    m_internalState = BrokerDisconnected;
+    if (auto socket = qobject_cast<QAbstractSocket *>(m_transport))
+        socket->abort();
+    else if (m_transport)
+        m_transport->close();
+    m_client->setState(QMqttClient::Disconnected);
+    scheduleReconnect();
+}
+
 bool QMqttConnection::sendControlConnect()
 {
     qCDebug(lcMqttConnection) << Q_FUNC_INFO;
@@ -234,13 +352,32 @@ bool QMqttConnection::sendControlConnect()
     return true;
 }
 
+qint32 QMqttConnection::sendControlPublish(const QMqttTopicName &topic, const QByteArray &message, quint8 qos, bool retain)
+{
+    // Covers wildcards and the maximum length, validated once by QMqttTopicName
+    if (!topic.isValid())
+        return -1;
+    return writePublish(topic.toUtf8(), message, qos, retain);
+}
+
+// For topics passed as a string, which are not worth creating a QMqttTopicName for
 qint32 QMqttConnection::sendControlPublish(const QString &topic, const QByteArray &message, quint8 qos, bool retain)
+{
+    const QByteArray topicUtf8 = topic.toUtf8();
+    if (!QMqttTopicNamePrivate::isValid(topicUtf8))
+        return -1;
+    return writePublish(topicUtf8, message, qos, retain);
+}
+
+qint32 QMqttConnection::writePublish(const QByteArray &topic, const QByteArray &message, quint8 qos, bool retain)
 {
     qCDebug(lcMqttConnection) << Q_FUNC_INFO << topic << " Size:" << message.size() << " bytes."
                               << "QoS:" << qos << " Retain:" << retain;
 
-    if (topic.contains(QLatin1Char('#')) || topic.contains('+'))
+    if (m_writeBufferFull && m_writeBufferPolicy == QMqttClient::RejectWhenFull) {
+        qCDebug(lcMqttConnection) << "Write buffer full, rejecting message";
         return -1;
+    }
 
     quint8 header = QMqttControlPacket::PUBLISH;
     if (qos == 1)
@@ -251,37 +388,64 @@ qint32 QMqttConnection::sendControlPublish(const QString &topic, const QByteArra
     if (retain)
         header |= 0x01;
 
-    QSharedPointer<QMqttControlPacket> packet(new QMqttControlPacket(header));
-
-    QByteArray topicArray = topic.toUtf8();
-    const std::uint16_t u16max = std::numeric_limits<std::uint16_t>::max();
-    if (topicArray.size() > u16max) {
-        qWarning("Published topic is too long. Need to truncate");
-        topicArray.truncate(u16max);
-    }
+    QMqttControlPacket packet(header);
 
-    packet->append(topicArray);
+    packet.append(topic);
     quint16 identifier = 0;
     if (qos > 0) {
         // Add Packet Identifier
-        static quint16 publishIdCounter = 0;
-        if (publishIdCounter + 1 == u16max)
-            publishIdCounter = 0;
-        else
-            publishIdCounter++;
+        identifier = m_packetIds.allocate();
+        if (!identifier) {
+            qWarning("No packet identifier available, too many messages in flight");
+            return -1;
+        }
+        packet.append(identifier);
+    }
+    packet.appendRaw(message);
+
+    // Too big to be encoded, checked before anything keeps the packet
+    if (packet.exceedsMaximumSize()) {
+        m_packetIds.release(identifier);
+        return -1;
+    }
 
-        identifier = publishIdCounter;
-        packet->append(identifier);
+    // Messages queued before have to be written first to keep the order
+    if (m_writeBufferFull || !m_queuedPublishes.isEmpty()) {
+        // Written once the transport drained below the low watermarks
+        const qint64 size = packet.serializedSize();
+        if (m_queuedPublishBytes + size > m_writeBufferQueueLimit) {
+            qCDebug(lcMqttConnection) << "Write buffer queue full, rejecting message";
+            m_packetIds.release(identifier);
+            return -1;
+        }
+        if (qos) {
+            m_pendingMessages.insert(identifier, packet);
+            if (m_sessionStore.isOpen())
+                m_sessionStore.storePublish(identifier, packet);
+        }
+        m_queuedPublishes.enqueue({identifier, packet});
+        m_queuedPublishBytes += size;
+        return identifier;
     }
-    packet->appendRaw(message);
 
-    if (qos)
+    if (qos) {
         m_pendingMessages.insert(identifier, packet);
+        if (m_sessionStore.isOpen())
+            m_sessionStore.storePublish(identifier, packet);
+        // Sent while connecting, not to be sent again after the CONNACK
+        if (m_internalState != BrokerConnected)
+            m_pipelinedPublishes.insert(identifier, true);
+    }
 
-    const bool written = writePacketToTransport(*packet.data());
+    const bool written = writePacketToTransport(packet);
 
-    if (!written)
+    if (!written && qos) {
         m_pendingMessages.remove(identifier);
+        m_pipelinedPublishes.remove(identifier);
+        m_packetIds.release(identifier);
+        if (m_sessionStore.isOpen())
+            m_sessionStore.storeComplete(identifier);
+    }
     return written ? identifier : -1;
 }
 
@@ -320,104 +484,284 @@ bool QMqttConnection::sendControlPublishComp(quint16 id)
     return writePacketToTransport(packet);
 }
 
-QSharedPointer<QMqttSubscription> QMqttConnection::sendControlSubscribe(const QString &topic, quint8 qos)
+QSharedPointer<QMqttSubscription> QMqttConnection::sendControlSubscribe(const QMqttTopicFilter &topic, quint8 qos)
 {
-    qCDebug(lcMqttConnection) << Q_FUNC_INFO << " Topic:" << topic << " qos:" << qos;
-
-    if (m_activeSubscriptions.contains(topic))
-        return m_activeSubscriptions[topic];
+    return sendControlSubscribe(QList<QPair<QMqttTopicFilter, quint8>>() << qMakePair(topic, qos)).first();
+}
 
-    // has to have 0010 as bits 3-0, maybe update SUBSCRIBE instead?
-    // MQTT-3.8.1-1
-    const quint8 header = QMqttControlPacket::SUBSCRIBE + 0x02;
-    QMqttControlPacket packet(header);
+// Subscribes to all topic filters with as few SUBSCRIBE packets as possible.
+// Returns one subscription per topic filter, a null pointer for the invalid
+// ones and the ones which could not be sent.
+QList<QSharedPointer<QMqttSubscription>> QMqttConnection::sendControlSubscribe(const QList<QPair<QMqttTopicFilter, quint8>> &topics)
+{
+    qCDebug(lcMqttConnection) << Q_FUNC_INFO << " Topics:" << topics.size();
 
-    // Add Packet Identifier
-    const quint16 identifier =
-#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
-            qrand();
-#else
-            QRandomGenerator::get32();
-#endif
+    QList<QSharedPointer<QMqttSubscription>> result;
+    result.reserve(topics.size());
+    QVector<QSharedPointer<QMqttSubscription>> created;
+    QHash<QString, QSharedPointer<QMqttSubscription>> createdByFilter;
 
-    packet.append(identifier);
+    for (const auto &topic : topics) {
+        const QString &filter = topic.first.filter();
+        if (m_activeSubscriptions.contains(filter)) {
+            result.append(m_activeSubscriptions.value(filter));
+            continue;
+        }
+        if (createdByFilter.contains(filter)) {
+            result.append(createdByFilter.value(filter));
+            continue;
+        }
 
-    // Overflow protection
-    QByteArray topicArray = topic.toUtf8();
-    if (topicArray.size() > std::numeric_limits<std::uint16_t>::max()) {
-        qWarning("Subscribed topic is too long.");
-        return QSharedPointer<QMqttSubscription>();
-    }
+        // Also covers the maximum length, MQTT-4.7.3-3
+        if (!topic.first.isValid()) {
+            qWarning("Invalid topic filter.");
+            result.append(QSharedPointer<QMqttSubscription>());
+            continue;
+        }
 
-    packet.append(topicArray);
+        if (topic.second > 2) {
+            result.append(QSharedPointer<QMqttSubscription>());
+            continue;
+        }
 
-    switch (qos) {
-    case 0: packet.append(char(0x0)); break;
-    case 1: packet.append(char(0x1)); break;
-    case 2: packet.append(char(0x2)); break;
-    default: return QSharedPointer<QMqttSubscription>();
+        QSharedPointer<QMqttSubscription> sub(new QMqttSubscription);
+        sub->setTopic(topic.first);
+        sub->setClient(m_client);
+        sub->setQos(topic.second);
+        created.append(sub);
+        createdByFilter.insert(filter, sub);
+        result.append(sub);
     }
 
-    QSharedPointer<QMqttSubscription> result(new QMqttSubscription);
-    result->setTopic(QString::fromUtf8(topicArray));
-    result->setClient(m_client);
-    result->setQos(qos);
-    result->setState(QMqttSubscription::SubscriptionPending);
-
-    if (!writePacketToTransport(packet))
-        return QSharedPointer<QMqttSubscription>();
-
-    // SUBACK must contain identifier MQTT-3.8.4-2
-    m_pendingSubscriptionAck.insert(identifier, result);
-    m_activeSubscriptions.insert(result->topic(), result);
+    const int written = writeSubscriptionRequests(QMqttControlPacket::SUBSCRIBE, created);
+    for (int i = 0; i < written; ++i) {
+        const auto &sub = created.at(i);
+        m_activeSubscriptions.insert(sub->topic(), sub);
+        m_subscriptionTrie.insert(sub->d_func()->m_topic.toUtf8(), sub);
+    }
+    if (written < created.size()) {
+        for (auto &sub : result) {
+            if (sub && !m_activeSubscriptions.contains(sub->topic()))
+                sub.reset();
+        }
+    }
     return result;
 }
 
-bool QMqttConnection::sendControlUnsubscribe(const QString &topic)
+// Sends one SUBSCRIBE for all subscriptions, which are acknowledged by a
+// single SUBACK
+bool QMqttConnection::writeSubscribe(const QVector<QSharedPointer<QMqttSubscription>> &subscriptions)
 {
-    qCDebug(lcMqttConnection) << Q_FUNC_INFO << " Topic:" << topic;
+    // has to have 0010 as bits 3-0, maybe update SUBSCRIBE instead?
+    // MQTT-3.8.1-1
+    const quint8 header = QMqttControlPacket::SUBSCRIBE + 0x02;
+    QMqttControlPacket packet(header);
 
-    // MQTT-3.10.3-2
-    if (topic.isEmpty())
+    // Add Packet Identifier
+    const quint16 identifier = m_packetIds.allocate();
+    if (!identifier) {
+        qWarning("No packet identifier available, too many requests in flight");
         return false;
+    }
 
-    if (!m_activeSubscriptions.contains(topic))
-        return false;
+    packet.append(identifier);
+    for (const auto &sub : subscriptions) {
+        packet.append(sub->d_func()->m_topic.toUtf8());
+        packet.append(char(sub->qos()));
+    }
 
-    if (m_internalState != QMqttConnection::BrokerConnected) {
-        m_activeSubscriptions.remove(topic);
-        return true;
+    if (!writePacketToTransport(packet)) {
+        m_packetIds.release(identifier);
+        return false;
     }
 
+    for (const auto &sub : subscriptions)
+        sub->setState(QMqttSubscription::SubscriptionPending);
+    // SUBACK must contain identifier MQTT-3.8.4-2
+    m_pendingSubscriptionAck.insert(identifier, subscriptions);
+    return true;
+}
+
+// Sends one UNSUBSCRIBE for all subscriptions, which are acknowledged by a
+// single UNSUBACK
+bool QMqttConnection::writeUnsubscribe(const QVector<QSharedPointer<QMqttSubscription>> &subscriptions)
+{
     // has to have 0010 as bits 3-0, maybe update UNSUBSCRIBE instead?
     // MQTT-3.10.1-1
     const quint8 header = QMqttControlPacket::UNSUBSCRIBE + 0x02;
     QMqttControlPacket packet(header);
 
     // Add Packet Identifier
-    const quint16 identifier =
-#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
-            qrand();
-#else
-            QRandomGenerator::get32();
-#endif
+    const quint16 identifier = m_packetIds.allocate();
+    if (!identifier) {
+        qWarning("No packet identifier available, too many requests in flight");
+        return false;
+    }
 
     packet.append(identifier);
+    for (const auto &sub : subscriptions)
+        packet.append(sub->d_func()->m_topic.toUtf8());
 
-    packet.append(topic.toUtf8());
-    auto sub = m_activeSubscriptions[topic];
-    sub->setState(QMqttSubscription::UnsubscriptionPending);
-
-    if (!writePacketToTransport(packet))
+    if (!writePacketToTransport(packet)) {
+        m_packetIds.release(identifier);
         return false;
+    }
 
+    for (const auto &sub : subscriptions)
+        sub->setState(QMqttSubscription::UnsubscriptionPending);
     // Do not remove from m_activeSubscriptions as there might be QoS1/2 messages to still
     // be sent before UNSUBSCRIBE is acknowledged.
-    m_pendingUnsubscriptions.insert(identifier, sub);
-
+    m_pendingUnsubscriptions.insert(identifier, subscriptions);
     return true;
 }
 
+// Splits the requests into packets of about subscriptionBatchSize. Returns
+// how many subscriptions have been sent, in order.
+int QMqttConnection::writeSubscriptionRequests(QMqttControlPacket::PacketType type,
+                                               const QVector<QSharedPointer<QMqttSubscription>> &subscriptions)
+{
+    // Each topic filter is prefixed by its length, a SUBSCRIBE adds the QoS
+    const int overhead = type == QMqttControlPacket::SUBSCRIBE ? 3 : 2;
+    auto write = [this, type](const QVector<QSharedPointer<QMqttSubscription>> &batch) {
+        return type == QMqttControlPacket::SUBSCRIBE ? writeSubscribe(batch) : writeUnsubscribe(batch);
+    };
+
+    int begin = 0;
+    int batchSize = 0;
+    for (int i = 0; i < subscriptions.size(); ++i) {
+        const int size = subscriptions.at(i)->d_func()->m_topic.toUtf8().size() + overhead;
+        if (i > begin && batchSize + size > subscriptionBatchSize) {
+            if (!write(subscriptions.mid(begin, i - begin)))
+                return begin;
+            begin = i;
+            batchSize = 0;
+        }
+        batchSize += size;
+    }
+    if (begin < subscriptions.size() && !write(subscriptions.mid(begin)))
+        return begin;
+    return subscriptions.size();
+}
+
+// Restores the subscriptions the broker does not know about, all of them if
+// it did not keep the session
+void QMqttConnection::resubscribe(bool sessionPresent)
+{
+    // Subscriptions requested while connecting are on their way already
+    QSet<QMqttSubscription *> requested;
+    m_pendingSubscriptionAck.forEach([&requested](quint16, const QVector<QSharedPointer<QMqttSubscription>> &subscriptions) {
+        for (const auto &sub : subscriptions)
+            requested.insert(sub.data());
+    });
+
+    QVector<QSharedPointer<QMqttSubscription>> subscriptions;
+    for (const auto &sub : qAsConst(m_activeSubscriptions)) {
+        if (sessionPresent && sub->state() == QMqttSubscription::Subscribed)
+            continue;
+        if (sub->state() == QMqttSubscription::UnsubscriptionPending || requested.contains(sub.data()))
+            continue;
+        subscriptions.append(sub);
+    }
+    if (subscriptions.isEmpty())
+        return;
+
+    qCDebug(lcMqttConnection) << "Restoring" << subscriptions.size() << "subscriptions";
+    if (writeSubscriptionRequests(QMqttControlPacket::SUBSCRIBE, subscriptions) < subscriptions.size())
+        qWarning("Could not restore subscriptions");
+}
+
+// The broker will not answer requests of a closed connection
+void QMqttConnection::abortSubscriptionRequests()
+{
+    m_pendingSubscriptionAck.forEach([this](quint16 id, const QVector<QSharedPointer<QMqttSubscription>> &) {
+        m_packetIds.release(id);
+    });
+    m_pendingSubscriptionAck.clear();
+
+    QVector<QSharedPointer<QMqttSubscription>> unsubscribed;
+    m_pendingUnsubscriptions.forEach([this, &unsubscribed](quint16 id, const QVector<QSharedPointer<QMqttSubscription>> &subscriptions) {
+        m_packetIds.release(id);
+        unsubscribed += subscriptions;
+    });
+    m_pendingUnsubscriptions.clear();
+    forgetSubscriptions(unsubscribed);
+}
+
+// Slots connected to stateChanged() might subscribe or unsubscribe, hence
+// the tables of requests must not be iterated anymore.
+void QMqttConnection::forgetSubscriptions(const QVector<QSharedPointer<QMqttSubscription>> &subscriptions)
+{
+    for (const auto &sub : subscriptions) {
+        m_activeSubscriptions.remove(sub->topic());
+        m_subscriptionTrie.remove(sub->d_func()->m_topic.toUtf8());
+    }
+    for (const auto &sub : subscriptions)
+        sub->setState(QMqttSubscription::Unsubscribed);
+}
+
+// Requests made while connecting never reached a session if the connection
+// could not be established or the broker rejected it
+void QMqttConnection::rollbackPipelinedRequests()
+{
+    m_pipelinedPackets.clear();
+
+    m_pipelinedPublishes.forEach([this](quint16 id, bool) {
+        if (!m_pendingMessages.remove(id))
+            return;
+        m_packetIds.release(id);
+        if (m_sessionStore.isOpen())
+            m_sessionStore.storeComplete(id);
+    });
+    m_pipelinedPublishes.clear();
+
+    QVector<QSharedPointer<QMqttSubscription>> subscribed;
+    m_pendingSubscriptionAck.forEach([this, &subscribed](quint16 id, const QVector<QSharedPointer<QMqttSubscription>> &subscriptions) {
+        m_packetIds.release(id);
+        subscribed += subscriptions;
+    });
+    m_pendingSubscriptionAck.clear();
+    forgetSubscriptions(subscribed);
+}
+
+bool QMqttConnection::sendControlUnsubscribe(const QMqttTopicFilter &topic)
+{
+    return sendControlUnsubscribe(QList<QMqttTopicFilter>() << topic);
+}
+
+// Unsubscribes from all topic filters with as few UNSUBSCRIBE packets as
+// possible. Returns false if one of them is not subscribed or could not be
+// sent.
+bool QMqttConnection::sendControlUnsubscribe(const QList<QMqttTopicFilter> &topics)
+{
+    qCDebug(lcMqttConnection) << Q_FUNC_INFO << " Topics:" << topics.size();
+
+    bool result = true;
+    QVector<QSharedPointer<QMqttSubscription>> subscriptions;
+    for (const auto &topic : topics) {
+        // MQTT-3.10.3-2
+        const auto sub = topic.isValid() ? m_activeSubscriptions.value(topic.filter())
+                                         : QSharedPointer<QMqttSubscription>();
+        if (!sub) {
+            result = false;
+            continue;
+        }
+
+        // A subscription kept while disconnected is only forgotten locally.
+        // While connecting the UNSUBSCRIBE is pipelined like the SUBSCRIBE.
+        if (m_internalState == QMqttConnection::BrokerDisconnected) {
+            m_activeSubscriptions.remove(topic.filter());
+            m_subscriptionTrie.remove(topic.toUtf8());
+            sub->setState(QMqttSubscription::Unsubscribed);
+            continue;
+        }
+        subscriptions.append(sub);
+    }
+
+    if (writeSubscriptionRequests(QMqttControlPacket::UNSUBSCRIBE, subscriptions) < subscriptions.size())
+        return false;
+    return result;
+}
+
 bool QMqttConnection::sendControlPingRequest()
 {
     qCDebug(lcMqttConnection) << Q_FUNC_INFO;
@@ -433,29 +777,46 @@ bool QMqttConnection::sendControlPingRequest()
     return true;
 }
 
-bool QMqttConnection::sendControlDisconnect()
+bool QMqttConnection::sendControlDisconnect(QMqttClient::DisconnectMode mode)
 {
-    qCDebug(lcMqttConnection) << Q_FUNC_INFO;
+    qCDebug(lcMqttConnection) << Q_FUNC_INFO << mode;
 
     m_pingTimer.stop();
 
-    for (auto sub : m_activeSubscriptions)
-        sub->unsubscribe();
-    m_activeSubscriptions.clear();
+    switch (mode) {
+    case QMqttClient::UnsubscribeAll: {
+        const auto subscriptions = m_activeSubscriptions.values().toVector();
+        if (writeSubscriptionRequests(QMqttControlPacket::UNSUBSCRIBE, subscriptions) < subscriptions.size())
+            qWarning("Could not unsubscribe from all topics");
+        Q_FALLTHROUGH();
+    }
+    case QMqttClient::DiscardSubscriptions:
+        // The broker does not answer once it received the DISCONNECT
+        forgetSubscriptions(m_activeSubscriptions.values().toVector());
+        break;
+    case QMqttClient::KeepSubscriptions:
+        // Restored by the next connection, unless the broker kept them
+        break;
+    }
 
     const QMqttControlPacket packet(QMqttControlPacket::DISCONNECT);
-    if (!writePacketToTransport(packet)) {
+    // Corked packets must not be sent after DISCONNECT, MQTT-3.14.4-2
+    if (!writePacketToTransport(packet) || !flush()) {
         qWarning("Could not write DISCONNECT frame to transport");
         return false;
     }
     m_internalState = BrokerDisconnected;
 
-    if (m_transport->waitForBytesWritten(30000)) {
-        // MQTT-3.14.4-1 must disconnect
+    // MQTT-3.14.4-1 must disconnect. A socket closes once the pending data
+    // has been written and reports it via disconnected().
+    if (auto socket = qobject_cast<QAbstractSocket *>(m_transport)) {
+        handOverDirectSegments();
+        socket->flush();
+        socket->disconnectFromHost();
+    } else {
         m_transport->close();
-        return true;
     }
-    return false;
+    return true;
 }
 
 void QMqttConnection::setClient(QMqttClient *client)
@@ -463,31 +824,354 @@ void QMqttConnection::setClient(QMqttClient *client)
     m_client = client;
 }
 
+void QMqttConnection::setWriteCoalescing(bool enable)
+{
+    if (m_writeCoalescing == enable)
+        return;
+    if (!enable)
+        flush();
+    m_writeCoalescing = enable;
+}
+
+bool QMqttConnection::flush()
+{
+    m_flushTimer.stop();
+    if (m_writeBuffer.isEmpty())
+        return true;
+
+    const bool written = writeToTransport(m_writeBuffer);
+    m_writeBuffer.clear();
+    updateWriteBufferState();
+    return written;
+}
+
+void QMqttConnection::setWatermarks(const Watermarks &watermarks)
+{
+    m_watermarks = watermarks;
+    updateWriteBufferState();
+}
+
+void QMqttConnection::setWriteBufferPolicy(QMqttClient::WriteBufferPolicy policy)
+{
+    m_writeBufferPolicy = policy;
+}
+
+// Restores the messages in flight from fileName and keeps track of them
+// from now on. They are sent again once the broker acknowledged the next
+// connection. An empty fileName closes the store.
+bool QMqttConnection::setSessionStoreFile(const QString &fileName)
+{
+    if (m_internalState != BrokerDisconnected) {
+        qWarning("Changing the session store while connected is not possible");
+        return false;
+    }
+    if (!m_pendingMessages.isEmpty() || !m_pendingReleaseMessages.isEmpty() || !m_receivedQos2.isEmpty()) {
+        qWarning("Cannot restore a session while messages are in flight");
+        return false;
+    }
+
+    m_sessionStore.close();
+    if (fileName.isEmpty())
+        return true;
+    if (!m_sessionStore.open(fileName))
+        return false;
+
+    const auto outgoing = m_sessionStore.outgoing();
+    for (const auto &message : outgoing) {
+        // Skip the fixed header, the packet keeps the variable part
+        int offset = 1;
+        while (offset < message.frame.size() && (message.frame.at(offset) & 0x80))
+            ++offset;
+        const QMqttControlPacket packet(quint8(message.frame.at(0)), message.frame.mid(offset + 1));
+
+        if (!m_packetIds.reserve(message.id)) {
+            qWarning("Session store contains packet identifier %u twice", message.id);
+            continue;
+        }
+        if (message.released)
+            m_pendingReleaseMessages.insert(message.id, packet);
+        else
+            m_pendingMessages.insert(message.id, packet);
+    }
+    const auto incoming = m_sessionStore.incoming();
+    for (quint16 id : incoming)
+        m_receivedQos2.insert(id, true);
+
+    qCDebug(lcMqttConnection) << "Restored session from" << fileName << ":" << outgoing.size()
+                              << "outgoing and" << incoming.size() << "incoming messages";
+    return true;
+}
+
+QString QMqttConnection::sessionStoreFile() const
+{
+    return m_sessionStore.isOpen() ? m_sessionStore.fileName() : QString();
+}
+
+// Returns 0 if the message has been queued. It is sent once connected,
+// after all messages queued before.
+qint32 QMqttConnection::queueOfflinePublish(const QMqttTopicName &topic, const QByteArray &message,
+                                            quint8 qos, bool retain)
+{
+    if (!topic.isValid())
+        return -1;
+    // Would be rejected by sendControlPublish() once connected
+    const qint64 length = 2 + topic.toUtf8().size() + (qos ? 2 : 0) + qint64(message.size());
+    if (length > QMqttControlPacket::maximumRemainingLength) {
+        qWarning("Publishing a message bigger than maximum size!");
+        return -1;
+    }
+    if (!m_offlineQueue.enqueue(topic, message, qos, retain))
+        return -1;
+    scheduleOfflineDrain();
+    return 0;
+}
+
+void QMqttConnection::setOfflineDrainRate(int messagesPerSecond)
+{
+    m_offlineDrainRate = qMax(0, messagesPerSecond);
+    if (m_offlineDrainTimer.isActive()) {
+        m_offlineDrainTimer.stop();
+        scheduleOfflineDrain();
+    }
+}
+
+void QMqttConnection::scheduleOfflineDrain()
+{
+    if (m_internalState != BrokerConnected || m_offlineQueue.isEmpty() || m_offlineDrainTimer.isActive())
+        return;
+
+    if (m_offlineDrainRate > 0) {
+        m_offlineDrainTimer.setInterval(qMax(10, 1000 / m_offlineDrainRate));
+        m_offlineDrainClock.start();
+        m_offlineDrainTokens = 1;
+    } else {
+        m_offlineDrainTimer.setInterval(0);
+    }
+    m_offlineDrainTimer.start();
+}
+
+void QMqttConnection::drainOfflineQueue()
+{
+    if (m_internalState != BrokerConnected) {
+        m_offlineDrainTimer.stop();
+        return;
+    }
+
+    // Token bucket, allows bursts of a tenth of a second
+    int budget = offlineDrainBatchSize;
+    if (m_offlineDrainRate > 0) {
+        const double burst = qMax(1.0, m_offlineDrainRate / 10.0);
+        m_offlineDrainTokens = qMin(burst, m_offlineDrainTokens
+                                    + m_offlineDrainClock.restart() * m_offlineDrainRate / 1000.0);
+        budget = int(m_offlineDrainTokens);
+    }
+
+    for (; budget > 0; --budget) {
+        // Resumed once the write buffer drained or identifiers are released
+        if (m_writeBufferFull || m_packetIds.isFull()) {
+            m_offlineDrainTimer.stop();
+            return;
+        }
+        QMqttOfflineQueue::Message message;
+        if (!m_offlineQueue.dequeue(&message))
+            break;
+        if (sendControlPublish(message.topic, message.message, message.qos, message.retain) < 0)
+            qWarning("Could not send message from the offline queue");
+        if (m_offlineDrainRate > 0)
+            m_offlineDrainTokens -= 1;
+    }
+
+    if (m_offlineQueue.isEmpty())
+        m_offlineDrainTimer.stop();
+}
+
+void QMqttConnection::setAutoReconnect(bool enable)
+{
+    m_autoReconnect = enable;
+    if (!enable)
+        m_reconnectTimer.stop();
+}
+
+void QMqttConnection::setReconnectIntervals(int minimum, int maximum)
+{
+    m_reconnectMinimumInterval = qMax(1, minimum);
+    m_reconnectMaximumInterval = qMax(m_reconnectMinimumInterval, maximum);
+}
+
+// Called when connecting on request of the application, the connection is
+// restored with the same settings once it is lost
+void QMqttConnection::setReconnectTarget(const QString &sslPeerName)
+{
+    m_reconnectTimer.stop();
+    m_reconnectWanted = true;
+    m_reconnectPeerName = sslPeerName;
+}
+
+void QMqttConnection::cancelReconnect()
+{
+    m_reconnectTimer.stop();
+    m_reconnectWanted = false;
+    m_reconnectAttempt = 0;
+}
+
+// Exponential backoff with jitter: the delay is between half and all of the
+// backoff, which keeps clients dropped at the same time from reconnecting at
+// the same time.
+void QMqttConnection::scheduleReconnect()
+{
+    if (!m_autoReconnect || !m_reconnectWanted || m_reconnectTimer.isActive())
+        return;
+
+    const qint64 backoff = qMin<qint64>(m_reconnectMaximumInterval,
+                                        qint64(m_reconnectMinimumInterval) << qMin(m_reconnectAttempt, 30));
+    const quint32 jitter =
+#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
+            quint32(qrand()) % (quint32(backoff / 2) + 1);
+#else
+            QRandomGenerator::global()->bounded(quint32(backoff / 2) + 1);
+#endif
+    const int delay = int(backoff / 2 + jitter);
+    m_reconnectAttempt++;
+
+    qCDebug(lcMqttConnection) << "Reconnecting in" << delay << "ms, attempt" << m_reconnectAttempt;
+    m_reconnectTimer.start(delay);
+}
+
+void QMqttConnection::reconnect()
+{
+    if (m_internalState != BrokerDisconnected || !m_transport)
+        return;
+
+    m_client->setState(QMqttClient::Connecting);
+    if (!ensureTransportOpen(m_reconnectPeerName)) {
+        m_client->setState(QMqttClient::Disconnected);
+        scheduleReconnect();
+    }
+}
+
+qint64 QMqttConnection::bytesToWrite() const
+{
+    // Corked packets, segments waiting to be written directly and the data
+    // the transport has not sent yet
+    const qint64 transportBytes = m_transport ? m_transport->bytesToWrite() : 0;
+    return transportBytes + m_directBytes + m_writeBuffer.size();
+}
+
+int QMqttConnection::packetsToWrite() const
+{
+    // A packet is written once the transport sent all bytes up to its end
+    const qint64 written = m_bytesQueued - bytesToWrite();
+    return int(m_packetEnds.constEnd() - std::upper_bound(m_packetEnds.constBegin(), m_packetEnds.constEnd(), written));
+}
+
+void QMqttConnection::updateWriteBufferState()
+{
+    const qint64 bytes = bytesToWrite();
+    const qint64 written = m_bytesQueued - bytes;
+    while (!m_packetEnds.isEmpty() && m_packetEnds.head() <= written)
+        m_packetEnds.dequeue();
+    const int packets = m_packetEnds.size();
+
+    if (!m_writeBufferFull) {
+        if ((m_watermarks.highBytes > 0 && bytes >= m_watermarks.highBytes)
+                || (m_watermarks.highPackets > 0 && packets >= m_watermarks.highPackets)) {
+            qCDebug(lcMqttConnection) << "Write buffer full:" << bytes << "bytes," << packets << "packets";
+            m_writeBufferFull = true;
+            emit m_client->writeBufferFull();
+        }
+        return;
+    }
+
+    // Unused limits do not hold back draining
+    if (m_watermarks.highBytes > 0 && bytes > m_watermarks.lowBytes)
+        return;
+    if (m_watermarks.highPackets > 0 && packets > m_watermarks.lowPackets)
+        return;
+
+    qCDebug(lcMqttConnection) << "Write buffer drained:" << bytes << "bytes," << packets << "packets";
+    m_writeBufferFull = false;
+    emit m_client->writeBufferDrained();
+    writeQueuedPublishes();
+    scheduleOfflineDrain();
+}
+
+void QMqttConnection::writeQueuedPublishes()
+{
+    // Only written once the broker accepted the connection, for the first
+    // time, so without DUP
+    if (m_internalState != BrokerConnected)
+        return;
+
+    // Stops as soon as the high watermarks are reached again
+    while (!m_writeBufferFull && !m_queuedPublishes.isEmpty()) {
+        const QueuedPublish queued = m_queuedPublishes.dequeue();
+        m_queuedPublishBytes -= queued.packet.serializedSize();
+        if (!writePacketToTransport(queued.packet))
+            qWarning("Could not write queued message to transport");
+    }
+}
+
+void QMqttConnection::transportBytesWritten()
+{
+    if (m_writeBufferFull)
+        updateWriteBufferState();
+}
+
 void QMqttConnection::transportConnectionClosed()
 {
-    m_readBuffer.clear();
+    abortStream();
+    m_decoder.clear();
+    m_writeBuffer.clear();
+    clearDirectSegments();
+    m_flushTimer.stop();
+    m_bytesQueued = 0;
+    m_packetEnds.clear();
+    m_writeBufferFull = false;
+    m_currentPublish.subscriptions.clear();
     m_pingTimer.stop();
+    m_offlineDrainTimer.stop();
+    // Requests made by slots connected to the subscriptions are not sent anymore
+    m_internalState = BrokerDisconnected;
+    abortSubscriptionRequests();
     m_client->setState(QMqttClient::Disconnected);
+    scheduleReconnect();
 }
 
 void QMqttConnection::transportReadReady()
 {
     qCDebug(lcMqttConnectionVerbose) << Q_FUNC_INFO;
-    m_readBuffer.append(m_transport->readAll());
-    processData();
+    // Read and process in chunks, so that a large payload can be read
+    // directly into its destination once its header has been decoded.
+    do {
+        if (m_decoder.readFrom(m_transport) <= 0)
+            break;
+        processData();
+    } while (m_transport->bytesAvailable() > 0);
+
+    deliverBatches();
+}
+
+// Batches without an interval are delivered once all data available has
+// been processed
+void QMqttConnection::deliverBatches()
+{
+    if (m_pendingBatches.isEmpty())
+        return;
+
+    QVector<QSharedPointer<QMqttSubscription>> pending;
+    pending.swap(m_pendingBatches);
+    for (const auto &sub : qAsConst(pending))
+        sub->d_func()->deliverBatch();
 }
 
 void QMqttConnection::readBuffer(char *data, qint64 size)
 {
-    memcpy(data, m_readBuffer.constData(), size);
-    m_readBuffer = m_readBuffer.mid(size);
+    m_decoder.buffer().read(data, int(size));
 }
 
 QByteArray QMqttConnection::readBuffer(qint64 size)
 {
-    QByteArray res = m_readBuffer.left(size);
-    m_readBuffer = m_readBuffer.mid(size);
-    return res;
+    return m_decoder.buffer().read(int(size));
 }
 
 void QMqttConnection::finalize_connack()
@@ -513,19 +1197,89 @@ void QMqttConnection::finalize_connack()
     readBuffer((char*)&connectResultValue, 1);
     if (connectResultValue != 0) {
         qWarning("Connection has been rejected");
+        // Only an unavailable server might accept a later attempt
+        if (connectResultValue != ServerUnavailable)
+            m_reconnectWanted = false;
         // MQTT-3.2.2-5
         // ### TODO: ConnectionError
-        m_readBuffer.clear();
+        m_decoder.clear();
+        rollbackPipelinedRequests();
         m_transport->close();
         m_internalState = BrokerDisconnected;
         m_client->setState(QMqttClient::Disconnected);
         return;
     }
     m_internalState = BrokerConnected;
+    m_reconnectAttempt = 0;
+
+    // Without a session the broker does not know about incoming QoS 2
+    // messages anymore, a message with the same identifier is a new one.
+    if (!sessionPresent && !m_receivedQos2.isEmpty()) {
+        if (m_sessionStore.isOpen())
+            m_receivedQos2.forEach([this](quint16 id, bool) { m_sessionStore.storeIncomingComplete(id); });
+        m_receivedQos2.clear();
+    }
+    resendInFlight();
+    writeQueuedPublishes();
+    m_pipelinedPublishes.clear();
+    resubscribe(sessionPresent);
+
     m_client->setState(QMqttClient::Connected);
 
     m_pingTimer.setInterval(m_client->keepAlive() * 1000);
     m_pingTimer.start();
+
+    scheduleOfflineDrain();
+}
+
+// MQTT-4.4.0-1: unacknowledged PUBLISH and PUBREL packets are sent again
+// after reconnecting, in the order they have been sent originally.
+void QMqttConnection::resendInFlight()
+{
+    if (m_pendingMessages.isEmpty() && m_pendingReleaseMessages.isEmpty())
+        return;
+
+    qCDebug(lcMqttConnection) << "Resending" << m_pendingMessages.size() << "messages and"
+                              << m_pendingReleaseMessages.size() << "releases";
+
+    // Identifiers are allocated round-robin, the ones from the next
+    // identifier on have been allocated before the ones below it.
+    const quint16 next = m_packetIds.nextId();
+    QVector<quint16> older;
+    QVector<quint16> newer;
+    auto collect = [&](quint16 id) {
+        if (next && id >= next)
+            older.append(id);
+        else
+            newer.append(id);
+    };
+    // Messages which have never been written are not sent again, but for
+    // the first time by writeQueuedPublishes()
+    QSet<quint16> unwritten;
+    for (const QueuedPublish &queued : qAsConst(m_queuedPublishes)) {
+        if (queued.id)
+            unwritten.insert(queued.id);
+    }
+    m_pendingMessages.forEach([this, &collect, &unwritten](quint16 id, const QMqttControlPacket &) {
+        // Sent after the CONNECT of this connection already
+        if (!m_pipelinedPublishes.contains(id) && !unwritten.contains(id))
+            collect(id);
+    });
+    m_pendingReleaseMessages.forEach([&collect](quint16 id, const QMqttControlPacket &) { collect(id); });
+    std::sort(older.begin(), older.end());
+    std::sort(newer.begin(), newer.end());
+    older += newer;
+
+    for (quint16 id : qAsConst(older)) {
+        if (QMqttControlPacket *packet = m_pendingMessages.find(id)) {
+            // MQTT-3.3.1-1
+            packet->setDup(true);
+            if (!writePacketToTransport(*packet))
+                qWarning("Could not resend message %u", id);
+        } else if (!sendControlPublishRelease(id)) {
+            qWarning("Could not resend release of message %u", id);
+        }
+    }
 }
 
 void QMqttConnection::finalize_suback()
@@ -537,24 +1291,35 @@ void QMqttConnection::finalize_suback()
         qWarning("Received SUBACK for unknown subscription request");
         return;
     }
-    quint8 result;
-    readBuffer((char*)&result, 1);
-    auto sub = m_pendingSubscriptionAck.take(id);
-    qCDebug(lcMqttConnectionVerbose) << "Finalize SUBACK: id:" << id << "qos:" << result;
-    if (result <= 2) {
-        // The broker might have a different support level for QoS than what
-        // the client requested
-        if (result != sub->qos()) {
-            sub->setQos(result);
-            emit sub->qosChanged(result);
+    const auto subscriptions = m_pendingSubscriptionAck.take(id);
+    m_packetIds.release(id);
+
+    // One return code per topic filter, in the order of the SUBSCRIBE
+    const qint64 resultCount = m_missingData - 2;
+    if (resultCount != subscriptions.size())
+        qWarning("Received SUBACK with %lld return codes for %d topic filters", resultCount, subscriptions.size());
+
+    for (int i = 0; i < subscriptions.size(); ++i) {
+        const auto &sub = subscriptions.at(i);
+        quint8 result = 0x80;
+        if (i < resultCount)
+            readBuffer((char*)&result, 1);
+        qCDebug(lcMqttConnectionVerbose) << "Finalize SUBACK: id:" << id << "qos:" << result;
+        if (result <= 2) {
+            // The broker might have a different support level for QoS than what
+            // the client requested
+            if (result != sub->qos()) {
+                sub->setQos(result);
+                emit sub->qosChanged(result);
+            }
+            sub->setState(QMqttSubscription::Subscribed);
+        } else if (result == 0x80) {
+            qWarning() << "Subscription for id " << id << " failed.";
+            sub->setState(QMqttSubscription::Error);
+        } else {
+            qWarning("Received invalid SUBACK result value");
+            sub->setState(QMqttSubscription::Error);
         }
-        sub->setState(QMqttSubscription::Subscribed);
-    } else if (result == 0x80) {
-        qWarning() << "Subscription for id " << id << " failed.";
-        sub->setState(QMqttSubscription::Error);
-    } else {
-        qWarning("Received invalid SUBACK result value");
-        sub->setState(QMqttSubscription::Error);
     }
 }
 
@@ -568,68 +1333,173 @@ void QMqttConnection::finalize_unsuback()
         qWarning("Received UNSUBACK for unknown request");
         return;
     }
-    auto sub = m_pendingUnsubscriptions.take(id);
-    sub->setState(QMqttSubscription::Unsubscribed);
-    m_activeSubscriptions.remove(sub->topic());
+    const auto subscriptions = m_pendingUnsubscriptions.take(id);
+    m_packetIds.release(id);
+    for (const auto &sub : subscriptions) {
+        sub->setState(QMqttSubscription::Unsubscribed);
+        m_activeSubscriptions.remove(sub->topic());
+        m_subscriptionTrie.remove(sub->d_func()->m_topic.toUtf8());
+    }
 }
 
-void QMqttConnection::finalize_publish()
+bool QMqttConnection::isMessageReceivedConnected() const
+{
+    static const QMetaMethod messageReceived = QMetaMethod::fromSignal(&QMqttClient::messageReceived);
+    return m_client->isSignalConnected(messageReceived);
+}
+
+// The message handler of the client and QMqttClient::messageReceived()
+// need the complete payload
+bool QMqttConnection::clientReceivesMessages() const
+{
+    if (m_messageDispatch == QMqttClient::SubscriptionsOnly)
+        return false;
+    return m_messageHandler.isSet() || isMessageReceivedConnected();
+}
+
+void QMqttConnection::initialize_publish()
+{
+    m_currentPublish.topic = m_decoder.publishTopic();
+    m_currentPublish.id = m_decoder.publishId();
+    // MQTT-4.3.3-2: a QoS 2 message is delivered once until it is released
+    m_currentPublish.duplicate = m_currentPublish.qos == 2 && m_receivedQos2.contains(m_currentPublish.id);
+    if (m_currentPublish.duplicate || m_messageDispatch == QMqttClient::ClientOnly)
+        m_currentPublish.subscriptions.clear();
+    else
+        m_currentPublish.subscriptions = matchingSubscriptions(m_currentPublish.topic);
+
+    // Only stream the payload if all receivers asked for it. Otherwise it
+    // needs to be buffered anyway.
+    const qint64 payloadLength = m_decoder.publishPayloadLength();
+    bool stream = !m_currentPublish.subscriptions.isEmpty() && !clientReceivesMessages();
+    for (const auto &sub : qAsConst(m_currentPublish.subscriptions)) {
+        if (!sub->d_func()->streamsPayload(payloadLength)) {
+            stream = false;
+            break;
+        }
+    }
+    m_decoder.setStreamPayload(stream);
+
+    qCDebug(lcMqttConnectionVerbose) << "Initialize PUBLISH: topic:" << m_currentPublish.topic
+                                     << " payloadLength:" << payloadLength << " stream:" << stream;
+
+    m_currentPublish.streaming = stream;
+    if (stream) {
+        const QMqttMessage header(m_currentPublish.topic, QByteArray(), m_currentPublish.id,
+                                  m_currentPublish.qos, m_currentPublish.dup, m_currentPublish.retain);
+        for (const auto &sub : qAsConst(m_currentPublish.subscriptions))
+            emit sub->streamStarted(header, payloadLength);
+    }
+}
+
+void QMqttConnection::stream_publish()
 {
-    // String topic
-    const quint16 topicLength = qFromBigEndian<quint16>(reinterpret_cast<const quint16 *>(readBuffer(2).constData()));
-    const QString topic = QString::fromUtf8(reinterpret_cast<const char *>(readBuffer(topicLength).constData()));
+    const QByteArray chunk = m_decoder.publishPayload();
+    const bool finished = m_decoder.publishPayloadRemaining() == 0;
+    for (const auto &sub : qAsConst(m_currentPublish.subscriptions)) {
+        sub->d_func()->writeStreamData(chunk);
+        emit sub->streamDataReceived(chunk);
+        if (finished)
+            emit sub->streamFinished();
+    }
 
-    quint16 id = 0;
-    if (m_currentPublish.qos > 0) {
-        id = qFromBigEndian<quint16>(reinterpret_cast<const quint16 *>(readBuffer(2).constData()));
+    if (finished) {
+        qCDebug(lcMqttConnectionVerbose) << "Finalize streamed PUBLISH: topic:" << m_currentPublish.topic;
+        m_currentPublish.streaming = false;
+        m_currentPublish.subscriptions.clear();
+        acknowledgePublish();
     }
+}
+
+// The connection has been lost while the payload was streamed
+void QMqttConnection::abortStream()
+{
+    if (!m_currentPublish.streaming)
+        return;
+
+    qCDebug(lcMqttConnection) << "Aborting streamed PUBLISH: topic:" << m_currentPublish.topic
+                              << " missing:" << m_decoder.publishPayloadRemaining() << "bytes";
+    m_currentPublish.streaming = false;
+    const QVector<QSharedPointer<QMqttSubscription>> subscriptions = m_currentPublish.subscriptions;
+    m_currentPublish.subscriptions.clear();
+    for (const auto &sub : subscriptions)
+        emit sub->streamAborted();
+}
 
-    // message
-    qint64 payloadLength = m_missingData - (topicLength + 2) - (m_currentPublish.qos > 0 ? 2 : 0);
-    const QByteArray message = readBuffer(payloadLength);
+void QMqttConnection::finalize_publish()
+{
+    // The decoder has already split the frame, the payload has been read
+    // into its own buffer and is shared with every message.
+    const QByteArray &topic = m_currentPublish.topic;
+    const QByteArray message = m_decoder.publishPayload();
+    const qint64 payloadLength = message.size();
 
     qCDebug(lcMqttConnectionVerbose) << "Finalize PUBLISH: topic:" << topic
                                      << " payloadLength:" << payloadLength;;
 
-    emit m_client->messageReceived(message, topic);
+    if (m_currentPublish.duplicate) {
+        qCDebug(lcMqttConnectionVerbose) << "Acknowledging duplicate of message" << m_currentPublish.id;
+        acknowledgePublish();
+        return;
+    }
 
-    QMqttMessage qmsg(topic, message, id, m_currentPublish.qos,
-                      m_currentPublish.dup, m_currentPublish.retain);
+    const QMqttMessage qmsg(topic, message, m_currentPublish.id, m_currentPublish.qos,
+                            m_currentPublish.dup, m_currentPublish.retain);
 
-    for (auto sub = m_activeSubscriptions.constBegin(); sub != m_activeSubscriptions.constEnd(); sub++) {
-        const QString subTopic = sub.key();
+    if (m_messageDispatch != QMqttClient::SubscriptionsOnly) {
+        if (m_messageHandler.isSet())
+            m_messageHandler.call(qmsg);
+        // Decodes the topic once for all receivers, only if there are any
+        if (isMessageReceivedConnected())
+            emit m_client->messageReceived(message, qmsg.topic());
+    }
 
-        if (subTopic == topic) {
-            emit sub.value()->messageReceived(qmsg);
-            continue;
-        } else if (subTopic.endsWith(QLatin1Char('#')) && topic.startsWith(subTopic.leftRef(subTopic.size() - 1))) {
-            emit sub.value()->messageReceived(qmsg);
-            continue;
+    for (const auto &sub : qAsConst(m_currentPublish.subscriptions)) {
+        if (sub->d_func()->streamsPayload(payloadLength)) {
+            // Buffered for other receivers, still deliver as a stream
+            const QMqttMessage header(topic, QByteArray(), m_currentPublish.id, m_currentPublish.qos,
+                                      m_currentPublish.dup, m_currentPublish.retain);
+            emit sub->streamStarted(header, payloadLength);
+            sub->d_func()->writeStreamData(message);
+            emit sub->streamDataReceived(message);
+            emit sub->streamFinished();
+        } else {
+            auto subPrivate = sub->d_func();
+            if (subPrivate->m_messageHandler.isSet())
+                subPrivate->m_messageHandler.call(qmsg);
+            if (subPrivate->m_batchSize > 0) {
+                if (subPrivate->addToBatch(qmsg))
+                    m_pendingBatches.append(sub);
+            } else {
+                emit sub->messageReceived(qmsg);
+            }
         }
+    }
+    m_currentPublish.subscriptions.clear();
 
-        if (!subTopic.contains(QLatin1Char('+')))
-            continue;
-
-        const QVector<QStringRef> subTopicSplit = subTopic.splitRef(QLatin1Char('/'));
-        const QVector<QStringRef> topicSplit = topic.splitRef(QLatin1Char('/'));
-        if (subTopicSplit.size() != topicSplit.size())
-            continue;
-        bool match = true;
-        for (int i = 0; i < subTopicSplit.size() && match; ++i) {
-            if (subTopicSplit.at(i) == QLatin1Char('+') || subTopicSplit.at(i) == topicSplit.at(i))
-                continue;
-            match = false;
-        }
+    acknowledgePublish();
+}
 
-        if (match) {
-            emit sub.value()->messageReceived(qmsg);
+void QMqttConnection::acknowledgePublish()
+{
+    if (m_currentPublish.qos == 1) {
+        sendControlPublishAcknowledge(m_currentPublish.id);
+    } else if (m_currentPublish.qos == 2) {
+        // Recorded before PUBREC, the broker sends the message again otherwise
+        if (!m_currentPublish.duplicate) {
+            m_receivedQos2.insert(m_currentPublish.id, true);
+            if (m_sessionStore.isOpen())
+                m_sessionStore.storeReceived(m_currentPublish.id);
         }
+        sendControlPublishReceive(m_currentPublish.id);
     }
+}
 
-    if (m_currentPublish.qos == 1)
-        sendControlPublishAcknowledge(id);
-    else if (m_currentPublish.qos == 2)
-        sendControlPublishReceive(id);
+QVector<QSharedPointer<QMqttSubscription>> QMqttConnection::matchingSubscriptions(const QByteArray &topic) const
+{
+    QVector<QSharedPointer<QMqttSubscription>> result;
+    m_subscriptionTrie.match(topic, &result);
+    return result;
 }
 
 void QMqttConnection::finalize_pubAckRecComp()
@@ -641,24 +1511,35 @@ void QMqttConnection::finalize_pubAckRecComp()
 
     if ((m_currentPacket & 0xF0) == QMqttControlPacket::PUBCOMP) {
         qCDebug(lcMqttConnectionVerbose) << " PUBCOMP:" << id;
-        auto pendingRelease = m_pendingReleaseMessages.take(id);
-        if (!pendingRelease)
+        if (!m_pendingReleaseMessages.remove(id)) {
             qWarning("Received PUBCOMP for unknown released message");
+        } else {
+            m_packetIds.release(id);
+            if (m_sessionStore.isOpen())
+                m_sessionStore.storeComplete(id);
+            scheduleOfflineDrain();
+        }
         emit m_client->messageSent(id);
         return;
     }
 
-    auto pendingMsg = m_pendingMessages.take(id);
-    if (!pendingMsg) {
+    if (!m_pendingMessages.contains(id)) {
         qWarning() << QLatin1String("Received PUBACK for unknown message: ") << id;
         return;
     }
+    const QMqttControlPacket pendingMsg = m_pendingMessages.take(id);
     if ((m_currentPacket & 0xF0) == QMqttControlPacket::PUBREC) {
         qCDebug(lcMqttConnectionVerbose) << " PUBREC:" << id;
         m_pendingReleaseMessages.insert(id, pendingMsg);
+        if (m_sessionStore.isOpen())
+            m_sessionStore.storeRelease(id);
         sendControlPublishRelease(id);
     } else {
         qCDebug(lcMqttConnectionVerbose) << " PUBACK:" << id;
+        m_packetIds.release(id);
+        if (m_sessionStore.isOpen())
+            m_sessionStore.storeComplete(id);
+        scheduleOfflineDrain();
         emit m_client->messageSent(id);
     }
 }
@@ -671,143 +1552,280 @@ void QMqttConnection::finalize_pubrel()
 
     qCDebug(lcMqttConnectionVerbose) << "Finalize PUBREL:" << id;
 
-    // ### TODO: send to our app now or not???
-    // See standard Figure 4.3 Method A or B ???
+    // Messages are delivered on arrival, Figure 4.3 Method B. Until the
+    // release the identifier marks a duplicate.
+    if (m_receivedQos2.remove(id) && m_sessionStore.isOpen())
+        m_sessionStore.storeIncomingComplete(id);
     sendControlPublishComp(id);
 }
 
 void QMqttConnection::finalize_pingresp()
 {
     qCDebug(lcMqttConnectionVerbose) << "Finalize PINGRESP";
-    quint8 v;
-    readBuffer((char*)&v, 1);
-    if (v != 0)
+    if (m_missingData != 0)
         qWarning("Received a PINGRESP with payload!");
     emit m_client->pingResponseReceived();
 }
 
 void QMqttConnection::processData()
 {
-    if (m_missingData > 0) {
-        if (m_readBuffer.size() < m_missingData)
-            return;
+    while (m_decoder.nextFrame()) {
+        m_currentPacket = static_cast<QMqttControlPacket::PacketType>(m_decoder.header());
+        m_missingData = m_decoder.remainingLength();
+
+        switch (m_decoder.state()) {
+        case QMqttFrameDecoder::PublishHeader:
+            qCDebug(lcMqttConnectionVerbose) << "Received PUBLISH";
+            m_currentPublish.dup = m_currentPacket & 0x08;
+            m_currentPublish.qos = (m_currentPacket & 0x06) >> 1;
+            m_currentPublish.retain = m_currentPacket & 0x01;
+            initialize_publish();
+            continue;
+        case QMqttFrameDecoder::PublishStream:
+            stream_publish();
+            continue;
+        case QMqttFrameDecoder::PublishPayload:
+            finalize_publish();
+            continue;
+        default:
+            break;
+        }
 
         switch (m_currentPacket & 0xF0) {
         case QMqttControlPacket::CONNACK:
+            qCDebug(lcMqttConnectionVerbose) << "Received CONNACK";
+            if (m_internalState != BrokerWaitForConnectAck) {
+                qWarning("Received CONNACK at unexpected time!");
+                break;
+            }
+            if (m_missingData != 2) {
+                qWarning("Unexpected FRAME size in CONNACK");
+                // ## SET SOME ERROR
+                break;
+            }
             finalize_connack();
             break;
         case QMqttControlPacket::SUBACK:
+            qCDebug(lcMqttConnectionVerbose) << "Received SUBACK";
+            if (m_missingData < 3) {
+                qWarning("Received SUBACK with invalid remaining length");
+                break;
+            }
             finalize_suback();
             break;
-        case QMqttControlPacket::UNSUBACK:
-            finalize_unsuback();
-            break;
-        case QMqttControlPacket::PUBLISH:
-            finalize_publish();
+        case QMqttControlPacket::PINGRESP:
+            qCDebug(lcMqttConnectionVerbose) << "Received PINGRESP";
+            finalize_pingresp();
             break;
+        case QMqttControlPacket::UNSUBACK:
         case QMqttControlPacket::PUBACK:
         case QMqttControlPacket::PUBREC:
         case QMqttControlPacket::PUBCOMP:
-            finalize_pubAckRecComp();
-            break;
-        case QMqttControlPacket::PINGRESP:
-            finalize_pingresp();
-            break;
-        case QMqttControlPacket::PUBREL: {
-            finalize_pubrel();
+        case QMqttControlPacket::PUBREL:
+            qCDebug(lcMqttConnectionVerbose) << "Received UNSUBACK/PUBACK/PUBREC/PUBCOMP/PUBREL";
+            if (m_missingData != 2) {
+                qWarning("Received 2 byte message with invalid remaining length");
+                break;
+            }
+            if ((m_currentPacket & 0xF0) == QMqttControlPacket::UNSUBACK)
+                finalize_unsuback();
+            else if ((m_currentPacket & 0xF0) == QMqttControlPacket::PUBREL)
+                finalize_pubrel();
+            else
+                finalize_pubAckRecComp();
             break;
-        }
         default:
-            qFatal("Unknown packet to finalize");
+            qWarning("Received unknown command");
             break;
         }
         m_missingData = 0;
     }
 
-    if (m_readBuffer.size() == 0)
-        return;
+    if (Q_UNLIKELY(m_decoder.hasError())) {
+        // The stream cannot be synchronized anymore.
+        m_decoder.clear();
+        m_transport->close();
+    }
+}
 
-    readBuffer((char*)&m_currentPacket, 1);
+bool QMqttConnection::writePacketToTransport(const QMqttControlPacket &p)
+{
+    if (p.exceedsMaximumSize())
+        return false;
 
-    switch (m_currentPacket & 0xF0) {
-    case QMqttControlPacket::CONNACK: {
-        qCDebug(lcMqttConnectionVerbose) << "Received CONNACK";
-        if (m_internalState != BrokerWaitForConnectAck) {
-            qWarning("Received CONNACK at unexpected time!");
-            break;
-        }
+    // Until the transport is connected, everything but the CONNECT is kept
+    // to be written right after it
+    if (m_internalState == BrokerConnecting && p.header() != QMqttControlPacket::CONNECT) {
+        m_pipelinedPackets.append(p);
+        return true;
+    }
 
-        quint8 payloadSize;
-        readBuffer((char*)&payloadSize, 1);
-        if (payloadSize != 2) {
-            qWarning("Unexpected FRAME size in CONNACK");
-            // ## SET SOME ERROR
-            break;
-        }
-        m_missingData = 2;
-        break;
+    bool written = true;
+    if (p.rawPayload().size() >= scatterGatherThreshold) {
+        // Keep the order of the packets corked before
+        written = flush() && writeSegmentsToTransport(p);
+    } else if (m_writeCoalescing) {
+        written = p.serializeInto(&m_writeBuffer);
+        if (!m_flushTimer.isActive())
+            m_flushTimer.start();
+    } else {
+        written = writeToTransport(p.serialize());
     }
-    case QMqttControlPacket::SUBACK: {
-        qCDebug(lcMqttConnectionVerbose) << "Received SUBACK";
-        quint8 remaining;
-        readBuffer((char*)&remaining, 1);
-        m_missingData = remaining;
-        break;
+
+    if (written) {
+        m_bytesQueued += p.serializedSize();
+        m_packetEnds.enqueue(m_bytesQueued);
+        updateWriteBufferState();
     }
-    case QMqttControlPacket::PUBLISH: {
-        qCDebug(lcMqttConnectionVerbose) << "Received PUBLISH";
-        m_currentPublish.dup = m_currentPacket & 0x08;
-        m_currentPublish.qos = (m_currentPacket & 0x06) >> 1;
-        m_currentPublish.retain = m_currentPacket & 0x01;
-        // remaining length
-        quint32 multiplier = 1;
-        quint32 msgLength = 0;
-        quint8 b = 0;
-        quint8 iteration = 0;
-        do {
-            readBuffer((char*)&b, 1);
-            msgLength += (b & 127) * multiplier;
-            multiplier *= 128;
-            iteration++;
-            if (iteration > 4)
-                qFatal("Publish message is too big to handle");
-        } while ((b & 128) != 0);
-        m_missingData = msgLength;
-        break;
+    return written;
+}
+
+bool QMqttConnection::writeSegmentsToTransport(const QMqttControlPacket &p)
+{
+    // The payload is passed on as is instead of being copied into a frame
+    const QByteArray header = p.serializeHeader();
+    const QByteArray payload = p.rawPayload();
+
+    // Other transports copy the segments into their write buffer
+    if (m_directSegments.isEmpty() && !canWriteDirectly())
+        return writeToTransport(header) && writeToTransport(payload);
+
+    const bool idle = m_directSegments.isEmpty();
+    m_directSegments.enqueue(header);
+    m_directSegments.enqueue(payload);
+    m_directBytes += header.size() + payload.size();
+    return !idle || writeDirectSegments();
+}
+
+// Only a plain TCP socket without queued data may be bypassed
+bool QMqttConnection::canWriteDirectly() const
+{
+#ifdef Q_OS_UNIX
+    if (m_transportType != QMqttClient::AbstractSocket)
+        return false;
+    auto socket = qobject_cast<QTcpSocket *>(m_transport);
+    if (!socket || socket->state() != QAbstractSocket::ConnectedState)
+        return false;
+#ifndef QT_NO_SSL
+    // Data of an encrypted socket must pass the socket
+    if (qobject_cast<QSslSocket *>(socket))
+        return false;
+#endif
+    return socket->bytesToWrite() == 0 && socket->socketDescriptor() != -1;
+#else
+    return false;
+#endif
+}
+
+// Writes as much of the direct segments as the kernel takes with a single
+// writev(). The rest stays queued until the descriptor is writable again.
+bool QMqttConnection::writeDirectSegments()
+{
+#ifdef Q_OS_UNIX
+    auto socket = qobject_cast<QTcpSocket *>(m_transport);
+    const qintptr descriptor = socket ? socket->socketDescriptor() : -1;
+    if (descriptor == -1 || m_directSegments.isEmpty()) {
+        clearDirectSegments();
+        return false;
     }
-    case QMqttControlPacket::PINGRESP:
-        qCDebug(lcMqttConnectionVerbose) << "Received PINGRESP";
-        m_missingData = 1;
-        break;
-    case QMqttControlPacket::UNSUBACK:
-    case QMqttControlPacket::PUBACK:
-    case QMqttControlPacket::PUBREC:
-    case QMqttControlPacket::PUBCOMP:
-    case QMqttControlPacket::PUBREL: {
-        qCDebug(lcMqttConnectionVerbose) << "Received UNSUBACK/PUBACK/PUBREC/PUBCOMP/PUBREL";
-        char remaining;
-        readBuffer(&remaining, 1); // ### TODO: verify this is 2
-        if (remaining != 0x02)
-            qWarning("Received 2 byte message with invalid remaining length");
-        m_missingData = 2;
-        break;
+
+    static const int maximumSegments = 16;
+    struct iovec segments[maximumSegments];
+    int count = 0;
+    for (auto it = m_directSegments.cbegin(); it != m_directSegments.cend() && count < maximumSegments; ++it) {
+        const int offset = count == 0 ? m_directSegmentOffset : 0;
+        segments[count].iov_base = const_cast<char *>(it->constData() + offset);
+        segments[count].iov_len = size_t(it->size() - offset);
+        ++count;
     }
-    default:
-        qFatal("Received unknown command");
-        break;
+
+    ssize_t res;
+    do {
+        res = ::writev(int(descriptor), segments, count);
+    } while (res == -1 && errno == EINTR);
+    if (res == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        // The socket reports the error once it tries to write the data
+        handOverDirectSegments();
+        return true;
+    }
+
+    qint64 written = qMax<qint64>(res, 0);
+    m_directBytes -= written;
+    while (written > 0) {
+        const qint64 left = m_directSegments.head().size() - m_directSegmentOffset;
+        if (written < left) {
+            m_directSegmentOffset += int(written);
+            break;
+        }
+        written -= left;
+        m_directSegments.dequeue();
+        m_directSegmentOffset = 0;
     }
+    qCDebug(lcMqttConnectionVerbose) << "Wrote" << qMax<qint64>(res, 0) << "bytes directly to the socket,"
+                                     << m_directBytes << "bytes left";
+
+    if (!m_directSegments.isEmpty() && (!m_directWriteNotifier || m_directWriteNotifier->socket() != descriptor)) {
+        if (m_directWriteNotifier)
+            m_directWriteNotifier->deleteLater();
+        m_directWriteNotifier = new QSocketNotifier(descriptor, QSocketNotifier::Write, this);
+        connect(m_directWriteNotifier, &QSocketNotifier::activated, this, &QMqttConnection::writeDirectSegments);
+    }
+    // Disabled before anything else is written through the socket
+    if (m_directWriteNotifier)
+        m_directWriteNotifier->setEnabled(!m_directSegments.isEmpty());
 
-    /* set current command CONNACK - PINGRESP */
-    /* read command size */
-    /* calculate missing_data */
-    processData(); // implicitly finishes and enqueues
-    return;
+    if (res > 0)
+        transportBytesWritten();
+    return true;
+#else
+    clearDirectSegments();
+    return false;
+#endif
 }
 
-bool QMqttConnection::writePacketToTransport(const QMqttControlPacket &p)
+// Passes the segments not written yet to the socket, which copies them.
+// Used when the socket has to take over, like before disconnecting.
+void QMqttConnection::handOverDirectSegments()
+{
+    if (m_directSegments.isEmpty())
+        return;
+
+    QQueue<QByteArray> segments;
+    segments.swap(m_directSegments);
+    int offset = m_directSegmentOffset;
+    clearDirectSegments();
+    for (const QByteArray &segment : qAsConst(segments)) {
+        if (!writeToTransport(QByteArray::fromRawData(segment.constData() + offset, segment.size() - offset)))
+            break;
+        offset = 0;
+    }
+}
+
+void QMqttConnection::clearDirectSegments()
+{
+    m_directSegments.clear();
+    m_directSegmentOffset = 0;
+    m_directBytes = 0;
+    if (m_directWriteNotifier) {
+        m_directWriteNotifier->setEnabled(false);
+        m_directWriteNotifier->deleteLater();
+        m_directWriteNotifier = nullptr;
+    }
+}
+
+bool QMqttConnection::writeToTransport(const QByteArray &data)
 {
-    const QByteArray writeData = p.serialize();
-    const qint64 res = m_transport->write(writeData.constData(), writeData.size());
+    if (Q_UNLIKELY(!m_transport)) {
+        qWarning("Could not write frame, no transport");
+        return false;
+    }
+    // Keeps the order behind data waiting to be written directly
+    if (!m_directSegments.isEmpty()) {
+        m_directSegments.enqueue(data);
+        m_directBytes += data.size();
+        return true;
+    }
+    const qint64 res = m_transport->write(data.constData(), data.size());
     if (Q_UNLIKELY(res == -1)) {
         qWarning("Could not write frame to transport");
         return false;
@@ -35,14 +35,25 @@
 
 #include "qmqttclient.h"
 #include "qmqttcontrolpacket_p.h"
+#include "qmqttframedecoder_p.h"
+#include "qmqttofflinequeue_p.h"
+#include "qmqttpacketidallocator_p.h"
+#include "qmqttpacketidtable_p.h"
+#include "qmqttsessionstore_p.h"
+#include "qmqtttopictrie_p.h"
 #include "qmqttmessage.h"
-#include "qmqttsubscription.h"
+#include "qmqttsubscription_p.h"
 #include <QtCore/QBuffer>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QMap>
 #include <QtCore/QObject>
+#include <QtCore/QQueue>
 #include <QtCore/QSharedPointer>
+#include <QtCore/QSocketNotifier>
 #include <QtCore/QTimer>
 #include <QtCore/QtEndian>
+#include <QtCore/QVector>
+#include <QtNetwork/QAbstractSocket>
 
 QT_BEGIN_NAMESPACE
 
@@ -52,6 +63,7 @@ class Q_AUTOTEST_EXPORT QMqttConnection : public QObject
 public:
     enum InternalConnectionState {
         BrokerDisconnected = 0,
+        BrokerConnecting,
         BrokerWaitForConnectAck,
         BrokerConnected
     };
@@ -64,6 +76,13 @@ public:
         BadUsernameOrPassword  = 4,
         NotAuthorized          = 5
     };
+    struct Watermarks {
+        qint64 lowBytes{0};
+        qint64 highBytes{0};
+        int lowPackets{0};
+        int highPackets{0};
+    };
+
     explicit QMqttConnection(QObject *parent = 0);
     ~QMqttConnection() override;
 
@@ -74,23 +93,66 @@ public:
     bool ensureTransportOpen(const QString &sslPeerName = QString());
 
     bool sendControlConnect();
+    qint32 sendControlPublish(const QMqttTopicName &topic, const QByteArray &message, quint8 qos = 0, bool retain = false);
     qint32 sendControlPublish(const QString &topic, const QByteArray &message, quint8 qos = 0, bool retain = false);
     bool sendControlPublishAcknowledge(quint16 id);
     bool sendControlPublishRelease(quint16 id);
     bool sendControlPublishReceive(quint16 id);
     bool sendControlPublishComp(quint16 id);
-    QSharedPointer<QMqttSubscription> sendControlSubscribe(const QString &topic, quint8 qos = 0);
-    bool sendControlUnsubscribe(const QString &topic);
+    QSharedPointer<QMqttSubscription> sendControlSubscribe(const QMqttTopicFilter &topic, quint8 qos = 0);
+    QList<QSharedPointer<QMqttSubscription>> sendControlSubscribe(const QList<QPair<QMqttTopicFilter, quint8>> &topics);
+    bool sendControlUnsubscribe(const QMqttTopicFilter &topic);
+    bool sendControlUnsubscribe(const QList<QMqttTopicFilter> &topics);
     bool sendControlPingRequest();
-    bool sendControlDisconnect();
+    bool sendControlDisconnect(QMqttClient::DisconnectMode mode = QMqttClient::UnsubscribeAll);
+    void closeTransport();
 
     void setClient(QMqttClient *client);
 
+    void setWriteCoalescing(bool enable);
+    inline bool writeCoalescing() const { return m_writeCoalescing; }
+    bool flush();
+
+    void setWatermarks(const Watermarks &watermarks);
+    inline Watermarks watermarks() const { return m_watermarks; }
+    void setWriteBufferPolicy(QMqttClient::WriteBufferPolicy policy);
+    inline QMqttClient::WriteBufferPolicy writeBufferPolicy() const { return m_writeBufferPolicy; }
+    inline void setWriteBufferQueueLimit(qint64 bytes) { m_writeBufferQueueLimit = qMax<qint64>(0, bytes); }
+    inline qint64 writeBufferQueueLimit() const { return m_writeBufferQueueLimit; }
+    inline bool isWriteBufferFull() const { return m_writeBufferFull; }
+    qint64 bytesToWrite() const;
+    int packetsToWrite() const;
+
+    bool setSessionStoreFile(const QString &fileName);
+    QString sessionStoreFile() const;
+
+    qint32 queueOfflinePublish(const QMqttTopicName &topic, const QByteArray &message, quint8 qos, bool retain);
+    inline QMqttOfflineQueue &offlineQueue() { return m_offlineQueue; }
+    inline const QMqttOfflineQueue &offlineQueue() const { return m_offlineQueue; }
+    void setOfflineDrainRate(int messagesPerSecond);
+    inline int offlineDrainRate() const { return m_offlineDrainRate; }
+
+    void setAutoReconnect(bool enable);
+    inline bool autoReconnect() const { return m_autoReconnect; }
+    void setReconnectIntervals(int minimum, int maximum);
+    inline int reconnectMinimumInterval() const { return m_reconnectMinimumInterval; }
+    inline int reconnectMaximumInterval() const { return m_reconnectMaximumInterval; }
+    void setReconnectTarget(const QString &sslPeerName);
+    void cancelReconnect();
+
+    inline QMqttSubscription::MessageHandler messageHandler() const { return m_messageHandler.handler(); }
+    inline void setMessageHandler(const QMqttSubscription::MessageHandler &handler) { m_messageHandler.setHandler(handler); }
+    inline QMqttClient::MessageDispatch messageDispatch() const { return m_messageDispatch; }
+    inline void setMessageDispatch(QMqttClient::MessageDispatch dispatch) { m_messageDispatch = dispatch; }
+
     inline InternalConnectionState internalState() const { return m_internalState; }
 
 public Q_SLOTS:
     void transportConnectionClosed();
     void transportReadReady();
+    void transportBytesWritten();
+    void transportConnected();
+    void transportError(QAbstractSocket::SocketError error);
 
 public:
     QIODevice *m_transport{nullptr};
@@ -100,34 +162,116 @@ public:
 private:
     Q_DISABLE_COPY(QMqttConnection)
     void someFuncToBeRemoved();
+    void connectSocketSignals();
     void finalize_connack();
     void finalize_suback();
     void finalize_unsuback();
+    bool isMessageReceivedConnected() const;
+    bool clientReceivesMessages() const;
+    void initialize_publish();
+    void stream_publish();
+    void abortStream();
     void finalize_publish();
+    void acknowledgePublish();
+    void resendInFlight();
+    void deliverBatches();
+    QVector<QSharedPointer<QMqttSubscription>> matchingSubscriptions(const QByteArray &topic) const;
     void finalize_pubAckRecComp();
     void finalize_pubrel();
     void finalize_pingresp();
     void processData();
     void readBuffer(char *data, qint64 size);
     QByteArray readBuffer(qint64 size);
-    QByteArray m_readBuffer;
+    QMqttFrameDecoder m_decoder;
     qint64 m_missingData{0};
     struct PublishData {
         quint8 qos;
         bool dup;
         bool retain;
+        bool duplicate; // QoS 2 message received before, not delivered again
+        quint16 id;
+        QByteArray topic; // UTF-8, decoded by QMqttMessage when needed
+        QVector<QSharedPointer<QMqttSubscription>> subscriptions;
+        bool streaming{false}; // streamStarted() emitted, payload not finished yet
     };
     PublishData m_currentPublish;
+    QVector<QSharedPointer<QMqttSubscription>> m_pendingBatches;
     QMqttControlPacket::PacketType m_currentPacket{QMqttControlPacket::UNKNOWN};
 
+    qint32 writePublish(const QByteArray &topic, const QByteArray &message, quint8 qos, bool retain);
     bool writePacketToTransport(const QMqttControlPacket &p);
-    QMap<quint16, QSharedPointer<QMqttSubscription>> m_pendingSubscriptionAck;
-    QMap<quint16, QSharedPointer<QMqttSubscription>> m_pendingUnsubscriptions;
+    bool writeSegmentsToTransport(const QMqttControlPacket &p);
+    bool canWriteDirectly() const;
+    bool writeDirectSegments();
+    void handOverDirectSegments();
+    void clearDirectSegments();
+    bool writeToTransport(const QByteArray &data);
+    bool m_writeCoalescing{false};
+    QByteArray m_writeBuffer;
+    QTimer m_flushTimer;
+    // Written to the socket descriptor with writev(), bypassing the socket.
+    // Segments are only referenced, whatever the kernel does not take is
+    // written once the descriptor is writable again. Everything written
+    // meanwhile is queued behind them.
+    QQueue<QByteArray> m_directSegments;
+    int m_directSegmentOffset{0};
+    qint64 m_directBytes{0};
+    QSocketNotifier *m_directWriteNotifier{nullptr};
+    void updateWriteBufferState();
+    void writeQueuedPublishes();
+    void scheduleOfflineDrain();
+    void drainOfflineQueue();
+    void scheduleReconnect();
+    void reconnect();
+    void resubscribe(bool sessionPresent);
+    bool writeSubscribe(const QVector<QSharedPointer<QMqttSubscription>> &subscriptions);
+    bool writeUnsubscribe(const QVector<QSharedPointer<QMqttSubscription>> &subscriptions);
+    int writeSubscriptionRequests(QMqttControlPacket::PacketType type,
+                                  const QVector<QSharedPointer<QMqttSubscription>> &subscriptions);
+    void abortSubscriptionRequests();
+    void forgetSubscriptions(const QVector<QSharedPointer<QMqttSubscription>> &subscriptions);
+    void rollbackPipelinedRequests();
+    Watermarks m_watermarks;
+    QMqttClient::WriteBufferPolicy m_writeBufferPolicy{QMqttClient::RejectWhenFull};
+    bool m_writeBufferFull{false};
+    qint64 m_bytesQueued{0};
+    QQueue<qint64> m_packetEnds;
+    // Publishes never written to the transport, they are kept when the
+    // connection is closed and written after the next CONNACK
+    struct QueuedPublish {
+        quint16 id; // 0 for QoS 0
+        QMqttControlPacket packet;
+    };
+    QQueue<QueuedPublish> m_queuedPublishes;
+    qint64 m_queuedPublishBytes{0};
+    qint64 m_writeBufferQueueLimit{16 * 1024 * 1024};
+    QVector<QMqttControlPacket> m_pipelinedPackets;
+    QMqttPacketIdTable<bool> m_pipelinedPublishes;
+    QMqttOfflineQueue m_offlineQueue;
+    int m_offlineDrainRate{0};
+    QTimer m_offlineDrainTimer;
+    QElapsedTimer m_offlineDrainClock;
+    double m_offlineDrainTokens{0};
+    QMqttPacketIdAllocator m_packetIds;
+    QMqttPacketIdTable<QVector<QSharedPointer<QMqttSubscription>>> m_pendingSubscriptionAck;
+    QMqttPacketIdTable<QVector<QSharedPointer<QMqttSubscription>>> m_pendingUnsubscriptions;
     QMap<QString, QSharedPointer<QMqttSubscription>> m_activeSubscriptions;
-    QMap<quint16, QSharedPointer<QMqttControlPacket>> m_pendingMessages;
-    QMap<quint16, QSharedPointer<QMqttControlPacket>> m_pendingReleaseMessages;
+    QMqttTopicTrie<QSharedPointer<QMqttSubscription>> m_subscriptionTrie;
+    QMqttPacketIdTable<QMqttControlPacket> m_pendingMessages;
+    QMqttPacketIdTable<QMqttControlPacket> m_pendingReleaseMessages;
+    QMqttPacketIdTable<bool> m_receivedQos2;
+    QMqttSessionStore m_sessionStore;
     InternalConnectionState m_internalState{BrokerDisconnected};
     QTimer m_pingTimer;
+    bool m_autoReconnect{false};
+    bool m_reconnectWanted{false};
+    int m_reconnectMinimumInterval{1000};
+    int m_reconnectMaximumInterval{60000};
+    int m_reconnectAttempt{0};
+    QString m_reconnectPeerName;
+    QTimer m_reconnectTimer;
+    QMqttMessageHandlerHolder m_messageHandler;
+    QMqttClient::MessageDispatch m_messageDispatch{QMqttClient::ClientAndSubscriptions};
 };
 
 QT_END_NAMESPACE
@@ -22,8 +22,23 @@
 #include "qmqttcontrolpacket_p.h"
 #include <QtCore/QtEndian>
 
+#include <cstring>
+
 QT_BEGIN_NAMESPACE
 
+namespace {
+inline int remainingLengthSize(quint32 length)
+{
+    if (length < 128)
+        return 1;
+    if (length < 16384)
+        return 2;
+    if (length < 2097152)
+        return 3;
+    return 4;
+}
+}
+
 QMqttControlPacket::QMqttControlPacket()
 {
 
@@ -46,6 +61,7 @@ void QMqttControlPacket::clear()
 {
     m_header = 0;
     m_payload.clear();
+    m_rawPayload.clear();
 }
 
 void QMqttControlPacket::setHeader(quint8 h)
@@ -56,51 +72,138 @@ void QMqttControlPacket::setHeader(quint8 h)
         m_header = h;
 }
 
+void QMqttControlPacket::setDup(bool dup)
+{
+    Q_ASSERT((m_header & 0xF0) == QMqttControlPacket::PUBLISH);
+    if (dup)
+        m_header |= 0x08;
+    else
+        m_header &= quint8(~0x08);
+}
+
 void QMqttControlPacket::append(char value)
 {
+    flushRawPayload();
     m_payload.append(value);
 }
 
 void QMqttControlPacket::append(quint16 value)
 {
+    flushRawPayload();
     const quint16 msb = qToBigEndian<quint16>(value);
-    const char * msb_c = reinterpret_cast<const char*>(&msb);
-    m_payload.append(msb_c[0]);
-    m_payload.append(msb_c[1]);
+    m_payload.append(reinterpret_cast<const char *>(&msb), 2);
 }
 
 void QMqttControlPacket::append(const QByteArray &data)
 {
     append(static_cast<quint16>(data.size()));
-    m_payload.append(data.constData());
+    m_payload.append(data);
 }
 
 void QMqttControlPacket::appendRaw(const QByteArray &data)
 {
-    m_payload.append(data.constData());
+    // Usually the message of a PUBLISH, which is only referenced here.
+    if (m_rawPayload.isEmpty())
+        m_rawPayload = data;
+    else
+        m_rawPayload.append(data);
+}
+
+quint32 QMqttControlPacket::remainingLength() const
+{
+    return quint32(m_payload.size()) + quint32(m_rawPayload.size());
+}
+
+bool QMqttControlPacket::exceedsMaximumSize() const
+{
+    if (remainingLength() <= maximumRemainingLength)
+        return false;
+    qWarning("Publishing a message bigger than maximum size!");
+    return true;
+}
+
+int QMqttControlPacket::serializedSize() const
+{
+    const quint32 length = remainingLength();
+    return 1 + remainingLengthSize(length) + int(length);
 }
 
 QByteArray QMqttControlPacket::serialize() const
 {
-    // Create ByteArray
-    QByteArray data;
-    // Add Header
-    data.append(char(m_header));
-    // Add length
-    quint32 msgSize = m_payload.size();
-    if (msgSize > 268435455) // 0xFFFFFF7F
-        qWarning("Publishing a message bigger than maximum size!");
+    if (exceedsMaximumSize())
+        return QByteArray();
+
+    // The frame is written into a single allocation of its final size
+    QByteArray data(serializedSize(), Qt::Uninitialized);
+    writeFrame(data.data());
+    return data;
+}
+
+bool QMqttControlPacket::serializeInto(QByteArray *buffer) const
+{
+    if (exceedsMaximumSize())
+        return false;
+
+    const int offset = buffer->size();
+    buffer->resize(offset + serializedSize());
+    writeFrame(buffer->data() + offset);
+    return true;
+}
+
+QByteArray QMqttControlPacket::serializeHeader() const
+{
+    if (exceedsMaximumSize())
+        return QByteArray();
+
+    QByteArray data(serializedSize() - m_rawPayload.size(), Qt::Uninitialized);
+    writeHeader(data.data());
+    return data;
+}
+
+char *QMqttControlPacket::writeHeader(char *out) const
+{
+    // The remaining length has at most four bytes, as sized by serializedSize()
+    quint32 msgSize = remainingLength();
+    Q_ASSERT(msgSize <= maximumRemainingLength);
+
+    *out++ = char(m_header);
     do {
         quint8 b = msgSize % 128;
         msgSize /= 128;
         if (msgSize > 0)
             b |= 0x80;
-        data.append(char(b));
+        *out++ = char(b);
     } while (msgSize > 0);
-    // Add payload
-    data.append(m_payload);
+    if (!m_payload.isEmpty()) {
+        memcpy(out, m_payload.constData(), size_t(m_payload.size()));
+        out += m_payload.size();
+    }
+    return out;
+}
 
-    return data;
+void QMqttControlPacket::writeFrame(char *out) const
+{
+    out = writeHeader(out);
+    if (!m_rawPayload.isEmpty())
+        memcpy(out, m_rawPayload.constData(), size_t(m_rawPayload.size()));
+}
+
+QByteArray QMqttControlPacket::payload() const
+{
+    if (m_rawPayload.isEmpty())
+        return m_payload;
+    if (m_payload.isEmpty())
+        return m_rawPayload;
+    return m_payload + m_rawPayload;
+}
+
+void QMqttControlPacket::flushRawPayload()
+{
+    // Keep the order of the data if something is appended after raw data
+    if (!m_rawPayload.isEmpty()) {
+        m_payload.append(m_rawPayload);
+        m_rawPayload.clear();
+    }
 }
 
 QT_END_NAMESPACE
@@ -68,17 +68,46 @@ public:
 
     void setHeader(quint8 h);
     inline quint8 header() const { return m_header; }
+    // 3.3.1.1 DUP flag of a PUBLISH, the other flags are kept
+    void setDup(bool dup);
+    inline bool isDup() const { return m_header & 0x08; }
 
     void append(char value);
     void append(quint16 value);
     void append(const QByteArray &data);
     void appendRaw(const QByteArray &data);
 
+    // 2.2.3 Remaining Length
+    static const quint32 maximumRemainingLength = 268435455;
+    quint32 remainingLength() const;
+    // Such a frame cannot be encoded, it must be rejected before serializing
+    bool exceedsMaximumSize() const;
+
+    // Size of the frame returned by serialize()
+    int serializedSize() const;
+    // Returns an empty array if the frame exceeds the maximum size
     QByteArray serialize() const;
-    inline QByteArray payload() const { return m_payload; }
+    // Appends the frame to buffer, which grows at most once. Returns false
+    // and leaves buffer untouched if the frame exceeds the maximum size.
+    bool serializeInto(QByteArray *buffer) const;
+    // Writes the frame to out, which must hold serializedSize() bytes. The
+    // frame must not exceed the maximum size.
+    inline void serializeInto(char *out) const { writeFrame(out); }
+    // The frame without the data appended by appendRaw(), which is returned
+    // by rawPayload(). Allows writing both without concatenating them.
+    QByteArray serializeHeader() const;
+    inline QByteArray rawPayload() const { return m_rawPayload; }
+    QByteArray payload() const;
 private:
+    void flushRawPayload();
+    char *writeHeader(char *out) const;
+    void writeFrame(char *out) const;
+
     quint8 m_header{UNKNOWN};
     QByteArray m_payload;
+    // Data appended by appendRaw() is kept shared until serialize() copies
+    // it into the frame.
+    QByteArray m_rawPayload;
 };
 
 QT_END_NAMESPACE
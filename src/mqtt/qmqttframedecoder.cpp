@@ -0,0 +1,238 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "qmqttframedecoder_p.h"
+#include "qmqttcontrolpacket_p.h"
+
+#include <QtCore/QIODevice>
+#include <QtCore/QtEndian>
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+// Maximum amount of data read into the buffer at once. Keeping this small
+// allows the decoder to switch to reading a payload directly.
+const qint64 readChunkSize = 64 * 1024;
+}
+
+qint64 QMqttFrameDecoder::readFrom(QIODevice *device)
+{
+    qint64 bytesRead = 0;
+    if (m_state == PublishPayload && !m_frameReady) {
+        const qint64 missing = m_publishPayloadLength - m_publishPayloadFilled;
+        const qint64 available = qMin(device->bytesAvailable(), missing);
+        if (available > 0) {
+            const qint64 res = device->read(reservePayload(int(available)), available);
+            if (res > 0) {
+                m_publishPayloadFilled += int(res);
+                bytesRead += res;
+            }
+            if (m_publishPayloadFilled < m_publishPayloadLength)
+                return bytesRead;
+        }
+    }
+    return bytesRead + m_buffer.readFrom(device, readChunkSize);
+}
+
+bool QMqttFrameDecoder::nextFrame()
+{
+    if (m_frameReady) {
+        m_frameReady = false;
+        if (m_state == PublishHeader) {
+            if (m_streamPayload) {
+                m_state = PublishStream;
+            } else {
+                // Only what is about to arrive, the length is announced by the peer
+                if (m_publishPayloadLength > 0) {
+                    const int size = qMin<qint64>(m_publishPayloadLength, m_buffer.size() + readChunkSize);
+                    m_publishPayload = QByteArray(size, Qt::Uninitialized);
+                }
+                m_state = PublishPayload;
+            }
+        } else if (m_state == PublishStream && publishPayloadRemaining() > 0) {
+            m_publishPayload.clear();
+        } else {
+            finishFrame();
+        }
+    }
+
+    for (;;) {
+        switch (m_state) {
+        case FixedHeader:
+            if (m_buffer.isEmpty())
+                return false;
+            m_buffer.read(reinterpret_cast<char *>(&m_header), 1);
+            m_remainingLength = 0;
+            m_lengthBytes = 0;
+            m_state = RemainingLength;
+            break;
+        case RemainingLength: {
+            // 2.2.3 Remaining Length, at most four bytes
+            if (m_buffer.isEmpty())
+                return false;
+            quint8 b;
+            m_buffer.read(reinterpret_cast<char *>(&b), 1);
+            m_remainingLength += quint32(b & 127) << (7 * m_lengthBytes);
+            m_lengthBytes++;
+            if (b & 128) {
+                if (m_lengthBytes == 4) {
+                    qWarning("Received frame with invalid remaining length");
+                    m_state = Error;
+                    return false;
+                }
+                break;
+            }
+            m_frameEnd = m_buffer.position() + m_remainingLength;
+            if ((m_header & 0xF0) == QMqttControlPacket::PUBLISH)
+                m_state = PublishHeader;
+            else
+                m_state = Body;
+            break;
+        }
+        case Body:
+            if (quint32(m_buffer.size()) < m_remainingLength)
+                return false;
+            m_frameReady = true;
+            return true;
+        case PublishHeader:
+            if (!readPublishHeader())
+                return false;
+            m_frameReady = true;
+            return true;
+        case PublishPayload:
+            if (!readPublishPayload())
+                return false;
+            m_frameReady = true;
+            return true;
+        case PublishStream:
+            if (!readPublishStream())
+                return false;
+            m_frameReady = true;
+            return true;
+        case Error:
+            return false;
+        }
+    }
+}
+
+void QMqttFrameDecoder::clear()
+{
+    m_buffer.clear();
+    m_state = FixedHeader;
+    m_frameReady = false;
+    m_header = 0;
+    m_lengthBytes = 0;
+    m_remainingLength = 0;
+    m_frameEnd = 0;
+    m_publishTopic.clear();
+    m_publishPayload.clear();
+    m_publishPayloadLength = 0;
+    m_publishPayloadFilled = 0;
+    m_publishId = 0;
+    m_streamPayload = false;
+}
+
+bool QMqttFrameDecoder::readPublishHeader()
+{
+    // 3.3.2 Variable header: topic name and, for QoS > 0, the packet identifier
+    const quint32 idLength = (m_header & 0x06) ? 2 : 0;
+    if (m_buffer.size() < 2)
+        return false;
+    const quint16 topicLength = qFromBigEndian<quint16>(m_buffer.constData());
+    const quint32 headerLength = 2 + topicLength + idLength;
+    if (Q_UNLIKELY(headerLength > m_remainingLength)) {
+        qWarning("Received PUBLISH with invalid topic length");
+        m_state = Error;
+        return false;
+    }
+    if (quint32(m_buffer.size()) < headerLength)
+        return false;
+
+    m_buffer.skip(2);
+    m_publishTopic = m_buffer.read(topicLength);
+    m_publishId = 0;
+    if (idLength) {
+        m_publishId = qFromBigEndian<quint16>(m_buffer.constData());
+        m_buffer.skip(2);
+    }
+
+    m_publishPayloadLength = int(m_remainingLength - headerLength);
+    m_publishPayloadFilled = 0;
+    m_streamPayload = false;
+    return true;
+}
+
+bool QMqttFrameDecoder::readPublishPayload()
+{
+    const int missing = publishPayloadRemaining();
+    const int buffered = qMin(missing, m_buffer.size());
+    if (buffered > 0) {
+        m_buffer.read(reservePayload(buffered), buffered);
+        m_publishPayloadFilled += buffered;
+#ifdef QT_BUILD_INTERNAL
+        m_copiedPayloadBytes += buffered;
+#endif
+    }
+    return m_publishPayloadFilled == m_publishPayloadLength;
+}
+
+// The payload grows with the data received, so that a frame announcing a
+// large payload does not allocate memory before the payload arrives.
+char *QMqttFrameDecoder::reservePayload(int size)
+{
+    const int needed = m_publishPayloadFilled + size;
+    if (needed > m_publishPayload.size())
+        m_publishPayload.resize(qMin(m_publishPayloadLength, qMax(needed, 2 * m_publishPayload.size())));
+    return m_publishPayload.data() + m_publishPayloadFilled;
+}
+
+bool QMqttFrameDecoder::readPublishStream()
+{
+    // An empty payload is reported as a single empty chunk
+    const int missing = publishPayloadRemaining();
+    if (missing > 0 && m_buffer.isEmpty())
+        return false;
+
+    const int chunkSize = qMin(missing, m_buffer.size());
+    m_publishPayload = m_buffer.read(chunkSize);
+    m_publishPayloadFilled += chunkSize;
+    return true;
+}
+
+void QMqttFrameDecoder::finishFrame()
+{
+    if (m_state == Body) {
+        const qint64 unread = qMin<qint64>(m_frameEnd - m_buffer.position(), m_buffer.size());
+        if (unread > 0)
+            m_buffer.skip(int(unread));
+    }
+    // Drop the references, the payload is owned by the messages now.
+    m_publishTopic.clear();
+    m_publishPayload.clear();
+    m_publishPayloadLength = 0;
+    m_publishPayloadFilled = 0;
+    m_frameReady = false;
+    m_state = FixedHeader;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,128 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTFRAMEDECODER_P_H
+#define QMQTTFRAMEDECODER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqttglobal.h"
+#include "qmqttreadbuffer_p.h"
+
+#include <QtCore/QtGlobal>
+
+QT_BEGIN_NAMESPACE
+
+// Splits the incoming byte stream into MQTT control packets. The decoder
+// keeps its state between calls, hence data can arrive in chunks of any
+// size. nextFrame() returns true once the fixed header, the remaining length
+// and the complete variable header and payload are buffered. The frame body
+// is then read from buffer(). Bytes of the body which have not been read are
+// skipped with the next call to nextFrame().
+//
+// PUBLISH frames are decoded by the decoder itself. nextFrame() returns true
+// in state PublishHeader as soon as the variable header is available. The
+// caller then either lets the payload be buffered completely, in which case
+// nextFrame() returns in state PublishPayload once it has been received, or
+// requests streaming via setStreamPayload(). Then nextFrame() returns in
+// state PublishStream for every chunk of the payload which arrives.
+//
+// readFrom() reads a buffered payload from the device directly into its
+// final buffer. Only the part of the payload which was already buffered
+// together with the variable header gets copied. The buffer grows with the
+// data received instead of being allocated with the announced length.
+class Q_AUTOTEST_EXPORT QMqttFrameDecoder
+{
+public:
+    enum State {
+        FixedHeader = 0,
+        RemainingLength,
+        Body,
+        PublishHeader,
+        PublishPayload,
+        PublishStream,
+        Error
+    };
+
+    inline void append(const QByteArray &data) { m_buffer.append(data); }
+    qint64 readFrom(QIODevice *device);
+
+    bool nextFrame();
+    void clear();
+
+    inline State state() const { return m_state; }
+    inline bool hasError() const { return m_state == Error; }
+
+    inline quint8 header() const { return m_header; }
+    inline quint32 remainingLength() const { return m_remainingLength; }
+    inline QMqttReadBuffer &buffer() { return m_buffer; }
+
+    inline QByteArray publishTopic() const { return m_publishTopic; }
+    inline quint16 publishId() const { return m_publishId; }
+    // The complete payload in state PublishPayload, the current chunk in
+    // state PublishStream
+    inline QByteArray publishPayload() const { return m_publishPayload; }
+    inline int publishPayloadLength() const { return m_publishPayloadLength; }
+    inline int publishPayloadRemaining() const { return m_publishPayloadLength - m_publishPayloadFilled; }
+    inline void setStreamPayload(bool stream) { m_streamPayload = stream; }
+
+#ifdef QT_BUILD_INTERNAL
+    // Payload bytes which have been copied out of the read buffer
+    inline quint64 copiedPayloadBytes() const { return m_copiedPayloadBytes; }
+#endif
+
+private:
+    bool readPublishHeader();
+    bool readPublishPayload();
+    char *reservePayload(int size);
+    bool readPublishStream();
+    void finishFrame();
+
+    QMqttReadBuffer m_buffer;
+    State m_state{FixedHeader};
+    bool m_frameReady{false};
+    quint8 m_header{0};
+    quint8 m_lengthBytes{0};
+    quint32 m_remainingLength{0};
+    qint64 m_frameEnd{0};
+    QByteArray m_publishTopic;
+    QByteArray m_publishPayload;
+    int m_publishPayloadLength{0};
+    int m_publishPayloadFilled{0};
+    quint16 m_publishId{0};
+    bool m_streamPayload{false};
+#ifdef QT_BUILD_INTERNAL
+    quint64 m_copiedPayloadBytes{0};
+#endif
+};
+
+QT_END_NAMESPACE
+
+#endif // QMQTTFRAMEDECODER_P_H
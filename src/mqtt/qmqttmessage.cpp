@@ -21,6 +21,8 @@
 
 #include "qmqttmessage.h"
 
+#include <QtCore/QAtomicPointer>
+
 QT_BEGIN_NAMESPACE
 
 /*!
@@ -32,6 +34,9 @@ QT_BEGIN_NAMESPACE
 
     A QMqttMessage only is created inside the module and returned via the
     \l QMqttSubscription::messageReceived() signal.
+
+    QMqttMessage is implicitly shared. Passing a message to several subscriptions or via a
+    queued connection to another thread does not copy the topic or the payload.
 */
 
 /*!
@@ -40,6 +45,9 @@ QT_BEGIN_NAMESPACE
 
     In case a wildcard has been used for a subscription, QMqttMessage::topic describes the
     topic matching this subscription. This property never contains any wildcard.
+
+    The topic is received encoded in UTF-8 and only converted when it is requested for the
+    first time. Use topicUtf8() to access it without the conversion.
 */
 
 /*!
@@ -78,44 +86,132 @@ QT_BEGIN_NAMESPACE
     store one retained message per topic.
 */
 
+class QMqttMessagePrivate : public QSharedData
+{
+public:
+    ~QMqttMessagePrivate() { delete topic.load(); }
+    QByteArray topicUtf8;
+    QAtomicPointer<QString> topic; // Decoded on first use
+    QByteArray payload;
+    quint16 id{0};
+    quint8 qos{0};
+    bool duplicate{false};
+    bool retain{false};
+};
+
+/*!
+    Creates an empty message. Messages with content are only created by the module.
+*/
+QMqttMessage::QMqttMessage()
+{
+}
+
+/*!
+    Creates a new message as a copy of \a other.
+*/
+QMqttMessage::QMqttMessage(const QMqttMessage &other)
+    : d(other.d)
+{
+}
+
+/*!
+    \fn QMqttMessage::QMqttMessage(QMqttMessage &&other)
+
+    Move-constructs a message from \a other. \a other is left empty.
+*/
+
+/*!
+    Destroys the message.
+*/
+QMqttMessage::~QMqttMessage()
+{
+}
+
+/*!
+    Assigns \a other to this message.
+*/
+QMqttMessage &QMqttMessage::operator=(const QMqttMessage &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/*!
+    \fn QMqttMessage &QMqttMessage::operator=(QMqttMessage &&other)
+
+    Move-assigns \a other to this message.
+*/
+
+/*!
+    \fn void QMqttMessage::swap(QMqttMessage &other)
+
+    Swaps this message with \a other. This operation is very fast and never fails.
+*/
+
 QByteArray QMqttMessage::payload() const
 {
-    return m_payload;
+    return d ? d->payload : QByteArray();
 }
 
 quint8 QMqttMessage::qos() const
 {
-    return m_qos;
+    return d ? d->qos : quint8(0);
 }
 
 quint16 QMqttMessage::id() const
 {
-    return m_id;
+    return d ? d->id : quint16(0);
 }
 
 QString QMqttMessage::topic() const
 {
-    return m_topic;
+    if (!d)
+        return QString();
+
+    // Most receivers never look at the topic, it is only decoded on request.
+    // Threads sharing the message might decode it at the same time, the
+    // first result published is kept.
+    QString *topic = d->topic.loadAcquire();
+    if (!topic) {
+        QString *decoded = new QString(QString::fromUtf8(d->topicUtf8));
+        if (d->topic.testAndSetOrdered(nullptr, decoded)) {
+            topic = decoded;
+        } else {
+            delete decoded;
+            topic = d->topic.loadAcquire();
+        }
+    }
+    return *topic;
+}
+
+/*!
+    Returns the topic of the message encoded in UTF-8, as it has been received from the
+    broker. Unlike topic(), this does not need to convert the topic.
+*/
+QByteArray QMqttMessage::topicUtf8() const
+{
+    return d ? d->topicUtf8 : QByteArray();
 }
 
 bool QMqttMessage::duplicate() const
 {
-    return m_duplicate;
+    return d && d->duplicate;
 }
 
 bool QMqttMessage::retain() const
 {
-    return m_retain;
+    return d && d->retain;
 }
 
-QMqttMessage::QMqttMessage(const QString &topic, const QByteArray &content, quint16 id, quint8 qos, bool dup, bool retain)
-    : m_topic(topic)
-    , m_payload(content)
-    , m_id(id)
-    , m_qos(qos)
-    , m_duplicate(dup)
-    , m_retain(retain)
+QMqttMessage::QMqttMessage(const QByteArray &topic, const QByteArray &content, quint16 id, quint8 qos, bool dup, bool retain)
+    : d(new QMqttMessagePrivate)
 {
+    d->topicUtf8 = topic;
+    d->payload = content;
+    d->id = id;
+    d->qos = qos;
+    d->duplicate = dup;
+    d->retain = retain;
 }
 
 QT_END_NAMESPACE
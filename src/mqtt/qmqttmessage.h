@@ -24,40 +24,57 @@
 
 #include "qmqttglobal.h"
 
+#include <QtCore/QExplicitlySharedDataPointer>
+#include <QtCore/QMetaType>
 #include <QtCore/QObject>
 
 QT_BEGIN_NAMESPACE
 
+class QMqttMessagePrivate;
+
 class Q_MQTT_EXPORT QMqttMessage
 {
     Q_GADGET
     Q_PROPERTY(QString topic READ topic CONSTANT)
+    Q_PROPERTY(QByteArray topicUtf8 READ topicUtf8 CONSTANT)
     Q_PROPERTY(QByteArray payload READ payload CONSTANT)
     Q_PROPERTY(quint16 id READ id CONSTANT)
     Q_PROPERTY(quint8 qos READ qos CONSTANT)
     Q_PROPERTY(bool duplicate READ duplicate CONSTANT)
     Q_PROPERTY(bool retain READ retain CONSTANT)
 public:
+    QMqttMessage();
+    QMqttMessage(const QMqttMessage &other);
+    ~QMqttMessage();
+
+    QMqttMessage &operator=(const QMqttMessage &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QMqttMessage(QMqttMessage &&other) Q_DECL_NOTHROW { swap(other); }
+    QMqttMessage &operator=(QMqttMessage &&other) Q_DECL_NOTHROW { swap(other); return *this; }
+#endif
+
+    inline void swap(QMqttMessage &other) Q_DECL_NOTHROW { qSwap(d, other.d); }
+
     QByteArray payload() const;
     quint8 qos() const;
     quint16 id() const;
     QString topic() const;
+    QByteArray topicUtf8() const;
     bool duplicate() const;
     bool retain() const;
 
 private:
     friend class QMqttConnection;
-    explicit QMqttMessage(const QString &topic, const QByteArray &payload,
+    explicit QMqttMessage(const QByteArray &topic, const QByteArray &payload,
                           quint16 id, quint8 qos,
                           bool dup, bool retain);
-    QString m_topic;
-    QByteArray m_payload;
-    quint16 m_id;
-    quint8 m_qos;
-    bool m_duplicate;
-    bool m_retain;
+    QExplicitlySharedDataPointer<QMqttMessagePrivate> d;
 };
 
+Q_DECLARE_SHARED(QMqttMessage)
+
 QT_END_NAMESPACE
 
+Q_DECLARE_METATYPE(QMqttMessage)
+
 #endif // QMQTTMESSAGE_H
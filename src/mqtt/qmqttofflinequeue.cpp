@@ -0,0 +1,413 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "qmqttofflinequeue_p.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QLoggingCategory>
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+Q_LOGGING_CATEGORY(lcMqttOfflineQueue, "qt.mqtt.offlinequeue")
+
+namespace {
+const QDataStream::Version streamVersion = QDataStream::Qt_5_6;
+
+enum RecordFlags : quint8 {
+    QosMask = 0x03,
+    Retain = 0x04,
+    Conflated = 0x08
+};
+
+// Serialized size of the sequence, expiry, flags, topic and message
+inline qint64 recordSize(const QByteArray &topic, const QByteArray &message)
+{
+    return 8 + 8 + 1 + 4 + topic.size() + 4 + message.size();
+}
+}
+
+QMqttOfflineQueue::QMqttOfflineQueue()
+{
+}
+
+QMqttOfflineQueue::~QMqttOfflineQueue()
+{
+    // The log stays for the next run
+    m_readFile.close();
+    m_writeFile.close();
+}
+
+void QMqttOfflineQueue::setMemoryLimit(qint64 bytes)
+{
+    m_memoryLimit = qMax<qint64>(0, bytes);
+}
+
+// Picks up the log left in path. Fails if the current log still contains
+// messages.
+bool QMqttOfflineQueue::setDirectory(const QString &path)
+{
+    if (path == m_directory)
+        return true;
+    if (m_logRecords > 0) {
+        qWarning("Cannot change the directory of the offline queue while it contains messages");
+        return false;
+    }
+
+    removeLog();
+    m_directory = path;
+    if (m_directory.isEmpty())
+        return true;
+    if (!QDir().mkpath(m_directory)) {
+        qWarning("Could not create directory %s for the offline queue", qPrintable(m_directory));
+        m_directory.clear();
+        return false;
+    }
+    recoverLog();
+    return true;
+}
+
+void QMqttOfflineQueue::setDiskLimit(qint64 bytes)
+{
+    m_diskLimit = qMax<qint64>(0, bytes);
+}
+
+void QMqttOfflineQueue::setSegmentSize(qint64 bytes)
+{
+    m_segmentSize = qMax<qint64>(1, bytes);
+}
+
+// Affects messages enqueued from now on
+void QMqttOfflineQueue::setConflation(const QByteArray &filter, bool conflate)
+{
+    if (conflate)
+        m_conflation.insert(filter, true);
+    else
+        m_conflation.remove(filter);
+}
+
+void QMqttOfflineQueue::setExpiry(const QByteArray &filter, int msecs)
+{
+    if (msecs > 0)
+        m_expiry.insert(filter, msecs);
+    else
+        m_expiry.remove(filter);
+}
+
+bool QMqttOfflineQueue::enqueue(const QMqttTopicName &topic, const QByteArray &message, quint8 qos, bool retain)
+{
+    if (!isEnabled())
+        return false;
+
+    const QByteArray topicUtf8 = topic.toUtf8();
+    Message entry;
+    entry.topic = topic;
+    entry.message = message;
+    entry.qos = qos;
+    entry.retain = retain;
+    entry.conflated = !m_conflation.isEmpty() && !m_conflation.match(topicUtf8).isEmpty();
+    if (!m_expiry.isEmpty()) {
+        // The shortest one of all matching filters applies
+        const QVector<int> expiries = m_expiry.match(topicUtf8);
+        if (!expiries.isEmpty())
+            entry.expiry = QDateTime::currentMSecsSinceEpoch() + *std::min_element(expiries.constBegin(), expiries.constEnd());
+    }
+    entry.sequence = ++m_sequence;
+
+    const int size = messageSize(entry);
+    const bool inMemory = m_logRecords == 0 && m_memoryBytes + size <= m_memoryLimit;
+    if (inMemory) {
+        m_memory.push_back(entry);
+        m_memoryBytes += size;
+    } else if (m_directory.isEmpty() || !appendToLog(entry)) {
+        qCDebug(lcMqttOfflineQueue) << "Offline queue full, rejecting message on" << topic.name();
+        return false;
+    }
+
+    if (entry.conflated) {
+        auto previous = m_latest.find(topicUtf8);
+        if (previous != m_latest.end()) {
+            // A replaced message in the log is skipped once it is read
+            m_depth--;
+            m_bytes -= previous->size;
+            m_discarded++;
+            if (previous->inMemory) {
+                m_memoryBytes -= previous->size;
+                m_memory.erase(previous->position);
+            }
+        }
+        Latest latest;
+        latest.sequence = entry.sequence;
+        latest.size = size;
+        latest.inMemory = inMemory;
+        if (inMemory)
+            latest.position = std::prev(m_memory.end());
+        m_latest.insert(topicUtf8, latest);
+    }
+
+    m_depth++;
+    m_bytes += size;
+    return true;
+}
+
+// Takes the oldest message which is neither replaced nor expired
+bool QMqttOfflineQueue::dequeue(Message *message)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (;;) {
+        Message entry;
+        if (!m_memory.empty()) {
+            entry = m_memory.front();
+            m_memory.pop_front();
+            m_memoryBytes -= messageSize(entry);
+        } else if (!readFromLog(&entry)) {
+            return false;
+        } else if (entry.conflated && !isLatest(entry)) {
+            continue;
+        }
+
+        if (entry.conflated)
+            m_latest.remove(entry.topic.toUtf8());
+        m_depth--;
+        m_bytes -= messageSize(entry);
+
+        if (entry.expiry && entry.expiry <= now) {
+            qCDebug(lcMqttOfflineQueue) << "Dropping expired message on" << entry.topic.name();
+            m_discarded++;
+            continue;
+        }
+        *message = entry;
+        return true;
+    }
+}
+
+void QMqttOfflineQueue::clear()
+{
+    m_memory.clear();
+    m_memoryBytes = 0;
+    m_latest.clear();
+    removeLog();
+    m_depth = 0;
+    m_bytes = 0;
+}
+
+int QMqttOfflineQueue::messageSize(const Message &message)
+{
+    return message.topic.toUtf8().size() + message.message.size();
+}
+
+bool QMqttOfflineQueue::isLatest(const Message &message) const
+{
+    const auto latest = m_latest.constFind(message.topic.toUtf8());
+    return latest != m_latest.constEnd() && latest->sequence == message.sequence;
+}
+
+bool QMqttOfflineQueue::appendToLog(const Message &message)
+{
+    const QByteArray topic = message.topic.toUtf8();
+    const qint64 size = recordSize(topic, message.message);
+    if (m_diskLimit > 0 && m_diskBytes + size > m_diskLimit)
+        return false;
+
+    if (m_writeFile.isOpen() && m_writeFile.size() >= m_segmentSize) {
+        m_writeFile.close();
+        m_writeSegment++;
+    }
+    if (!m_writeFile.isOpen() && !openWriteSegment())
+        return false;
+
+    quint8 flags = message.qos & QosMask;
+    if (message.retain)
+        flags |= Retain;
+    if (message.conflated)
+        flags |= Conflated;
+    m_writer << message.sequence << message.expiry << flags << topic << message.message;
+    // Flushed, so the record can be read right away
+    if (m_writer.status() != QDataStream::Ok || !m_writeFile.flush()) {
+        qWarning("Could not write to offline queue segment %s", qPrintable(m_writeFile.fileName()));
+        m_writer.resetStatus();
+        return false;
+    }
+    m_diskBytes += size;
+    m_logRecords++;
+    return true;
+}
+
+bool QMqttOfflineQueue::readFromLog(Message *message)
+{
+    while (m_logRecords > 0) {
+        if (!m_readFile.isOpen() && !openReadSegment())
+            break;
+
+        if (!m_reader.atEnd()) {
+            quint8 flags = 0;
+            QByteArray topic;
+            m_reader >> message->sequence >> message->expiry >> flags >> topic >> message->message;
+            if (m_reader.status() == QDataStream::Ok) {
+                message->topic = QMqttTopicName(QString::fromUtf8(topic));
+                message->qos = flags & QosMask;
+                message->retain = flags & Retain;
+                message->conflated = flags & Conflated;
+                if (--m_logRecords == 0)
+                    removeLog();
+                return true;
+            }
+            qWarning("Offline queue segment %s is corrupted", qPrintable(m_readFile.fileName()));
+            m_reader.resetStatus();
+        }
+
+        // The segment has been read completely
+        if (m_readSegment >= m_writeSegment)
+            break;
+        m_diskBytes -= m_readFile.size();
+        m_readFile.remove();
+        m_readSegment++;
+    }
+
+    // Records have been lost, what is left is in memory
+    removeLog();
+    m_depth = int(m_memory.size());
+    m_bytes = m_memoryBytes;
+    for (auto it = m_latest.begin(); it != m_latest.end();) {
+        if (it->inMemory)
+            ++it;
+        else
+            it = m_latest.erase(it);
+    }
+    return false;
+}
+
+bool QMqttOfflineQueue::openWriteSegment()
+{
+    m_writeFile.setFileName(segmentPath(m_writeSegment));
+    if (!m_writeFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning("Could not open offline queue segment %s", qPrintable(m_writeFile.fileName()));
+        return false;
+    }
+    m_writer.setDevice(&m_writeFile);
+    m_writer.setVersion(streamVersion);
+    return true;
+}
+
+bool QMqttOfflineQueue::openReadSegment()
+{
+    for (; m_readSegment <= m_writeSegment; ++m_readSegment) {
+        m_readFile.setFileName(segmentPath(m_readSegment));
+        if (m_readFile.open(QIODevice::ReadOnly)) {
+            m_reader.setDevice(&m_readFile);
+            m_reader.setVersion(streamVersion);
+            return true;
+        }
+    }
+    m_readSegment = m_writeSegment;
+    return false;
+}
+
+void QMqttOfflineQueue::removeLog()
+{
+    m_reader.setDevice(nullptr);
+    m_readFile.close();
+    m_writer.setDevice(nullptr);
+    m_writeFile.close();
+    if (!m_directory.isEmpty()) {
+        for (int segment = m_readSegment; segment <= m_writeSegment; ++segment)
+            QFile::remove(segmentPath(segment));
+    }
+    m_readSegment = 0;
+    m_writeSegment = 0;
+    m_logRecords = 0;
+    m_diskBytes = 0;
+}
+
+// Counts the records of the segments in m_directory. A record written
+// partially at the end of the last segment is cut off, so that appending
+// continues behind the last complete one.
+void QMqttOfflineQueue::recoverLog()
+{
+    const QStringList names = QDir(m_directory).entryList(QStringList(QLatin1String("*.mqq")),
+                                                          QDir::Files, QDir::Name);
+    QVector<int> segments;
+    for (const QString &name : names) {
+        bool ok = false;
+        const int segment = name.left(name.size() - 4).toInt(&ok);
+        if (ok)
+            segments.append(segment);
+    }
+    if (segments.isEmpty())
+        return;
+    std::sort(segments.begin(), segments.end());
+    m_readSegment = segments.first();
+    m_writeSegment = segments.last();
+
+    for (int segment : qAsConst(segments)) {
+        QFile file(segmentPath(segment));
+        if (!file.open(QIODevice::ReadWrite))
+            continue;
+        QDataStream stream(&file);
+        stream.setVersion(streamVersion);
+        qint64 validEnd = 0;
+        while (!stream.atEnd()) {
+            Message entry;
+            quint8 flags = 0;
+            QByteArray topic;
+            stream >> entry.sequence >> entry.expiry >> flags >> topic >> entry.message;
+            if (stream.status() != QDataStream::Ok)
+                break;
+            validEnd = file.pos();
+
+            const int size = topic.size() + entry.message.size();
+            m_sequence = qMax(m_sequence, entry.sequence);
+            m_logRecords++;
+            m_depth++;
+            m_bytes += size;
+            if (flags & Conflated) {
+                auto previous = m_latest.find(topic);
+                if (previous != m_latest.end()) {
+                    m_depth--;
+                    m_bytes -= previous->size;
+                }
+                Latest latest;
+                latest.sequence = entry.sequence;
+                latest.size = size;
+                m_latest.insert(topic, latest);
+            }
+        }
+        if (segment == m_writeSegment && validEnd < file.size()) {
+            qWarning("Offline queue segment %s is truncated", qPrintable(file.fileName()));
+            file.resize(validEnd);
+        }
+        m_diskBytes += file.size();
+    }
+
+    qCDebug(lcMqttOfflineQueue) << "Recovered" << m_logRecords << "messages from" << m_directory;
+    if (m_logRecords == 0)
+        removeLog();
+}
+
+QString QMqttOfflineQueue::segmentPath(int segment) const
+{
+    return m_directory + QLatin1Char('/') + QString::number(segment).rightJustified(8, QLatin1Char('0'))
+            + QLatin1String(".mqq");
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,158 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTOFFLINEQUEUE_P_H
+#define QMQTTOFFLINEQUEUE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqttglobal.h"
+#include "qmqtttopicname.h"
+#include "qmqtttopictrie_p.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+#include <list>
+
+QT_BEGIN_NAMESPACE
+
+// Keeps messages published while the client is not connected, in the order
+// they have been published.
+//
+// Messages are kept in memory up to the memory limit. Further messages are
+// appended to a log in a directory, split into segment files. Once a
+// message went to the log, all following messages do so as well until the
+// log has been read completely, which keeps the order. A segment is deleted
+// once it has been read. A log left behind by a previous run is picked up
+// when the directory is set.
+//
+// On topics with conflation only the latest message is kept. A replaced
+// message is removed from memory immediately, in the log it is skipped when
+// read. Messages on topics with an expiry are dropped when they are read
+// after their expiry.
+class Q_AUTOTEST_EXPORT QMqttOfflineQueue
+{
+public:
+    struct Message {
+        QMqttTopicName topic;
+        QByteArray message;
+        quint8 qos{0};
+        bool retain{false};
+        bool conflated{false};
+        qint64 expiry{0};   // Milliseconds since the epoch, 0 if it does not expire
+        quint64 sequence{0};
+    };
+
+    QMqttOfflineQueue();
+    ~QMqttOfflineQueue();
+
+    inline bool isEnabled() const { return m_memoryLimit > 0 || !m_directory.isEmpty(); }
+
+    void setMemoryLimit(qint64 bytes);
+    inline qint64 memoryLimit() const { return m_memoryLimit; }
+    bool setDirectory(const QString &path);
+    inline QString directory() const { return m_directory; }
+    void setDiskLimit(qint64 bytes);
+    inline qint64 diskLimit() const { return m_diskLimit; }
+    void setSegmentSize(qint64 bytes);
+    inline qint64 segmentSize() const { return m_segmentSize; }
+
+    void setConflation(const QByteArray &filter, bool conflate);
+    void setExpiry(const QByteArray &filter, int msecs);
+
+    bool enqueue(const QMqttTopicName &topic, const QByteArray &message, quint8 qos, bool retain);
+    bool dequeue(Message *message);
+    void clear();
+
+    inline bool isEmpty() const { return m_depth == 0; }
+    inline int depth() const { return m_depth; }
+    inline qint64 bytes() const { return m_bytes; }
+    inline qint64 memoryBytes() const { return m_memoryBytes; }
+    inline qint64 diskBytes() const { return m_diskBytes; }
+    inline int discarded() const { return m_discarded; }
+
+private:
+    Q_DISABLE_COPY(QMqttOfflineQueue)
+
+    typedef std::list<Message> MessageList;
+    struct Latest {
+        quint64 sequence{0};
+        int size{0};
+        bool inMemory{false};
+        MessageList::iterator position;
+    };
+
+    static int messageSize(const Message &message);
+    void discard(const Message &message);
+    bool isLatest(const Message &message) const;
+
+    bool appendToLog(const Message &message);
+    bool readFromLog(Message *message);
+    bool openWriteSegment();
+    bool openReadSegment();
+    void removeLog();
+    void recoverLog();
+    QString segmentPath(int segment) const;
+
+    qint64 m_memoryLimit{0};
+    qint64 m_diskLimit{0};
+    qint64 m_segmentSize{4 * 1024 * 1024};
+    QString m_directory;
+
+    QMqttTopicTrie<bool> m_conflation;
+    QMqttTopicTrie<int> m_expiry;
+    QHash<QByteArray, Latest> m_latest;
+
+    MessageList m_memory;
+    quint64 m_sequence{0};
+    int m_depth{0};
+    qint64 m_bytes{0};
+    qint64 m_memoryBytes{0};
+    int m_discarded{0};
+
+    // Segments from m_readSegment to m_writeSegment hold m_logRecords
+    // records not read yet, including replaced ones
+    QFile m_readFile;
+    QDataStream m_reader;
+    int m_readSegment{0};
+    QFile m_writeFile;
+    QDataStream m_writer;
+    int m_writeSegment{0};
+    int m_logRecords{0};
+    qint64 m_diskBytes{0};
+};
+
+QT_END_NAMESPACE
+
+#endif // QMQTTOFFLINEQUEUE_P_H
@@ -0,0 +1,121 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "qmqttpacketidallocator_p.h"
+
+#include <QtCore/qalgorithms.h>
+
+QT_BEGIN_NAMESPACE
+
+QMqttPacketIdAllocator::QMqttPacketIdAllocator()
+{
+    clear();
+}
+
+quint16 QMqttPacketIdAllocator::allocate()
+{
+    if (isFull())
+        return 0;
+
+    // Continue after the last identifier handed out
+    int word = m_next >> 6;
+    quint64 bits = m_free[word] & (~quint64(0) << (m_next & 63));
+    if (!bits) {
+        word = findFreeWord(word + 1);
+        bits = m_free[word];
+    }
+
+    const int bit = int(qCountTrailingZeroBits(bits));
+    m_free[word] &= ~(quint64(1) << bit);
+    if (!m_free[word])
+        m_summary[word >> 6] &= ~(quint64(1) << (word & 63));
+
+    const quint16 id = quint16(word * 64 + bit);
+    m_next = quint16(id + 1); // Wraps to 0, which is never free
+    m_allocatedCount++;
+    return id;
+}
+
+// Marks a specific identifier as in use, for instance one restored from a
+// previous session. Allocation continues after it.
+bool QMqttPacketIdAllocator::reserve(quint16 id)
+{
+    if (id == 0 || isAllocated(id))
+        return false;
+
+    const int word = id >> 6;
+    m_free[word] &= ~(quint64(1) << (id & 63));
+    if (!m_free[word])
+        m_summary[word >> 6] &= ~(quint64(1) << (word & 63));
+    m_next = quint16(id + 1);
+    m_allocatedCount++;
+    return true;
+}
+
+bool QMqttPacketIdAllocator::release(quint16 id)
+{
+    if (id == 0 || !isAllocated(id))
+        return false;
+
+    const int word = id >> 6;
+    m_free[word] |= quint64(1) << (id & 63);
+    m_summary[word >> 6] |= quint64(1) << (word & 63);
+    m_allocatedCount--;
+    return true;
+}
+
+void QMqttPacketIdAllocator::clear()
+{
+    for (int i = 0; i < WordCount; ++i)
+        m_free[i] = ~quint64(0);
+    for (int i = 0; i < SummaryCount; ++i)
+        m_summary[i] = ~quint64(0);
+    // 0 is reserved
+    m_free[0] &= ~quint64(1);
+    m_allocatedCount = 0;
+    m_next = 1;
+}
+
+bool QMqttPacketIdAllocator::isAllocated(quint16 id) const
+{
+    return !(m_free[id >> 6] & (quint64(1) << (id & 63)));
+}
+
+// Returns the first word at or after start, wrapping around, which contains
+// a free identifier. There must be one.
+int QMqttPacketIdAllocator::findFreeWord(int start) const
+{
+    start %= WordCount;
+    const int first = start >> 6;
+    quint64 bits = m_summary[first] & (~quint64(0) << (start & 63));
+    if (bits)
+        return first * 64 + int(qCountTrailingZeroBits(bits));
+
+    for (int i = 1; i <= SummaryCount; ++i) {
+        const int index = (first + i) % SummaryCount;
+        if (m_summary[index])
+            return index * 64 + int(qCountTrailingZeroBits(m_summary[index]));
+    }
+    Q_UNREACHABLE();
+    return 0;
+}
+
+QT_END_NAMESPACE
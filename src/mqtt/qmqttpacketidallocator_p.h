@@ -0,0 +1,87 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTPACKETIDALLOCATOR_P_H
+#define QMQTTPACKETIDALLOCATOR_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqttglobal.h"
+
+#include <QtCore/QtGlobal>
+
+QT_BEGIN_NAMESPACE
+
+// Hands out the packet identifiers of one connection. PUBLISH, SUBSCRIBE
+// and UNSUBSCRIBE share the identifier space, MQTT-2.3.1-2, hence an
+// identifier is only reused after it has been released.
+//
+// Free identifiers are tracked in a bitmap of 65536 bits. A second level
+// bitmap marks the words which still contain a free bit, so allocate() and
+// release() need a bounded number of operations, independent of the number
+// of identifiers in use. Identifiers are handed out round-robin, a released
+// identifier is not reused before all others have been used. 0 is not a
+// valid identifier and returned if all identifiers are in use.
+class Q_AUTOTEST_EXPORT QMqttPacketIdAllocator
+{
+public:
+    QMqttPacketIdAllocator();
+
+    quint16 allocate();
+    bool reserve(quint16 id);
+    bool release(quint16 id);
+    void clear();
+
+    bool isAllocated(quint16 id) const;
+    inline int allocatedCount() const { return m_allocatedCount; }
+    inline bool isFull() const { return m_allocatedCount == MaximumId; }
+    // The identifier allocate() tries first, 0 stands for 65536
+    inline quint16 nextId() const { return m_next; }
+
+    enum { MaximumId = 65535 };
+
+private:
+    int findFreeWord(int start) const;
+
+    enum {
+        WordCount = (MaximumId + 1) / 64,
+        SummaryCount = WordCount / 64
+    };
+    // A set bit marks a free identifier
+    quint64 m_free[WordCount];
+    // A set bit marks a word of m_free with a free identifier
+    quint64 m_summary[SummaryCount];
+    int m_allocatedCount{0};
+    quint16 m_next{1};
+};
+
+QT_END_NAMESPACE
+
+#endif // QMQTTPACKETIDALLOCATOR_P_H
@@ -0,0 +1,192 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTPACKETIDTABLE_P_H
+#define QMQTTPACKETIDTABLE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqttglobal.h"
+
+#include <QtCore/QtGlobal>
+
+#include <utility>
+
+QT_BEGIN_NAMESPACE
+
+// Maps packet identifiers to the state of a request in flight. The values
+// are stored inline in pages of 256 slots, indexed by the high and the low
+// byte of the identifier. A lookup is two array accesses, and a page is
+// only allocated while one of its identifiers is in use. As identifiers are
+// handed out round-robin, requests in flight share few pages.
+template <typename T>
+class QMqttPacketIdTable
+{
+public:
+    QMqttPacketIdTable() {}
+    ~QMqttPacketIdTable() { clear(); }
+
+    inline int size() const { return m_size; }
+    inline bool isEmpty() const { return m_size == 0; }
+
+    inline bool contains(quint16 id) const { return find(id) != nullptr; }
+    T *find(quint16 id);
+    const T *find(quint16 id) const;
+
+    void insert(quint16 id, const T &value);
+    bool remove(quint16 id);
+    T take(quint16 id);
+    void clear();
+
+    // Calls function(id, value) for all entries in ascending order of id.
+    // function must not insert or remove entries.
+    template <typename Function>
+    void forEach(Function function) const;
+
+private:
+    Q_DISABLE_COPY(QMqttPacketIdTable)
+
+    enum {
+        PageBits = 8,
+        PageSize = 1 << PageBits,
+        PageCount = 65536 / PageSize
+    };
+
+    struct Page {
+        T values[PageSize];
+        quint64 used[PageSize / 64] = {};
+        int count{0};
+
+        inline bool isUsed(int slot) const { return used[slot >> 6] & (quint64(1) << (slot & 63)); }
+    };
+
+    void release(Page *page, int index, int slot);
+
+    Page *m_pages[PageCount] = {};
+    int m_size{0};
+};
+
+template <typename T>
+T *QMqttPacketIdTable<T>::find(quint16 id)
+{
+    Page *page = m_pages[id >> PageBits];
+    const int slot = id & (PageSize - 1);
+    return page && page->isUsed(slot) ? &page->values[slot] : nullptr;
+}
+
+template <typename T>
+const T *QMqttPacketIdTable<T>::find(quint16 id) const
+{
+    const Page *page = m_pages[id >> PageBits];
+    const int slot = id & (PageSize - 1);
+    return page && page->isUsed(slot) ? &page->values[slot] : nullptr;
+}
+
+template <typename T>
+void QMqttPacketIdTable<T>::insert(quint16 id, const T &value)
+{
+    Page *&page = m_pages[id >> PageBits];
+    if (!page)
+        page = new Page;
+
+    const int slot = id & (PageSize - 1);
+    page->values[slot] = value;
+    if (page->isUsed(slot))
+        return;
+    page->used[slot >> 6] |= quint64(1) << (slot & 63);
+    page->count++;
+    m_size++;
+}
+
+template <typename T>
+bool QMqttPacketIdTable<T>::remove(quint16 id)
+{
+    Page *page = m_pages[id >> PageBits];
+    const int slot = id & (PageSize - 1);
+    if (!page || !page->isUsed(slot))
+        return false;
+    release(page, id >> PageBits, slot);
+    return true;
+}
+
+template <typename T>
+T QMqttPacketIdTable<T>::take(quint16 id)
+{
+    Page *page = m_pages[id >> PageBits];
+    const int slot = id & (PageSize - 1);
+    if (!page || !page->isUsed(slot))
+        return T();
+    T value = std::move(page->values[slot]);
+    release(page, id >> PageBits, slot);
+    return value;
+}
+
+template <typename T>
+void QMqttPacketIdTable<T>::clear()
+{
+    for (Page *&page : m_pages) {
+        delete page;
+        page = nullptr;
+    }
+    m_size = 0;
+}
+
+template <typename T>
+template <typename Function>
+void QMqttPacketIdTable<T>::forEach(Function function) const
+{
+    for (int index = 0; index < PageCount; ++index) {
+        const Page *page = m_pages[index];
+        if (!page)
+            continue;
+        for (int slot = 0; slot < PageSize; ++slot) {
+            if (page->isUsed(slot))
+                function(quint16((index << PageBits) | slot), page->values[slot]);
+        }
+    }
+}
+
+template <typename T>
+void QMqttPacketIdTable<T>::release(Page *page, int index, int slot)
+{
+    page->used[slot >> 6] &= ~(quint64(1) << (slot & 63));
+    m_size--;
+    if (--page->count == 0) {
+        delete page;
+        m_pages[index] = nullptr;
+        return;
+    }
+    // Do not keep the data of finished requests alive
+    page->values[slot] = T();
+}
+
+QT_END_NAMESPACE
+
+#endif // QMQTTPACKETIDTABLE_P_H
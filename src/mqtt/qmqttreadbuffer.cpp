@@ -0,0 +1,137 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "qmqttreadbuffer_p.h"
+
+#include <QtCore/QIODevice>
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+// Capacity kept allocated while the buffer is idle. Bigger allocations, caused
+// by large messages, are released once all data has been consumed.
+const int minimumCapacity = 16 * 1024;
+const int maximumRetainedCapacity = 1024 * 1024;
+}
+
+void QMqttReadBuffer::append(const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+
+    if (m_buffer.isEmpty()) {
+        // Take over the data without copying it.
+        m_buffer = data;
+        m_offset = 0;
+        return;
+    }
+
+    compact();
+    m_buffer.append(data);
+}
+
+qint64 QMqttReadBuffer::readFrom(QIODevice *device, qint64 maxSize)
+{
+    const qint64 available = qMin(device->bytesAvailable(), maxSize);
+    if (available <= 0) {
+        const QByteArray data = device->readAll();
+        append(data);
+        return data.size();
+    }
+
+    compact();
+    if (m_buffer.capacity() < minimumCapacity)
+        m_buffer.reserve(minimumCapacity);
+
+    // Read straight into the free space at the end of the buffer.
+    const int oldSize = m_buffer.size();
+    m_buffer.resize(oldSize + int(available));
+    const qint64 bytesRead = device->read(m_buffer.data() + oldSize, available);
+    m_buffer.resize(oldSize + int(qMax<qint64>(bytesRead, 0)));
+    return bytesRead;
+}
+
+void QMqttReadBuffer::read(char *data, int size)
+{
+    Q_ASSERT(size <= this->size());
+    memcpy(data, constData(), size);
+    advance(size);
+}
+
+QByteArray QMqttReadBuffer::read(int size)
+{
+    Q_ASSERT(size <= this->size());
+    QByteArray res;
+    if (m_offset == 0 && size == m_buffer.size()) {
+        // The whole buffer is requested, share it instead of copying.
+        res = m_buffer;
+    } else {
+        res = QByteArray(constData(), size);
+    }
+    advance(size);
+    return res;
+}
+
+void QMqttReadBuffer::skip(int size)
+{
+    Q_ASSERT(size <= this->size());
+    advance(size);
+}
+
+void QMqttReadBuffer::clear()
+{
+    m_position += size();
+    m_buffer.clear();
+    m_offset = 0;
+}
+
+void QMqttReadBuffer::compact()
+{
+    // Only move pending data once at least the same amount has been consumed
+    // since the last compaction. That way every byte gets moved a constant
+    // number of times on average.
+    if (m_offset == 0 || m_offset < m_buffer.size() - m_offset)
+        return;
+
+    const int remaining = size();
+    memmove(m_buffer.data(), constData(), remaining);
+    m_buffer.resize(remaining);
+    m_offset = 0;
+}
+
+void QMqttReadBuffer::advance(int size)
+{
+    m_position += size;
+    m_offset += size;
+    if (m_offset < m_buffer.size())
+        return;
+
+    // Everything has been consumed, reset without moving any data.
+    if (m_buffer.capacity() > maximumRetainedCapacity || !m_buffer.isDetached())
+        m_buffer.clear();
+    else
+        m_buffer.resize(0);
+    m_offset = 0;
+}
+
+QT_END_NAMESPACE
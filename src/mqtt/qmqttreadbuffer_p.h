@@ -0,0 +1,78 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTREADBUFFER_P_H
+#define QMQTTREADBUFFER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqttglobal.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QtGlobal>
+
+QT_BEGIN_NAMESPACE
+
+class QIODevice;
+
+// Receive buffer for the incoming byte stream. Consumed data is not removed
+// from the front of the buffer, instead a read offset is advanced. The
+// remaining bytes are moved to the front only when at least as many bytes
+// have been consumed as are still pending, which keeps the cost of reading
+// constant per byte independent of the amount of buffered data.
+class Q_AUTOTEST_EXPORT QMqttReadBuffer
+{
+public:
+    inline int size() const { return m_buffer.size() - m_offset; }
+    inline bool isEmpty() const { return size() == 0; }
+    inline const char *constData() const { return m_buffer.constData() + m_offset; }
+    // Number of bytes consumed since construction
+    inline qint64 position() const { return m_position; }
+
+    void append(const QByteArray &data);
+    qint64 readFrom(QIODevice *device, qint64 maxSize);
+
+    void read(char *data, int size);
+    QByteArray read(int size);
+    void skip(int size);
+    void clear();
+
+private:
+    void compact();
+    void advance(int size);
+
+    QByteArray m_buffer;
+    int m_offset{0};
+    qint64 m_position{0};
+};
+
+QT_END_NAMESPACE
+
+#endif // QMQTTREADBUFFER_P_H
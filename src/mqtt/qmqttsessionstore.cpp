@@ -0,0 +1,410 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "qmqttsessionstore_p.h"
+#include "qmqttcontrolpacket_p.h"
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+Q_LOGGING_CATEGORY(lcMqttSessionStore, "qt.mqtt.sessionstore")
+
+namespace {
+// File header: magic and version, followed by the records. A record starts
+// with its type, a reserved byte, the packet identifier and the length of
+// its data, followed by the data and a checksum of everything but the type.
+const char fileMagic[8] = {'Q', 'M', 'Q', 'T', 'T', 'S', 'E', 'S'};
+const quint32 fileVersion = 1;
+const qint64 fileHeaderSize = 16;
+const qint64 recordHeaderSize = 8;
+const qint64 recordChecksumSize = 2;
+const qint64 minimumFileSize = 64 * 1024;
+
+inline qint64 recordSize(quint32 length)
+{
+    return recordHeaderSize + length + recordChecksumSize;
+}
+
+void writeFileHeader(uchar *out)
+{
+    memcpy(out, fileMagic, sizeof(fileMagic));
+    qToBigEndian<quint32>(fileVersion, out + 8);
+    qToBigEndian<quint32>(0, out + 12);
+}
+
+// The data has already been written behind the header. The type is written
+// last, it makes the record valid.
+void finishRecord(uchar *record, quint8 type, quint16 id, quint32 length)
+{
+    record[1] = 0;
+    qToBigEndian<quint16>(id, record + 2);
+    qToBigEndian<quint32>(length, record + 4);
+    const quint16 checksum = qChecksum(reinterpret_cast<const char *>(record + 1),
+                                       uint(recordHeaderSize - 1 + length));
+    qToBigEndian<quint16>(checksum, record + recordHeaderSize + length);
+    record[0] = type;
+}
+}
+
+QMqttSessionStore::QMqttSessionStore()
+{
+}
+
+QMqttSessionStore::~QMqttSessionStore()
+{
+    close();
+}
+
+bool QMqttSessionStore::open(const QString &fileName)
+{
+    close();
+
+    // A compaction might have been interrupted after removing the old file
+    const QString compactName = fileName + QLatin1String(".compact");
+    if (!QFile::exists(fileName) && QFile::exists(compactName)) {
+        if (!QFile::rename(compactName, fileName)) {
+            qWarning("Could not rename %s", qPrintable(compactName));
+            return false;
+        }
+    } else {
+        QFile::remove(compactName);
+    }
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        qWarning("Could not open session store %s", qPrintable(fileName));
+        return false;
+    }
+
+    const qint64 size = m_file.size();
+    const bool empty = size < fileHeaderSize;
+    if (empty && !m_file.resize(minimumFileSize)) {
+        qWarning("Could not resize session store %s", qPrintable(fileName));
+        m_file.close();
+        return false;
+    }
+    if (!map(empty ? minimumFileSize : size)) {
+        m_file.close();
+        return false;
+    }
+
+    if (empty) {
+        initialize();
+    } else if (memcmp(m_map, fileMagic, sizeof(fileMagic)) != 0
+               || qFromBigEndian<quint32>(m_map + 8) != fileVersion) {
+        qWarning("Session store %s has an unknown format, discarding it", qPrintable(fileName));
+        initialize();
+    } else {
+        replay();
+    }
+    return true;
+}
+
+void QMqttSessionStore::close()
+{
+    unmap();
+    if (m_file.isOpen())
+        m_file.close();
+    m_outgoing.clear();
+    m_incoming.clear();
+    m_end = 0;
+    m_liveSize = 0;
+}
+
+QVector<QMqttSessionStore::Message> QMqttSessionStore::outgoing() const
+{
+    QVector<Message> result;
+    const auto entries = sortedOutgoing();
+    result.reserve(entries.size());
+    for (const auto &entry : entries) {
+        const Message message = {entry.first, entry.second.released,
+                                 QByteArray(reinterpret_cast<const char *>(m_map + entry.second.offset),
+                                            int(entry.second.length))};
+        result.append(message);
+    }
+    return result;
+}
+
+QVector<quint16> QMqttSessionStore::incoming() const
+{
+    QVector<quint16> result;
+    result.reserve(m_incoming.size());
+    m_incoming.forEach([&result](quint16 id, bool) { result.append(id); });
+    return result;
+}
+
+bool QMqttSessionStore::storePublish(quint16 id, const QMqttControlPacket &packet)
+{
+    if (packet.exceedsMaximumSize())
+        return false;
+
+    // Serialized directly into the mapping
+    const quint32 length = quint32(packet.serializedSize());
+    if (!reserve(recordSize(length)))
+        return false;
+
+    uchar *record = m_map + m_end;
+    packet.serializeInto(reinterpret_cast<char *>(record + recordHeaderSize));
+    finishRecord(record, Publish, id, length);
+    apply(Publish, id, m_end + recordHeaderSize, length);
+    m_end += recordSize(length);
+    return true;
+}
+
+bool QMqttSessionStore::storeRelease(quint16 id)
+{
+    const Entry *entry = m_outgoing.find(id);
+    if (!entry)
+        return false;
+    return entry->released || appendRecord(Release, id);
+}
+
+bool QMqttSessionStore::storeComplete(quint16 id)
+{
+    return m_outgoing.contains(id) ? appendRecord(Complete, id) : false;
+}
+
+bool QMqttSessionStore::storeReceived(quint16 id)
+{
+    return m_incoming.contains(id) || appendRecord(Received, id);
+}
+
+bool QMqttSessionStore::storeIncomingComplete(quint16 id)
+{
+    return m_incoming.contains(id) ? appendRecord(IncomingComplete, id) : false;
+}
+
+bool QMqttSessionStore::map(qint64 size)
+{
+    m_map = m_file.map(0, size);
+    if (!m_map) {
+        qWarning("Could not map session store %s", qPrintable(m_file.fileName()));
+        m_mapSize = 0;
+        return false;
+    }
+    m_mapSize = size;
+    return true;
+}
+
+void QMqttSessionStore::unmap()
+{
+    if (m_map)
+        m_file.unmap(m_map);
+    m_map = nullptr;
+    m_mapSize = 0;
+}
+
+void QMqttSessionStore::initialize()
+{
+    memset(m_map, 0, size_t(m_mapSize));
+    writeFileHeader(m_map);
+    m_end = fileHeaderSize;
+}
+
+void QMqttSessionStore::replay()
+{
+    qint64 position = fileHeaderSize;
+    bool valid = true;
+    while (position + recordSize(0) <= m_mapSize) {
+        const uchar *record = m_map + position;
+        const quint8 type = record[0];
+        if (type == End)
+            break;
+
+        const quint16 id = qFromBigEndian<quint16>(record + 2);
+        const quint32 length = qFromBigEndian<quint32>(record + 4);
+        if (type > IncomingComplete || qint64(length) > m_mapSize - position - recordSize(0)) {
+            valid = false;
+            break;
+        }
+        const quint16 checksum = qFromBigEndian<quint16>(record + recordHeaderSize + length);
+        if (checksum != qChecksum(reinterpret_cast<const char *>(record + 1), uint(recordHeaderSize - 1 + length))) {
+            valid = false;
+            break;
+        }
+
+        apply(RecordType(type), id, position + recordHeaderSize, length);
+        position += recordSize(length);
+    }
+
+    if (!valid) {
+        // Written partially when the system went down, drop the rest
+        qWarning("Session store %s is truncated at offset %lld", qPrintable(m_file.fileName()), position);
+        memset(m_map + position, 0, size_t(m_mapSize - position));
+    }
+    m_end = position;
+    qCDebug(lcMqttSessionStore) << "Restored" << m_outgoing.size() << "outgoing and" << m_incoming.size()
+                                << "incoming messages from" << m_file.fileName();
+}
+
+void QMqttSessionStore::apply(RecordType type, quint16 id, qint64 offset, quint32 length)
+{
+    switch (type) {
+    case Publish: {
+        if (const Entry *previous = m_outgoing.find(id))
+            m_liveSize -= recordSize(previous->length) + (previous->released ? recordSize(0) : 0);
+        Entry entry;
+        entry.offset = offset;
+        entry.length = length;
+        m_outgoing.insert(id, entry);
+        m_liveSize += recordSize(length);
+        break;
+    }
+    case Release:
+        if (Entry *entry = m_outgoing.find(id)) {
+            if (!entry->released) {
+                entry->released = true;
+                m_liveSize += recordSize(0);
+            }
+        }
+        break;
+    case Complete:
+        if (const Entry *entry = m_outgoing.find(id)) {
+            m_liveSize -= recordSize(entry->length) + (entry->released ? recordSize(0) : 0);
+            m_outgoing.remove(id);
+        }
+        break;
+    case Received:
+        if (!m_incoming.contains(id)) {
+            m_incoming.insert(id, true);
+            m_liveSize += recordSize(0);
+        }
+        break;
+    case IncomingComplete:
+        if (m_incoming.remove(id))
+            m_liveSize -= recordSize(0);
+        break;
+    case End:
+        break;
+    }
+}
+
+bool QMqttSessionStore::reserve(qint64 size)
+{
+    if (!m_map)
+        return false;
+    if (m_end + size <= m_mapSize)
+        return true;
+
+    // Rewriting pays off if most of the records are obsolete
+    if (fileHeaderSize + m_liveSize + size <= m_mapSize / 2)
+        return compact(size);
+    return grow(size);
+}
+
+bool QMqttSessionStore::grow(qint64 size)
+{
+    qint64 newSize = m_mapSize;
+    while (newSize < m_end + size)
+        newSize *= 2;
+
+    qCDebug(lcMqttSessionStore) << "Growing session store to" << newSize << "bytes";
+    unmap();
+    if (!m_file.resize(newSize)) {
+        qWarning("Could not resize session store %s", qPrintable(m_file.fileName()));
+        map(m_file.size());
+        return false;
+    }
+    return map(newSize);
+}
+
+bool QMqttSessionStore::compact(qint64 size)
+{
+    const QString fileName = m_file.fileName();
+    const QString compactName = fileName + QLatin1String(".compact");
+    qint64 newSize = minimumFileSize;
+    while (newSize < 2 * (fileHeaderSize + m_liveSize + size))
+        newSize *= 2;
+
+    qCDebug(lcMqttSessionStore) << "Compacting session store," << m_liveSize << "of" << m_end
+                                << "bytes in use";
+
+    QFile compactFile(compactName);
+    uchar *target = nullptr;
+    if (compactFile.open(QIODevice::ReadWrite | QIODevice::Truncate) && compactFile.resize(newSize))
+        target = compactFile.map(0, newSize);
+    if (!target) {
+        qWarning("Could not create %s, growing the session store instead", qPrintable(compactName));
+        compactFile.remove();
+        return grow(size);
+    }
+
+    // Outgoing messages keep their order
+    writeFileHeader(target);
+    qint64 position = fileHeaderSize;
+    const auto entries = sortedOutgoing();
+    for (const auto &entry : entries) {
+        memcpy(target + position + recordHeaderSize, m_map + entry.second.offset, entry.second.length);
+        finishRecord(target + position, Publish, entry.first, entry.second.length);
+        position += recordSize(entry.second.length);
+        if (entry.second.released) {
+            finishRecord(target + position, Release, entry.first, 0);
+            position += recordSize(0);
+        }
+    }
+    m_incoming.forEach([&](quint16 id, bool) {
+        finishRecord(target + position, Received, id, 0);
+        position += recordSize(0);
+    });
+    compactFile.unmap(target);
+    compactFile.close();
+
+    // Replace the old file, open() finishes this if it is interrupted
+    close();
+    if (!QFile::remove(fileName)) {
+        // The old file is still complete, continue with it
+        qWarning("Could not replace session store %s, growing it instead", qPrintable(fileName));
+        QFile::remove(compactName);
+        return open(fileName) && grow(size);
+    }
+    // Renames the compacted file
+    if (!open(fileName))
+        return false;
+    return m_end + size <= m_mapSize;
+}
+
+bool QMqttSessionStore::appendRecord(RecordType type, quint16 id)
+{
+    if (!reserve(recordSize(0)))
+        return false;
+    finishRecord(m_map + m_end, type, id, 0);
+    apply(type, id, m_end + recordHeaderSize, 0);
+    m_end += recordSize(0);
+    return true;
+}
+
+QVector<QPair<quint16, QMqttSessionStore::Entry>> QMqttSessionStore::sortedOutgoing() const
+{
+    QVector<QPair<quint16, Entry>> result;
+    result.reserve(m_outgoing.size());
+    m_outgoing.forEach([&result](quint16 id, const Entry &entry) { result.append(qMakePair(id, entry)); });
+    std::sort(result.begin(), result.end(), [](const QPair<quint16, Entry> &a, const QPair<quint16, Entry> &b) {
+        return a.second.offset < b.second.offset;
+    });
+    return result;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,133 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTSESSIONSTORE_P_H
+#define QMQTTSESSIONSTORE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqttglobal.h"
+#include "qmqttpacketidtable_p.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QMqttControlPacket;
+
+// Persists the session state of a client: outgoing QoS 1/2 messages until
+// they are acknowledged, and the identifiers of incoming QoS 2 messages
+// until they are released.
+//
+// Changes are appended as records to a memory-mapped file. The pages of the
+// mapping are written back by the operating system, so storing a message is
+// a copy into memory and no fsync() is needed. A record is only valid once
+// its type has been written, which happens last, and it carries a checksum.
+// Replaying stops at the first incomplete record.
+//
+// When the file is full and most records are obsolete, the live state is
+// written to a new file which replaces the old one. Otherwise the file
+// grows.
+class Q_AUTOTEST_EXPORT QMqttSessionStore
+{
+public:
+    struct Message {
+        quint16 id;
+        bool released;  // PUBREC has been received
+        QByteArray frame;
+    };
+
+    QMqttSessionStore();
+    ~QMqttSessionStore();
+
+    bool open(const QString &fileName);
+    void close();
+    inline bool isOpen() const { return m_map != nullptr; }
+    inline QString fileName() const { return m_file.fileName(); }
+
+    // The state restored by open(), outgoing messages in the order they
+    // have been stored
+    QVector<Message> outgoing() const;
+    QVector<quint16> incoming() const;
+
+    bool storePublish(quint16 id, const QMqttControlPacket &packet);
+    bool storeRelease(quint16 id);
+    bool storeComplete(quint16 id);
+    bool storeReceived(quint16 id);
+    bool storeIncomingComplete(quint16 id);
+
+    inline qint64 fileSize() const { return m_mapSize; }
+    inline qint64 usedSize() const { return m_end; }
+    inline qint64 liveSize() const { return m_liveSize; }
+
+private:
+    Q_DISABLE_COPY(QMqttSessionStore)
+
+    enum RecordType : quint8 {
+        End = 0,
+        Publish,
+        Release,
+        Complete,
+        Received,
+        IncomingComplete
+    };
+
+    struct Entry {
+        qint64 offset{0};   // Of the frame in the file
+        quint32 length{0};
+        bool released{false};
+    };
+
+    bool map(qint64 size);
+    void unmap();
+    void initialize();
+    void replay();
+    void apply(RecordType type, quint16 id, qint64 offset, quint32 length);
+    bool reserve(qint64 size);
+    bool grow(qint64 size);
+    bool compact(qint64 size);
+    bool appendRecord(RecordType type, quint16 id);
+    QVector<QPair<quint16, Entry>> sortedOutgoing() const;
+
+    QFile m_file;
+    uchar *m_map{nullptr};
+    qint64 m_mapSize{0};
+    qint64 m_end{0};
+    qint64 m_liveSize{0};
+    QMqttPacketIdTable<Entry> m_outgoing;
+    QMqttPacketIdTable<bool> m_incoming;
+};
+
+QT_END_NAMESPACE
+
+#endif // QMQTTSESSIONSTORE_P_H
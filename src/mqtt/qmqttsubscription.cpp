@@ -75,9 +75,57 @@ QT_BEGIN_NAMESPACE
     This signal is emitted when a new message \a msg has been received.
 */
 
+/*!
+    \fn QMqttSubscription::messagesReceived(const QVector<QMqttMessage> &messages)
+
+    This signal is emitted instead of messageReceived() if batching is enabled. \a messages
+    contains the messages received since the last emission, in the order they arrived.
+
+    \sa setBatchSize()
+*/
+
+/*!
+    \fn QMqttSubscription::streamStarted(QMqttMessage msg, qint64 payloadLength)
+
+    This signal is emitted when a message bigger than streamingThreshold() starts to arrive.
+    \a msg contains the topic and all other properties of the message except the payload.
+    The total size of the payload is specified by \a payloadLength.
+
+    \sa setStreamingThreshold()
+*/
+
+/*!
+    \fn QMqttSubscription::streamDataReceived(const QByteArray &data)
+
+    This signal is emitted for every part \a data of the payload of a streamed message.
+
+    \sa streamStarted()
+*/
+
+/*!
+    \fn QMqttSubscription::streamFinished()
+
+    This signal is emitted when the payload of a streamed message has been received
+    completely.
+
+    \sa streamStarted(), streamAborted()
+*/
+
+/*!
+    \fn QMqttSubscription::streamAborted()
+
+    This signal is emitted instead of streamFinished() if the connection to the broker is
+    closed before the payload of a streamed message has been received completely. The data
+    passed by streamDataReceived() or written to streamDevice() so far is incomplete.
+
+    \sa streamStarted()
+*/
+
 QMqttSubscription::QMqttSubscription(QObject *parent) : QObject(*(new QMqttSubscriptionPrivate), parent)
 {
-
+    Q_D(QMqttSubscription);
+    d->m_batchTimer.setSingleShot(true);
+    connect(&d->m_batchTimer, &QTimer::timeout, this, [d]() { d->deliverBatch(); });
 }
 
 /*!
@@ -100,7 +148,7 @@ QMqttSubscription::SubscriptionState QMqttSubscription::state() const
 QString QMqttSubscription::topic() const
 {
     Q_D(const QMqttSubscription);
-    return d->m_topic;
+    return d->m_topic.filter();
 }
 
 quint8 QMqttSubscription::qos() const
@@ -109,6 +157,157 @@ quint8 QMqttSubscription::qos() const
     return d->m_qos;
 }
 
+/*!
+    Returns the payload size above which messages are streamed, or \c -1 if streaming is
+    disabled.
+
+    \sa setStreamingThreshold()
+*/
+qint64 QMqttSubscription::streamingThreshold() const
+{
+    Q_D(const QMqttSubscription);
+    return d->m_streamingThreshold;
+}
+
+/*!
+    Enables streaming of messages with a payload bigger than \a threshold bytes. A negative
+    value disables streaming, which is the default.
+
+    Instead of messageReceived(), a streamed message emits streamStarted() as soon as its
+    topic is known, followed by streamDataReceived() for each part of the payload as it
+    arrives and streamFinished() at the end. The payload is not kept in memory by the client,
+    hence the memory usage does not depend on the size of the message.
+
+    The payload is only streamed if all subscriptions matching the message stream it, and
+    the client does not report the message itself by QMqttClient::messageReceived() or a
+    client message handler. Otherwise, it is received completely first and passed as a
+    single part. Use QMqttClient::SubscriptionsOnly as the message dispatch of the client
+    to stream messages regardless of the receivers of the client.
+
+    \sa setStreamDevice(), QMqttClient::setMessageDispatch()
+*/
+void QMqttSubscription::setStreamingThreshold(qint64 threshold)
+{
+    Q_D(QMqttSubscription);
+    d->m_streamingThreshold = threshold < 0 ? -1 : threshold;
+}
+
+/*!
+    Returns the device the payload of streamed messages is written to.
+*/
+QIODevice *QMqttSubscription::streamDevice() const
+{
+    Q_D(const QMqttSubscription);
+    return d->m_streamDevice.data();
+}
+
+/*!
+    Writes the payload of streamed messages to \a device, for instance a QFile. The
+    device needs to be open for writing. The subscription does not take ownership of
+    \a device.
+
+    \sa setStreamingThreshold()
+*/
+void QMqttSubscription::setStreamDevice(QIODevice *device)
+{
+    Q_D(QMqttSubscription);
+    d->m_streamDevice = device;
+}
+
+/*!
+    Returns the handler called for every message received by this subscription.
+
+    \sa setMessageHandler()
+*/
+QMqttSubscription::MessageHandler QMqttSubscription::messageHandler() const
+{
+    Q_D(const QMqttSubscription);
+    return d->m_messageHandler.handler();
+}
+
+/*!
+    Sets \a handler to be called for every message received by this subscription. Any
+    callable object taking a \c{const QMqttMessage &} can be passed, for instance a lambda.
+
+    The handler is called directly while the message is dispatched, right before
+    messageReceived() is emitted. Unlike a connection to the signal, this involves no lookup
+    of the receivers and no copy of the message, which matters for subscriptions with a high
+    message rate. The handler is called in the thread of the client and has to return
+    quickly, like a slot with a direct connection. Streamed messages are not passed to it.
+
+    Passing an empty handler removes the current one.
+
+    \sa QMqttClient::setMessageHandler()
+*/
+void QMqttSubscription::setMessageHandler(const MessageHandler &handler)
+{
+    Q_D(QMqttSubscription);
+    d->m_messageHandler.setHandler(handler);
+}
+
+/*!
+    Returns the maximum number of messages delivered at once by messagesReceived(), or \c 0
+    if batching is disabled.
+
+    \sa setBatchSize()
+*/
+int QMqttSubscription::batchSize() const
+{
+    Q_D(const QMqttSubscription);
+    return d->m_batchSize;
+}
+
+/*!
+    Enables batching of up to \a size messages if \a size is greater than \c 0. By default,
+    batching is disabled and every message is reported by messageReceived().
+
+    With batching enabled, messages are collected and reported together by
+    messagesReceived(). This amortizes the cost of the signal and of the receiving slot for
+    subscriptions with a high message rate, for instance to insert the messages into a
+    database in bulk. A batch is delivered as soon as it contains \a size messages.
+    Otherwise it is delivered once all data available from the broker has been processed,
+    or after batchInterval() if it is set. The message handler is still called for every
+    message.
+
+    Disabling batching delivers the messages collected so far.
+
+    \sa setBatchInterval()
+*/
+void QMqttSubscription::setBatchSize(int size)
+{
+    Q_D(QMqttSubscription);
+    d->m_batchSize = qMax(0, size);
+    if (!d->m_batchSize)
+        d->deliverBatch();
+}
+
+/*!
+    Returns the time in milliseconds a batch of messages is collected for, or \c 0 if a
+    batch is delivered once the available data has been processed.
+
+    \sa setBatchInterval()
+*/
+int QMqttSubscription::batchInterval() const
+{
+    Q_D(const QMqttSubscription);
+    return d->m_batchInterval;
+}
+
+/*!
+    Collects messages for up to \a msecs milliseconds after the first message of a batch
+    arrived, unless batchSize() messages arrived before. A value of \c 0, the default,
+    delivers a batch once all data available from the broker has been processed.
+
+    \sa setBatchSize()
+*/
+void QMqttSubscription::setBatchInterval(int msecs)
+{
+    Q_D(QMqttSubscription);
+    d->m_batchInterval = qMax(0, msecs);
+    if (d->m_batchTimer.isActive())
+        d->m_batchTimer.start(d->m_batchInterval);
+}
+
 void QMqttSubscription::setState(QMqttSubscription::SubscriptionState state)
 {
     Q_D(QMqttSubscription);
@@ -130,7 +329,7 @@ void QMqttSubscription::unsubscribe()
     setState(Unsubscribed);
 }
 
-void QMqttSubscription::setTopic(const QString &topic)
+void QMqttSubscription::setTopic(const QMqttTopicFilter &topic)
 {
     Q_D(QMqttSubscription);
     d->m_topic = topic;
@@ -154,4 +353,43 @@ QMqttSubscriptionPrivate::QMqttSubscriptionPrivate()
 
 }
 
+void QMqttSubscriptionPrivate::writeStreamData(const QByteArray &data)
+{
+    if (!m_streamDevice)
+        return;
+
+    if (m_streamDevice->write(data) != data.size())
+        qWarning("Could not write streamed payload to device");
+}
+
+// Returns true if the batch has to be delivered at the end of the current
+// read of the connection
+bool QMqttSubscriptionPrivate::addToBatch(const QMqttMessage &message)
+{
+    m_batch.append(message);
+    if (m_batch.size() >= m_batchSize) {
+        deliverBatch();
+        return false;
+    }
+    if (m_batchInterval > 0) {
+        if (!m_batchTimer.isActive())
+            m_batchTimer.start(m_batchInterval);
+        return false;
+    }
+    return m_batch.size() == 1;
+}
+
+void QMqttSubscriptionPrivate::deliverBatch()
+{
+    Q_Q(QMqttSubscription);
+    m_batchTimer.stop();
+    if (m_batch.isEmpty())
+        return;
+
+    // The receivers might cause further messages to be added
+    QVector<QMqttMessage> messages;
+    messages.swap(m_batch);
+    emit q->messagesReceived(messages);
+}
+
 QT_END_NAMESPACE
@@ -26,10 +26,15 @@
 
 #include <QtMqtt/qmqttglobal.h>
 #include <QtCore/QObject>
+#include <QtCore/QVector>
+
+#include <functional>
 
 QT_BEGIN_NAMESPACE
 
+class QIODevice;
 class QMqttClient;
+class QMqttTopicFilter;
 class QMqttSubscriptionPrivate;
 
 class Q_MQTT_EXPORT QMqttSubscription : public QObject
@@ -41,6 +46,7 @@ class Q_MQTT_EXPORT QMqttSubscription : public QObject
     Q_PROPERTY(QString topic READ topic)
 public:
     ~QMqttSubscription() override;
+    typedef std::function<void(const QMqttMessage &)> MessageHandler;
     enum SubscriptionState {
         Unsubscribed = 0,
         SubscriptionPending,
@@ -53,10 +59,28 @@ public:
     QString topic() const;
     quint8 qos() const;
 
+    qint64 streamingThreshold() const;
+    void setStreamingThreshold(qint64 threshold);
+    QIODevice *streamDevice() const;
+    void setStreamDevice(QIODevice *device);
+
+    MessageHandler messageHandler() const;
+    void setMessageHandler(const MessageHandler &handler);
+
+    int batchSize() const;
+    void setBatchSize(int size);
+    int batchInterval() const;
+    void setBatchInterval(int msecs);
+
 Q_SIGNALS:
     void stateChanged(SubscriptionState state);
     void qosChanged(quint8); // only emitted when broker provides different QoS than requested
     void messageReceived(QMqttMessage msg);
+    void messagesReceived(const QVector<QMqttMessage> &messages);
+    void streamStarted(QMqttMessage msg, qint64 payloadLength);
+    void streamDataReceived(const QByteArray &data);
+    void streamFinished();
+    void streamAborted();
 
 public Q_SLOTS:
     void unsubscribe();
@@ -65,7 +89,7 @@ private:
     Q_DECLARE_PRIVATE(QMqttSubscription)
     Q_DISABLE_COPY(QMqttSubscription)
     void setState(SubscriptionState state);
-    void setTopic(const QString &topic);
+    void setTopic(const QMqttTopicFilter &topic);
     void setClient(QMqttClient *client);
     void setQos(quint8 qos);
     friend class QMqttConnection;
@@ -34,20 +34,75 @@
 //
 
 #include "qmqttsubscription.h"
+#include "qmqtttopicfilter.h"
+#include <QtCore/QIODevice>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
 #include <QtCore/private/qobject_p.h>
 
+#include <utility>
+
 QT_BEGIN_NAMESPACE
 
+// Calls a message handler without copying it. A handler replaced while it
+// is called, possibly by itself, is only destroyed once the call returned.
+class QMqttMessageHandlerHolder
+{
+public:
+    inline QMqttSubscription::MessageHandler handler() const { return m_replaced ? m_next : m_handler; }
+    inline void setHandler(const QMqttSubscription::MessageHandler &handler)
+    {
+        if (m_calls > 0) {
+            m_next = handler;
+            m_replaced = true;
+        } else {
+            m_handler = handler;
+        }
+    }
+    inline bool isSet() const { return bool(m_handler); }
+    inline void call(const QMqttMessage &message)
+    {
+        ++m_calls;
+        m_handler(message);
+        if (--m_calls == 0 && m_replaced) {
+            m_handler = std::move(m_next);
+            m_next = nullptr;
+            m_replaced = false;
+        }
+    }
+
+private:
+    QMqttSubscription::MessageHandler m_handler;
+    QMqttSubscription::MessageHandler m_next;
+    int m_calls{0};
+    bool m_replaced{false};
+};
+
 class QMqttSubscriptionPrivate : public QObjectPrivate
 {
     Q_DECLARE_PUBLIC(QMqttSubscription)
 public:
     QMqttSubscriptionPrivate();
     ~QMqttSubscriptionPrivate() override = default;
+    inline bool streamsPayload(qint64 size) const
+    {
+        return m_streamingThreshold >= 0 && size > m_streamingThreshold;
+    }
+    void writeStreamData(const QByteArray &data);
+    bool addToBatch(const QMqttMessage &message);
+    void deliverBatch();
     QMqttClient *m_client{nullptr};
     QMqttSubscription::SubscriptionState m_state{QMqttSubscription::Unsubscribed};
-    QString m_topic;
+    QMqttTopicFilter m_topic;
     quint8 m_qos{0};
+    qint64 m_streamingThreshold{-1};
+    QPointer<QIODevice> m_streamDevice;
+    QMqttMessageHandlerHolder m_messageHandler;
+    int m_batchSize{0};
+    int m_batchInterval{0};
+    QVector<QMqttMessage> m_batch;
+    QTimer m_batchTimer;
 };
 
 QT_END_NAMESPACE
@@ -0,0 +1,330 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "qmqtttopicfilter.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+#include <cstring>
+#include <limits>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class QMqttTopicFilter
+
+    \inmodule QtMqtt
+    \brief The QMqttTopicFilter class represents a topic filter used to subscribe to topics.
+
+    A topic filter selects the topics a client is interested in. It consists of one or more
+    levels separated by a forward slash. The single-level wildcard \c + matches exactly one
+    level, the multi-level wildcard \c # matches any number of levels, including the parent
+    level. Topics starting with \c $ are not matched by filters starting with a wildcard.
+
+    QMqttTopicFilter validates the filter and prepares it for matching once, when it is
+    created. Reusing the same QMqttTopicFilter hence avoids encoding and parsing the filter
+    again. QMqttTopicFilter is implicitly shared.
+
+    Like QMqttTopicName, QMqttTopicFilter has explicit constructors taking a string.
+    QMqttClient::subscribe() and QMqttClient::unsubscribe() are overloaded for both strings
+    and filters, a QLatin1String passed to them would be ambiguous otherwise.
+
+    \sa QMqttClient::subscribe()
+*/
+
+class QMqttTopicFilterPrivate : public QSharedData
+{
+public:
+    enum LevelType : quint8 {
+        Literal,
+        SingleLevelWildcard,
+        MultiLevelWildcard
+    };
+    struct Level {
+        int begin;
+        int length;
+        LevelType type;
+    };
+
+    void parse();
+
+    QString filter;
+    QByteArray utf8;
+    QVector<Level> levels;
+    uint hash{0};
+    bool valid{false};
+    bool wildcards{false};
+};
+
+Q_DECLARE_TYPEINFO(QMqttTopicFilterPrivate::Level, Q_PRIMITIVE_TYPE);
+
+void QMqttTopicFilterPrivate::parse()
+{
+    utf8 = filter.toUtf8();
+    hash = qHash(utf8);
+    levels.clear();
+    wildcards = false;
+
+    // MQTT-4.7.3-1, MQTT-4.7.3-2, 1.5.3
+    valid = !utf8.isEmpty() && utf8.size() <= std::numeric_limits<quint16>::max()
+            && !utf8.contains('\0');
+    if (!valid)
+        return;
+
+    int from = 0;
+    for (;;) {
+        int end = utf8.indexOf('/', from);
+        if (end < 0)
+            end = utf8.size();
+
+        Level level{from, end - from, Literal};
+        const char *data = utf8.constData() + from;
+        if (level.length == 1 && *data == '+') {
+            level.type = SingleLevelWildcard;
+        } else if (level.length == 1 && *data == '#') {
+            // MQTT-4.7.1-2
+            if (end != utf8.size())
+                break;
+            level.type = MultiLevelWildcard;
+        } else if (memchr(data, '+', level.length) || memchr(data, '#', level.length)) {
+            // MQTT-4.7.1-3
+            break;
+        }
+        wildcards |= level.type != Literal;
+        levels.append(level);
+
+        if (end == utf8.size())
+            return;
+        from = end + 1;
+    }
+
+    valid = false;
+    wildcards = false;
+    levels.clear();
+}
+
+/*!
+    Creates a new topic filter from \a filter.
+*/
+QMqttTopicFilter::QMqttTopicFilter(const QString &filter)
+    : d(new QMqttTopicFilterPrivate)
+{
+    d->filter = filter;
+    d->parse();
+}
+
+/*!
+    Creates a new topic filter from \a filter.
+*/
+QMqttTopicFilter::QMqttTopicFilter(const QLatin1String &filter)
+    : QMqttTopicFilter(QString(filter))
+{
+}
+
+/*!
+    Creates a new topic filter as a copy of \a filter.
+*/
+QMqttTopicFilter::QMqttTopicFilter(const QMqttTopicFilter &filter)
+    : d(filter.d)
+{
+}
+
+/*!
+    Destroys the topic filter.
+*/
+QMqttTopicFilter::~QMqttTopicFilter()
+{
+}
+
+/*!
+    Assigns \a filter to this topic filter.
+*/
+QMqttTopicFilter &QMqttTopicFilter::operator=(const QMqttTopicFilter &filter)
+{
+    d = filter.d;
+    return *this;
+}
+
+/*!
+    \fn QMqttTopicFilter::QMqttTopicFilter(QMqttTopicFilter &&other)
+
+    Move-constructs a topic filter from \a other. The moved-from object can only be assigned to
+    or destroyed.
+*/
+
+/*!
+    \fn QMqttTopicFilter &QMqttTopicFilter::operator=(QMqttTopicFilter &&other)
+
+    Move-assigns \a other to this topic filter.
+*/
+
+/*!
+    \fn void QMqttTopicFilter::swap(QMqttTopicFilter &other)
+
+    Swaps this topic filter with \a other. This operation is very fast and never fails.
+*/
+
+/*!
+    Returns the topic filter.
+*/
+QString QMqttTopicFilter::filter() const
+{
+    return d->filter;
+}
+
+/*!
+    Sets the topic filter to \a filter.
+*/
+void QMqttTopicFilter::setFilter(const QString &filter)
+{
+    // Other copies keep the previous filter
+    QExplicitlySharedDataPointer<QMqttTopicFilterPrivate> p(new QMqttTopicFilterPrivate);
+    p->filter = filter;
+    p->parse();
+    d.swap(p);
+}
+
+/*!
+    Returns the UTF-8 representation of the topic filter, as it is sent to the broker.
+*/
+QByteArray QMqttTopicFilter::toUtf8() const
+{
+    return d->utf8;
+}
+
+/*!
+    Returns \c true if the topic filter is valid according to the MQTT specification.
+    A valid filter is not empty and each wildcard character occupies an entire level.
+    The multi-level wildcard \c # can only be used as the last level.
+*/
+bool QMqttTopicFilter::isValid() const
+{
+    return d->valid;
+}
+
+/*!
+    Returns \c true if the topic filter contains a wildcard.
+*/
+bool QMqttTopicFilter::hasWildcards() const
+{
+    return d->wildcards;
+}
+
+/*!
+    Returns the number of levels of the topic filter, including the wildcard levels.
+    Returns 0 if the topic filter is not valid.
+*/
+int QMqttTopicFilter::levelCount() const
+{
+    return d->levels.size();
+}
+
+/*!
+    Returns \c true if the topic name \a topic matches the topic filter.
+
+    \sa matchUtf8()
+*/
+bool QMqttTopicFilter::match(const QString &topic) const
+{
+    return matchUtf8(topic.toUtf8());
+}
+
+/*!
+    \overload
+
+    Returns \c true if the topic name \a name matches the topic filter. The encoded form
+    cached by \a name is used, hence no conversion takes place.
+*/
+bool QMqttTopicFilter::match(const QMqttTopicName &name) const
+{
+    return name.isValid() && matchUtf8(name.toUtf8());
+}
+
+/*!
+    Returns \c true if the UTF-8 encoded topic name \a topic matches the topic filter.
+    Unlike match(), this function does not need to allocate any memory.
+*/
+bool QMqttTopicFilter::matchUtf8(const QByteArray &topic) const
+{
+    if (!d->valid || topic.isEmpty())
+        return false;
+
+    // MQTT-4.7.2-1
+    if (topic.at(0) == '$' && d->levels.first().type != QMqttTopicFilterPrivate::Literal)
+        return false;
+
+    if (!d->wildcards)
+        return topic == d->utf8;
+
+    const char *filterData = d->utf8.constData();
+    const char *topicData = topic.constData();
+    const int topicSize = topic.size();
+    int from = 0;
+    bool exhausted = false;
+    for (const QMqttTopicFilterPrivate::Level &level : qAsConst(d->levels)) {
+        if (level.type == QMqttTopicFilterPrivate::MultiLevelWildcard)
+            return true;
+        if (exhausted)
+            return false;
+
+        const char *separator = static_cast<const char *>(memchr(topicData + from, '/', topicSize - from));
+        const int end = separator ? int(separator - topicData) : topicSize;
+        if (level.type == QMqttTopicFilterPrivate::Literal
+                && (level.length != end - from
+                    || memcmp(filterData + level.begin, topicData + from, level.length) != 0)) {
+            return false;
+        }
+        exhausted = end == topicSize;
+        from = end + 1;
+    }
+    return exhausted;
+}
+
+/*!
+    \relates QMqttTopicFilter
+
+    Returns \c true if the topic filters \a lhs and \a rhs are equal.
+*/
+bool operator==(const QMqttTopicFilter &lhs, const QMqttTopicFilter &rhs) Q_DECL_NOTHROW
+{
+    return lhs.d == rhs.d || (lhs.d->hash == rhs.d->hash && lhs.d->utf8 == rhs.d->utf8);
+}
+
+/*!
+    \fn bool operator!=(const QMqttTopicFilter &lhs, const QMqttTopicFilter &rhs)
+    \relates QMqttTopicFilter
+
+    Returns \c true if the topic filters \a lhs and \a rhs are different.
+*/
+
+/*!
+    \relates QMqttTopicFilter
+
+    Returns the hash value for \a filter, using \a seed to seed the calculation. The hash is
+    calculated once, when the filter is set.
+*/
+uint qHash(const QMqttTopicFilter &filter, uint seed) Q_DECL_NOTHROW
+{
+    return filter.d->hash ^ seed;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,80 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTTOPICFILTER_H
+#define QMQTTTOPICFILTER_H
+
+#include <QtMqtt/qmqttglobal.h>
+#include <QtMqtt/qmqtttopicname.h>
+
+#include <QtCore/QExplicitlySharedDataPointer>
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+class QMqttTopicFilterPrivate;
+
+class Q_MQTT_EXPORT QMqttTopicFilter
+{
+public:
+    explicit QMqttTopicFilter(const QString &filter = QString());
+    explicit QMqttTopicFilter(const QLatin1String &filter);
+    QMqttTopicFilter(const QMqttTopicFilter &filter);
+    ~QMqttTopicFilter();
+
+    QMqttTopicFilter &operator=(const QMqttTopicFilter &filter);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QMqttTopicFilter(QMqttTopicFilter &&other) Q_DECL_NOTHROW { swap(other); }
+    QMqttTopicFilter &operator=(QMqttTopicFilter &&other) Q_DECL_NOTHROW { swap(other); return *this; }
+#endif
+
+    inline void swap(QMqttTopicFilter &other) Q_DECL_NOTHROW { qSwap(d, other.d); }
+
+    QString filter() const;
+    void setFilter(const QString &filter);
+    QByteArray toUtf8() const;
+
+    bool isValid() const;
+    bool hasWildcards() const;
+    int levelCount() const;
+
+    bool match(const QString &topic) const;
+    bool match(const QMqttTopicName &name) const;
+    bool matchUtf8(const QByteArray &topic) const;
+
+    friend Q_MQTT_EXPORT bool operator==(const QMqttTopicFilter &lhs, const QMqttTopicFilter &rhs) Q_DECL_NOTHROW;
+    friend inline bool operator!=(const QMqttTopicFilter &lhs, const QMqttTopicFilter &rhs) Q_DECL_NOTHROW { return !(lhs == rhs); }
+    friend Q_MQTT_EXPORT uint qHash(const QMqttTopicFilter &filter, uint seed) Q_DECL_NOTHROW;
+
+private:
+    QExplicitlySharedDataPointer<QMqttTopicFilterPrivate> d;
+};
+
+Q_DECLARE_SHARED(QMqttTopicFilter)
+
+Q_MQTT_EXPORT uint qHash(const QMqttTopicFilter &filter, uint seed = 0) Q_DECL_NOTHROW;
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QMqttTopicFilter)
+
+#endif // QMQTTTOPICFILTER_H
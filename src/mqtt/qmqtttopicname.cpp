@@ -0,0 +1,200 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "qmqtttopicname_p.h"
+
+#include <QtCore/QHash>
+
+#include <limits>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class QMqttTopicName
+
+    \inmodule QtMqtt
+    \brief The QMqttTopicName class represents the name of a topic messages are published to.
+
+    A topic name consists of one or more levels separated by a forward slash. Unlike a
+    \l QMqttTopicFilter, it must not contain any wildcard characters.
+
+    QMqttTopicName validates the name and encodes it as UTF-8 once, when it is created.
+    Publishing repeatedly to the same QMqttTopicName hence does not need to validate or
+    convert the topic again. QMqttTopicName is implicitly shared.
+
+    A QMqttTopicName is only created from a string explicitly. For topics published to
+    once, QMqttClient::publish() also accepts the topic as a string.
+
+    \sa QMqttClient::publish()
+*/
+
+void QMqttTopicNamePrivate::parse()
+{
+    utf8 = name.toUtf8();
+    hash = qHash(utf8);
+
+    valid = isValid(utf8);
+    levelCount = valid ? utf8.count('/') + 1 : 0;
+}
+
+bool QMqttTopicNamePrivate::isValid(const QByteArray &utf8)
+{
+    // MQTT-4.7.1-1, MQTT-4.7.3-1, MQTT-4.7.3-2, MQTT-4.7.3-3
+    return !utf8.isEmpty() && utf8.size() <= std::numeric_limits<quint16>::max()
+           && !utf8.contains('#') && !utf8.contains('+') && !utf8.contains('\0');
+}
+
+/*!
+    Creates a new topic name from \a name.
+*/
+QMqttTopicName::QMqttTopicName(const QString &name)
+    : d(new QMqttTopicNamePrivate)
+{
+    d->name = name;
+    d->parse();
+}
+
+/*!
+    Creates a new topic name from \a name.
+*/
+QMqttTopicName::QMqttTopicName(const QLatin1String &name)
+    : QMqttTopicName(QString(name))
+{
+}
+
+/*!
+    Creates a new topic name as a copy of \a name.
+*/
+QMqttTopicName::QMqttTopicName(const QMqttTopicName &name)
+    : d(name.d)
+{
+}
+
+/*!
+    Destroys the topic name.
+*/
+QMqttTopicName::~QMqttTopicName()
+{
+}
+
+/*!
+    Assigns \a name to this topic name.
+*/
+QMqttTopicName &QMqttTopicName::operator=(const QMqttTopicName &name)
+{
+    d = name.d;
+    return *this;
+}
+
+/*!
+    \fn QMqttTopicName::QMqttTopicName(QMqttTopicName &&other)
+
+    Move-constructs a topic name from \a other. The moved-from object can only be assigned to
+    or destroyed.
+*/
+
+/*!
+    \fn QMqttTopicName &QMqttTopicName::operator=(QMqttTopicName &&other)
+
+    Move-assigns \a other to this topic name.
+*/
+
+/*!
+    \fn void QMqttTopicName::swap(QMqttTopicName &other)
+
+    Swaps this topic name with \a other. This operation is very fast and never fails.
+*/
+
+/*!
+    Returns the topic name.
+*/
+QString QMqttTopicName::name() const
+{
+    return d->name;
+}
+
+/*!
+    Sets the topic name to \a name.
+*/
+void QMqttTopicName::setName(const QString &name)
+{
+    // Other copies keep the previous name
+    QExplicitlySharedDataPointer<QMqttTopicNamePrivate> p(new QMqttTopicNamePrivate);
+    p->name = name;
+    p->parse();
+    d.swap(p);
+}
+
+/*!
+    Returns the UTF-8 representation of the topic name, as it is sent to the broker.
+*/
+QByteArray QMqttTopicName::toUtf8() const
+{
+    return d->utf8;
+}
+
+/*!
+    Returns \c true if the topic name is valid according to the MQTT specification. A valid
+    topic name is not empty, does not contain wildcard characters and is at most 65535 bytes
+    long when encoded as UTF-8.
+*/
+bool QMqttTopicName::isValid() const
+{
+    return d->valid;
+}
+
+/*!
+    Returns the number of levels of the topic name. Returns 0 if the topic name is not valid.
+*/
+int QMqttTopicName::levelCount() const
+{
+    return d->levelCount;
+}
+
+/*!
+    \relates QMqttTopicName
+
+    Returns \c true if the topic names \a lhs and \a rhs are equal.
+*/
+bool operator==(const QMqttTopicName &lhs, const QMqttTopicName &rhs) Q_DECL_NOTHROW
+{
+    return lhs.d == rhs.d || (lhs.d->hash == rhs.d->hash && lhs.d->utf8 == rhs.d->utf8);
+}
+
+/*!
+    \fn bool operator!=(const QMqttTopicName &lhs, const QMqttTopicName &rhs)
+    \relates QMqttTopicName
+
+    Returns \c true if the topic names \a lhs and \a rhs are different.
+*/
+
+/*!
+    \relates QMqttTopicName
+
+    Returns the hash value for \a name, using \a seed to seed the calculation. The hash is
+    calculated once, when the name is set.
+*/
+uint qHash(const QMqttTopicName &name, uint seed) Q_DECL_NOTHROW
+{
+    return name.d->hash ^ seed;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,74 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTTOPICNAME_H
+#define QMQTTTOPICNAME_H
+
+#include <QtMqtt/qmqttglobal.h>
+
+#include <QtCore/QExplicitlySharedDataPointer>
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+class QMqttTopicNamePrivate;
+
+class Q_MQTT_EXPORT QMqttTopicName
+{
+public:
+    explicit QMqttTopicName(const QString &name = QString());
+    explicit QMqttTopicName(const QLatin1String &name);
+    QMqttTopicName(const QMqttTopicName &name);
+    ~QMqttTopicName();
+
+    QMqttTopicName &operator=(const QMqttTopicName &name);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QMqttTopicName(QMqttTopicName &&other) Q_DECL_NOTHROW { swap(other); }
+    QMqttTopicName &operator=(QMqttTopicName &&other) Q_DECL_NOTHROW { swap(other); return *this; }
+#endif
+
+    inline void swap(QMqttTopicName &other) Q_DECL_NOTHROW { qSwap(d, other.d); }
+
+    QString name() const;
+    void setName(const QString &name);
+    QByteArray toUtf8() const;
+
+    bool isValid() const;
+    int levelCount() const;
+
+    friend Q_MQTT_EXPORT bool operator==(const QMqttTopicName &lhs, const QMqttTopicName &rhs) Q_DECL_NOTHROW;
+    friend inline bool operator!=(const QMqttTopicName &lhs, const QMqttTopicName &rhs) Q_DECL_NOTHROW { return !(lhs == rhs); }
+    friend Q_MQTT_EXPORT uint qHash(const QMqttTopicName &name, uint seed) Q_DECL_NOTHROW;
+
+private:
+    QExplicitlySharedDataPointer<QMqttTopicNamePrivate> d;
+};
+
+Q_DECLARE_SHARED(QMqttTopicName)
+
+Q_MQTT_EXPORT uint qHash(const QMqttTopicName &name, uint seed = 0) Q_DECL_NOTHROW;
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QMqttTopicName)
+
+#endif // QMQTTTOPICNAME_H
@@ -0,0 +1,60 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTTOPICNAME_P_H
+#define QMQTTTOPICNAME_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqtttopicname.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QSharedData>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+class QMqttTopicNamePrivate : public QSharedData
+{
+public:
+    void parse();
+    // Validates an encoded topic name, used where no handle is created
+    static bool isValid(const QByteArray &utf8);
+
+    QString name;
+    QByteArray utf8;
+    uint hash{0};
+    int levelCount{0};
+    bool valid{false};
+};
+
+QT_END_NAMESPACE
+
+#endif // QMQTTTOPICNAME_P_H
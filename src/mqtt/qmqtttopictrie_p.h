@@ -0,0 +1,256 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#ifndef QMQTTTOPICTRIE_P_H
+#define QMQTTTOPICTRIE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qmqttglobal.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+// Maps topic filters to values, indexed by topic level. Every level of a
+// filter is a node, '+' is stored as a separate child of its parent and a
+// trailing '#' is stored in the node of the level in front of it. Matching
+// a topic name visits at most two children per level, hence its cost only
+// depends on the depth of the topic and not on the number of filters.
+//
+// Filters and topic names are UTF-8 encoded, as they are transmitted.
+// Matching follows 4.7 of the MQTT 3.1.1 specification: "a/#" also matches
+// "a", and topics starting with '$' are not matched by filters starting with
+// a wildcard.
+template <typename T>
+class QMqttTopicTrie
+{
+public:
+    QMqttTopicTrie() : m_root(new Node) {}
+    ~QMqttTopicTrie() { delete m_root; }
+
+    inline int size() const { return m_size; }
+    inline bool isEmpty() const { return m_size == 0; }
+
+    void insert(const QByteArray &filter, const T &value);
+    bool remove(const QByteArray &filter);
+    void clear();
+
+    void match(const QByteArray &topic, QVector<T> *result) const;
+    inline QVector<T> match(const QByteArray &topic) const
+    {
+        QVector<T> result;
+        match(topic, &result);
+        return result;
+    }
+
+private:
+    Q_DISABLE_COPY(QMqttTopicTrie)
+
+    struct Node {
+        ~Node()
+        {
+            qDeleteAll(children);
+            delete wildcard;
+        }
+        inline bool isEmpty() const
+        {
+            return !hasValue && !hasMultiLevelValue && !wildcard && children.isEmpty();
+        }
+
+        QHash<QByteArray, Node *> children;
+        Node *wildcard{nullptr};
+        T value{};
+        T multiLevelValue{};
+        bool hasValue{false};
+        bool hasMultiLevelValue{false};
+    };
+
+    void matchLevel(const Node *node, const QByteArray &topic, int from, bool wildcards,
+                    QVector<T> *result) const;
+
+    Node *m_root;
+    int m_size{0};
+};
+
+template <typename T>
+void QMqttTopicTrie<T>::insert(const QByteArray &filter, const T &value)
+{
+    Node *node = m_root;
+    int from = 0;
+    for (;;) {
+        int end = filter.indexOf('/', from);
+        if (end < 0)
+            end = filter.size();
+        const int length = end - from;
+
+        if (length == 1 && filter.at(from) == '#') {
+            if (!node->hasMultiLevelValue)
+                m_size++;
+            node->multiLevelValue = value;
+            node->hasMultiLevelValue = true;
+            return;
+        }
+
+        if (length == 1 && filter.at(from) == '+') {
+            if (!node->wildcard)
+                node->wildcard = new Node;
+            node = node->wildcard;
+        } else {
+            const QByteArray level = filter.mid(from, length);
+            Node *&child = node->children[level];
+            if (!child)
+                child = new Node;
+            node = child;
+        }
+
+        if (end == filter.size())
+            break;
+        from = end + 1;
+    }
+
+    if (!node->hasValue)
+        m_size++;
+    node->value = value;
+    node->hasValue = true;
+}
+
+template <typename T>
+bool QMqttTopicTrie<T>::remove(const QByteArray &filter)
+{
+    QVector<Node *> path;
+    QVector<QByteArray> levels;
+    path.append(m_root);
+
+    Node *node = m_root;
+    bool multiLevel = false;
+    int from = 0;
+    for (;;) {
+        int end = filter.indexOf('/', from);
+        if (end < 0)
+            end = filter.size();
+        const int length = end - from;
+
+        if (length == 1 && filter.at(from) == '#') {
+            multiLevel = true;
+            break;
+        }
+
+        const QByteArray level = filter.mid(from, length);
+        if (level == "+")
+            node = node->wildcard;
+        else
+            node = node->children.value(level, nullptr);
+        if (!node)
+            return false;
+        path.append(node);
+        levels.append(level);
+
+        if (end == filter.size())
+            break;
+        from = end + 1;
+    }
+
+    if (multiLevel) {
+        if (!node->hasMultiLevelValue)
+            return false;
+        node->multiLevelValue = T();
+        node->hasMultiLevelValue = false;
+    } else {
+        if (!node->hasValue)
+            return false;
+        node->value = T();
+        node->hasValue = false;
+    }
+    m_size--;
+
+    // Prune the levels which are not needed anymore
+    for (int i = path.size() - 1; i > 0 && path.at(i)->isEmpty(); --i) {
+        Node *parent = path.at(i - 1);
+        if (levels.at(i - 1) == "+")
+            parent->wildcard = nullptr;
+        else
+            parent->children.remove(levels.at(i - 1));
+        delete path.at(i);
+    }
+    return true;
+}
+
+template <typename T>
+void QMqttTopicTrie<T>::clear()
+{
+    delete m_root;
+    m_root = new Node;
+    m_size = 0;
+}
+
+template <typename T>
+void QMqttTopicTrie<T>::match(const QByteArray &topic, QVector<T> *result) const
+{
+    if (topic.isEmpty() || isEmpty())
+        return;
+    // MQTT-4.7.2-1
+    matchLevel(m_root, topic, 0, topic.at(0) != '$', result);
+}
+
+template <typename T>
+void QMqttTopicTrie<T>::matchLevel(const Node *node, const QByteArray &topic, int from,
+                                   bool wildcards, QVector<T> *result) const
+{
+    // '#' matches the parent level as well as any number of child levels
+    if (wildcards && node->hasMultiLevelValue)
+        result->append(node->multiLevelValue);
+
+    if (from > topic.size()) {
+        if (node->hasValue)
+            result->append(node->value);
+        return;
+    }
+
+    int end = topic.indexOf('/', from);
+    if (end < 0)
+        end = topic.size();
+
+    if (!node->children.isEmpty()) {
+        // Look up the level without copying it out of the topic
+        const QByteArray level = QByteArray::fromRawData(topic.constData() + from, end - from);
+        const auto child = node->children.constFind(level);
+        if (child != node->children.constEnd())
+            matchLevel(child.value(), topic, end + 1, true, result);
+    }
+    if (wildcards && node->wildcard)
+        matchLevel(node->wildcard, topic, end + 1, true, result);
+}
+
+QT_END_NAMESPACE
+
+#endif // QMQTTTOPICTRIE_P_H
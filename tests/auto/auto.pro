@@ -3,5 +3,14 @@ TEMPLATE = subdirs
 win32|if(linux:!cross_compile): SUBDIRS += cmake \
                                       conformance \
                                       qmqttcontrolpacket \
+                                      qmqttframedecoder \
                                       qmqttclient \
-                                      qmqttsubscription
+                                      qmqttconnection \
+                                      qmqttofflinequeue \
+                                      qmqttpacketidallocator \
+                                      qmqttpacketidtable \
+                                      qmqttsessionstore \
+                                      qmqttsubscription \
+                                      qmqtttopicfilter \
+                                      qmqtttopicname \
+                                      qmqtttopictrie
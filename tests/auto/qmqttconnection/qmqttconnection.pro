@@ -0,0 +1,16 @@
+CONFIG += testcase
+QT       += network testlib mqtt
+QT       -= gui
+
+TARGET = tst_qmqttconnection
+
+SOURCES += \
+    tst_qmqttconnection.cpp
+
+HEADERS += \
+    $$PWD/../../common/fake_transport.h
+
+INCLUDEPATH += \
+    $$PWD/../../common
+
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
@@ -0,0 +1,1452 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "fake_transport.h"
+
+#include <QtCore/QString>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+#include <QtMqtt/QMqttClient>
+#include <QtMqtt/QMqttTopicName>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+#include <thread>
+#include <vector>
+
+Q_DECLARE_METATYPE(QMqttClient::DisconnectMode)
+Q_DECLARE_METATYPE(QMqttSubscription::SubscriptionState)
+
+// Broker on the loopback interface, which accepts one client and records
+// everything it sends after the CONNECT.
+class LocalBroker : public QObject
+{
+public:
+    bool listen() { return m_server.listen(QHostAddress::LocalHost); }
+    quint16 port() const { return m_server.serverPort(); }
+
+    bool acceptClient()
+    {
+        if (!m_server.hasPendingConnections())
+            return false;
+        m_socket = m_server.nextPendingConnection();
+        connect(m_socket, &QIODevice::readyRead, this, &LocalBroker::readClient);
+        readClient();
+        return true;
+    }
+
+    QByteArray received() const { return m_received; }
+    void clear() { m_received.clear(); }
+
+private:
+    void readClient()
+    {
+        const QByteArray data = m_socket->readAll();
+        if (!m_connected && !data.isEmpty()) {
+            // The first frame is the CONNECT, pipelined packets might follow it
+            m_connected = true;
+            m_socket->write(QByteArray("\x20\x02\x00\x00", 4));
+            m_received.append(data.mid(2 + quint8(data.at(1))));
+            return;
+        }
+        m_received.append(data);
+    }
+
+    QTcpServer m_server;
+    QTcpSocket *m_socket{nullptr};
+    QByteArray m_received;
+    bool m_connected{false};
+};
+
+class Tst_QMqttConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttConnection();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void connectDisconnect();
+    void destroyWhileSending();
+    void connectRefused();
+    void cancelConnect();
+    void largePublish_data();
+    void largePublish();
+    void publishOversized();
+    void streamAborted();
+    void streamClientReceivers();
+    void writeBufferBytes();
+    void writeBufferPackets();
+    void writeBufferQueue();
+    void packetIdentifiers();
+    void sessionRestore();
+    void offlineQueue();
+    void offlineQueueDrainRate();
+    void reconnectBackoff();
+    void reconnectResubscribe();
+    void reconnectResend();
+    void reconnectWriteBufferQueue();
+    void pipelinedConnect();
+    void pipelinedConnectRejected();
+    void subscribeMultiple();
+    void subscribeMultipleBatches();
+    void disconnectMode_data();
+    void disconnectMode();
+    void unsubscribeOffline();
+    void unsubscribeAborted();
+    void messageHandler();
+    void messageDispatch_data();
+    void messageDispatch();
+    void messageBatches();
+    void messageSharing();
+    void messageTopicUtf8();
+};
+
+Tst_QMqttConnection::Tst_QMqttConnection()
+{
+}
+
+void Tst_QMqttConnection::initTestCase()
+{
+}
+
+void Tst_QMqttConnection::cleanupTestCase()
+{
+}
+
+void Tst_QMqttConnection::connectDisconnect()
+{
+    LocalBroker broker;
+    QVERIFY(broker.listen());
+
+    QMqttClient client;
+    client.setHostname(QLatin1String("127.0.0.1"));
+    client.setPort(broker.port());
+    QVector<QMqttClient::State> states;
+    connect(&client, &QMqttClient::stateChanged, [&states](QMqttClient::State state) {
+        states.append(state);
+    });
+
+    // Returns without waiting for the socket
+    client.connectToHost();
+    QCOMPARE(client.state(), QMqttClient::Connecting);
+    QTRY_VERIFY(broker.acceptClient());
+    QTRY_COMPARE(client.state(), QMqttClient::Connected);
+
+    client.disconnectFromHost();
+    QTRY_COMPARE(client.state(), QMqttClient::Disconnected);
+    QTRY_COMPARE(broker.received(), QByteArray("\xe0\x00", 2));
+
+    const QVector<QMqttClient::State> expected = {QMqttClient::Connecting, QMqttClient::Connected,
+                                                   QMqttClient::Disconnected};
+    QVERIFY(states == expected);
+}
+
+// The socket owned by a destroyed client still sends what has been queued
+void Tst_QMqttConnection::destroyWhileSending()
+{
+    LocalBroker broker;
+    QVERIFY(broker.listen());
+
+    QScopedPointer<QMqttClient> client(new QMqttClient);
+    client->setHostname(QLatin1String("127.0.0.1"));
+    client->setPort(broker.port());
+    client->connectToHost();
+    QTRY_VERIFY(broker.acceptClient());
+    QTRY_COMPARE(client->state(), QMqttClient::Connected);
+
+    // More than the kernel takes at once
+    const QByteArray message(16 * 1024 * 1024, 'x');
+    QVERIFY(client->publish(QMqttTopicName(QLatin1String("a/b")), message) != -1);
+    client.reset();
+
+    // PUBLISH with a four byte remaining length, followed by the DISCONNECT
+    const int expectedSize = 1 + 4 + 5 + message.size() + 2;
+    QTRY_COMPARE_WITH_TIMEOUT(broker.received().size(), expectedSize, 20000);
+    QVERIFY(broker.received().endsWith(QByteArray("\xe0\x00", 2)));
+}
+
+void Tst_QMqttConnection::connectRefused()
+{
+    // Nobody listens on the port anymore
+    quint16 port = 0;
+    {
+        QTcpServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+        port = server.serverPort();
+    }
+
+    QMqttClient client;
+    client.setHostname(QLatin1String("127.0.0.1"));
+    client.setPort(port);
+    QSignalSpy disconnectedSpy(&client, &QMqttClient::disconnected);
+
+    QTest::ignoreMessage(QtWarningMsg, "Could not establish socket connection for transport");
+    client.connectToHost();
+    QCOMPARE(client.state(), QMqttClient::Connecting);
+    QTRY_COMPARE(client.state(), QMqttClient::Disconnected);
+    QCOMPARE(disconnectedSpy.count(), 1);
+}
+
+void Tst_QMqttConnection::cancelConnect()
+{
+    LocalBroker broker;
+    QVERIFY(broker.listen());
+
+    QMqttClient client;
+    client.setHostname(QLatin1String("127.0.0.1"));
+    client.setPort(broker.port());
+
+    client.connectToHost();
+    QCOMPARE(client.state(), QMqttClient::Connecting);
+    client.disconnectFromHost();
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+
+    // The client can connect again afterwards
+    LocalBroker otherBroker;
+    QVERIFY(otherBroker.listen());
+    client.setPort(otherBroker.port());
+    client.connectToHost();
+    QTRY_VERIFY(otherBroker.acceptClient());
+    QTRY_COMPARE(client.state(), QMqttClient::Connected);
+}
+
+void Tst_QMqttConnection::largePublish_data()
+{
+    QTest::addColumn<int>("qos");
+    QTest::addColumn<int>("payloadSize");
+
+    const int payloadSizes[] = {1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+    for (int payloadSize : payloadSizes) {
+        for (int qos = 0; qos < 2; ++qos)
+            QTest::newRow(qPrintable(QString::fromLatin1("qos%1/%2").arg(qos).arg(payloadSize)))
+                    << qos << payloadSize;
+    }
+}
+
+// Large payloads are written without copying them into the frame, the
+// broker still has to receive the frames in order and unmodified.
+void Tst_QMqttConnection::largePublish()
+{
+    QFETCH(int, qos);
+    QFETCH(int, payloadSize);
+
+    LocalBroker broker;
+    QVERIFY(broker.listen());
+
+    QMqttClient client;
+    client.setHostname(QLatin1String("127.0.0.1"));
+    client.setPort(broker.port());
+    client.connectToHost();
+    QTRY_VERIFY(broker.acceptClient());
+    QTRY_COMPARE(client.state(), QMqttClient::Connected);
+
+    const QMqttTopicName topic(QLatin1String("tiles/upload"));
+    QByteArray message(payloadSize, Qt::Uninitialized);
+    for (int i = 0; i < payloadSize; ++i)
+        message[i] = char(i % 251);
+
+    const qint32 id = client.publish(topic, message, quint8(qos));
+    QVERIFY(id != -1);
+    // A small message after the large one must not overtake it
+    const qint32 followUpId = client.publish(topic, QByteArray("done"), quint8(qos));
+    QVERIFY(followUpId != -1);
+#ifdef Q_OS_UNIX
+    // What the kernel did not take stays referenced instead of being copied
+    // into the socket, the follow-up is queued behind it
+    if (payloadSize >= 64 * 1024) {
+        auto socket = qobject_cast<QTcpSocket *>(client.transport());
+        QVERIFY(socket);
+        QCOMPARE(socket->bytesToWrite(), qint64(0));
+    }
+#endif
+
+    auto publishFrame = [&](qint32 packetId, const QByteArray &payload) {
+        QByteArray variableHeader;
+        variableHeader.append(char(topic.toUtf8().size() >> 8));
+        variableHeader.append(char(topic.toUtf8().size() & 0xFF));
+        variableHeader.append(topic.toUtf8());
+        if (qos) {
+            variableHeader.append(char(packetId >> 8));
+            variableHeader.append(char(packetId & 0xFF));
+        }
+        QByteArray frame(1, char(0x30 | (qos << 1)));
+        quint32 length = quint32(variableHeader.size() + payload.size());
+        do {
+            quint8 b = length % 128;
+            length /= 128;
+            if (length > 0)
+                b |= 0x80;
+            frame.append(char(b));
+        } while (length > 0);
+        return frame + variableHeader + payload;
+    };
+    const QByteArray expected = publishFrame(id, message) + publishFrame(followUpId, QByteArray("done"));
+
+    QTRY_COMPARE_WITH_TIMEOUT(broker.received().size(), expected.size(), 20000);
+    QVERIFY(broker.received() == expected);
+    QTRY_COMPARE(client.bytesToWrite(), qint64(0));
+
+    client.disconnectFromHost();
+}
+
+void Tst_QMqttConnection::publishOversized()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+
+    // Topic and packet identifier take 7 bytes, the remaining length would
+    // exceed its maximum by one. The payload is never touched.
+    const QMqttTopicName topic(QLatin1String("a/b"));
+    const QByteArray message(268435455 - 6, Qt::Uninitialized);
+    QTest::ignoreMessage(QtWarningMsg, "Publishing a message bigger than maximum size!");
+    QCOMPARE(client.publish(topic, message, 1), -1);
+    QCOMPARE(transport.bytesWrittenTotal(), qint64(0));
+    QCOMPARE(client.packetsToWrite(), 0);
+
+    // The packet identifier has not been used up
+    QCOMPARE(client.publish(topic, QByteArray("x"), 1), 1);
+
+    // Not queued while offline either
+    client.disconnectFromHost();
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QTest::ignoreMessage(QtWarningMsg, "Publishing a message bigger than maximum size!");
+    QCOMPARE(client.publish(topic, message, 1), -1);
+}
+
+void Tst_QMqttConnection::streamAborted()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto sub = client.subscribe(QLatin1String("a/b"), 0);
+    QVERIFY(sub);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x00", 5));
+    sub->setStreamingThreshold(10);
+
+    QSignalSpy startedSpy(sub.data(), &QMqttSubscription::streamStarted);
+    QSignalSpy finishedSpy(sub.data(), &QMqttSubscription::streamFinished);
+    QSignalSpy abortedSpy(sub.data(), &QMqttSubscription::streamAborted);
+    qint64 streamed = 0;
+    connect(sub.data(), &QMqttSubscription::streamDataReceived,
+            [&streamed](const QByteArray &data) { streamed += data.size(); });
+
+    transport.receive(QByteArray("\x30\x19\x00\x03" "a/b", 7) + QByteArray(20, 'x'));
+    QCOMPARE(startedSpy.count(), 1);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(streamed, qint64(20));
+
+    // The connection is lost after 40 of 100 bytes
+    transport.receive(QByteArray("\x30\x69\x00\x03" "a/b", 7) + QByteArray(40, 'y'));
+    QCOMPARE(startedSpy.count(), 2);
+    QCOMPARE(streamed, qint64(60));
+    QCOMPARE(abortedSpy.count(), 0);
+    transport.close();
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QCOMPARE(abortedSpy.count(), 1);
+    QCOMPARE(finishedSpy.count(), 1);
+}
+
+// Messages are only streamed if the client does not receive them as well
+void Tst_QMqttConnection::streamClientReceivers()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto sub = client.subscribe(QLatin1String("a/b"), 0);
+    QVERIFY(sub);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x00", 5));
+    sub->setStreamingThreshold(10);
+
+    QSignalSpy startedSpy(sub.data(), &QMqttSubscription::streamStarted);
+    QSignalSpy dataSpy(sub.data(), &QMqttSubscription::streamDataReceived);
+    QSignalSpy finishedSpy(sub.data(), &QMqttSubscription::streamFinished);
+    const QByteArray header("\x30\x69\x00\x03" "a/b", 7);
+    const QByteArray payload = QByteArray(40, 'x') + QByteArray(60, 'y');
+
+    {
+        // Buffered for QMqttClient::messageReceived, one part for the subscription
+        QSignalSpy receivedSpy(&client, &QMqttClient::messageReceived);
+        transport.receive(header + payload.left(40));
+        QCOMPARE(startedSpy.count(), 0);
+        transport.receive(payload.mid(40));
+        QCOMPARE(receivedSpy.count(), 1);
+        QCOMPARE(receivedSpy.at(0).at(0).toByteArray(), payload);
+        QCOMPARE(startedSpy.count(), 1);
+        QCOMPARE(dataSpy.count(), 1);
+        QCOMPARE(finishedSpy.count(), 1);
+    }
+
+    // The same for a message handler of the client
+    int handled = 0;
+    client.setMessageHandler([&handled, &payload](const QMqttMessage &message) {
+        QCOMPARE(message.payload(), payload);
+        ++handled;
+    });
+    transport.receive(header + payload.left(40));
+    QCOMPARE(startedSpy.count(), 1);
+    transport.receive(payload.mid(40));
+    QCOMPARE(handled, 1);
+    QCOMPARE(startedSpy.count(), 2);
+    QCOMPARE(dataSpy.count(), 2);
+
+    // Streamed if only the subscriptions receive messages
+    client.setMessageDispatch(QMqttClient::SubscriptionsOnly);
+    transport.receive(header + payload.left(40));
+    QCOMPARE(startedSpy.count(), 3);
+    QCOMPARE(dataSpy.count(), 3);
+    transport.receive(payload.mid(40));
+    QCOMPARE(dataSpy.count(), 4);
+    QCOMPARE(finishedSpy.count(), 3);
+    QCOMPARE(handled, 1);
+}
+
+// Frames of 107 bytes: fixed header, remaining length, topic and message
+static const QMqttTopicName watermarkTopic(QLatin1String("a/b"));
+static QByteArray watermarkMessage(int index)
+{
+    return QByteArray(100, char('a' + index % 26));
+}
+
+void Tst_QMqttConnection::writeBufferBytes()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setStalled(true);
+
+    client.setWriteBufferHighWatermark(1000);
+    client.setWriteBufferLowWatermark(200);
+    QSignalSpy fullSpy(&client, &QMqttClient::writeBufferFull);
+    QSignalSpy drainedSpy(&client, &QMqttClient::writeBufferDrained);
+
+    for (int i = 0; i < 9; ++i)
+        QCOMPARE(client.publish(watermarkTopic, watermarkMessage(i)), 0);
+    QCOMPARE(client.bytesToWrite(), qint64(9 * 107));
+    QCOMPARE(client.packetsToWrite(), 9);
+    QVERIFY(!client.isWriteBufferFull());
+    QCOMPARE(fullSpy.count(), 0);
+
+    // Reaching the high watermark still writes the message
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(9)), 0);
+    QVERIFY(client.isWriteBufferFull());
+    QCOMPARE(fullSpy.count(), 1);
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(10)), -1);
+    QCOMPARE(client.bytesToWrite(), qint64(10 * 107));
+
+    transport.drain(800);
+    QVERIFY(client.isWriteBufferFull());
+    QCOMPARE(client.packetsToWrite(), 3);
+    transport.drain(100);
+    QVERIFY(!client.isWriteBufferFull());
+    QCOMPARE(drainedSpy.count(), 1);
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(11)), 0);
+    QCOMPARE(fullSpy.count(), 1);
+}
+
+void Tst_QMqttConnection::writeBufferPackets()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setStalled(true);
+
+    client.setWriteBufferPacketHighWatermark(5);
+    client.setWriteBufferPacketLowWatermark(2);
+    QSignalSpy fullSpy(&client, &QMqttClient::writeBufferFull);
+    QSignalSpy drainedSpy(&client, &QMqttClient::writeBufferDrained);
+
+    for (int i = 0; i < 5; ++i)
+        QVERIFY(client.publish(watermarkTopic, watermarkMessage(i), 1) > 0);
+    QCOMPARE(fullSpy.count(), 1);
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(5), 1), -1);
+
+    // A partially written packet still counts
+    transport.drain(3 * 109 - 1);
+    QCOMPARE(client.packetsToWrite(), 3);
+    QCOMPARE(drainedSpy.count(), 0);
+    transport.drain(1);
+    QCOMPARE(client.packetsToWrite(), 2);
+    QCOMPARE(drainedSpy.count(), 1);
+    QVERIFY(!client.isWriteBufferFull());
+
+    // Disabling the limit drains as well
+    for (int i = 6; i < 9; ++i)
+        QVERIFY(client.publish(watermarkTopic, watermarkMessage(i), 1) > 0);
+    QCOMPARE(fullSpy.count(), 2);
+    client.setWriteBufferPacketHighWatermark(0);
+    QVERIFY(!client.isWriteBufferFull());
+    QCOMPARE(drainedSpy.count(), 2);
+}
+
+void Tst_QMqttConnection::writeBufferQueue()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setStalled(true);
+    transport.setKeepWritten(true);
+
+    client.setWriteBufferHighWatermark(500);
+    client.setWriteBufferPolicy(QMqttClient::QueueWhenFull);
+    QSignalSpy drainedSpy(&client, &QMqttClient::writeBufferDrained);
+
+    QByteArray expected;
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(client.publish(watermarkTopic, watermarkMessage(i)), 0);
+        expected.append(watermarkMessage(i));
+    }
+    // Memory held by the transport stays bounded, the client keeps the rest
+    QVERIFY(client.isWriteBufferFull());
+    QCOMPARE(client.bytesToWrite(), qint64(5 * 107));
+    QCOMPARE(transport.writeCount(), 5);
+
+    // The queued messages are written in order after draining
+    transport.drain(5 * 107);
+    QCOMPARE(drainedSpy.count(), 1);
+    QCOMPARE(transport.writeCount(), 10);
+    QVERIFY(client.isWriteBufferFull());
+    transport.drain(5 * 107);
+    QCOMPARE(drainedSpy.count(), 2);
+    QVERIFY(!client.isWriteBufferFull());
+
+    QByteArray messages;
+    const QByteArray written = transport.written();
+    for (int i = 0; i < 10; ++i)
+        messages.append(written.mid(i * 107 + 7, 100));
+    QCOMPARE(messages, expected);
+
+    // The memory kept by the client is limited as well
+    client.setWriteBufferQueueLimit(3 * 107);
+    for (int i = 0; i < 5; ++i)
+        QCOMPARE(client.publish(watermarkTopic, watermarkMessage(i)), 0);
+    QVERIFY(client.isWriteBufferFull());
+    for (int i = 0; i < 3; ++i)
+        QCOMPARE(client.publish(watermarkTopic, watermarkMessage(i)), 0);
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(3)), -1);
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(4), 1), -1);
+
+    // Space becomes available once the queued messages are written
+    transport.drain(5 * 107);
+    QCOMPARE(transport.writeCount(), 18);
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(5)), 0);
+}
+
+// Keeps 60000 messages in flight, no identifier may be used twice
+void Tst_QMqttConnection::packetIdentifiers()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    QSignalSpy sentSpy(&client, &QMqttClient::messageSent);
+
+    const QMqttTopicName topic(QLatin1String("a/b"));
+    const int inFlightCount = 60000;
+    QVector<bool> inFlight(65536, false);
+    QVector<quint16> ids;
+    ids.reserve(inFlightCount);
+    for (int i = 0; i < inFlightCount; ++i) {
+        const qint32 id = client.publish(topic, QByteArray("x"), quint8(1 + i % 2));
+        QVERIFY(id > 0 && id <= 65535);
+        QVERIFY(!inFlight.at(id));
+        inFlight[id] = true;
+        ids.append(quint16(id));
+    }
+
+    // Acknowledge every other QoS 1 message
+    QByteArray acknowledges;
+    for (int i = 0; i < inFlightCount; i += 4) {
+        acknowledges.append(createPublishAcknowledge(ids.at(i)));
+        inFlight[ids.at(i)] = false;
+    }
+    transport.receive(acknowledges);
+    QCOMPARE(sentSpy.count(), inFlightCount / 4);
+
+    for (int i = 0; i < inFlightCount / 4; ++i) {
+        const qint32 id = client.publish(topic, QByteArray("x"), 1);
+        QVERIFY(id > 0);
+        QVERIFY(!inFlight.at(id));
+        inFlight[id] = true;
+    }
+
+    // SUBSCRIBE shares the identifiers with PUBLISH
+    transport.setKeepWritten(true);
+    transport.resetCounters();
+    QVERIFY(client.subscribe(QLatin1String("c/d"), 1));
+    const QByteArray subscribe = transport.written();
+    QCOMPARE(quint8(subscribe.at(0)), quint8(0x82));
+    const quint16 subscribeId = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(subscribe.constData() + 2));
+    QVERIFY(subscribeId != 0);
+    QVERIFY(!inFlight.at(subscribeId));
+
+    // Identifiers are not shared between connections
+    FakeTransport otherTransport;
+    QMqttClient otherClient;
+    QVERIFY(connectFakeBroker(&otherClient, &otherTransport));
+    QCOMPARE(otherClient.publish(topic, QByteArray("x"), 1), 1);
+}
+
+static QByteArray createPublish(quint8 qos, quint16 id, const QByteArray &message)
+{
+    QByteArray data = QByteArray("\x00\x03" "a/b", 5);
+    const quint16 idBigEndian = qToBigEndian<quint16>(id);
+    if (qos)
+        data.append(reinterpret_cast<const char *>(&idBigEndian), 2);
+    data.append(message);
+    return char(0x30 | (qos << 1)) + (char(data.size()) + data);
+}
+
+// Messages in flight survive the client via the session store and are sent
+// again after the next CONNACK.
+void Tst_QMqttConnection::sessionRestore()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QLatin1String("session"));
+    const QMqttTopicName topic(QLatin1String("a/b"));
+
+    qint32 qos1Id = 0;
+    qint32 qos2Id = 0;
+    {
+        FakeTransport transport;
+        QMqttClient client;
+        client.setCleanSession(false);
+        QVERIFY(client.setSessionStoreFile(fileName));
+        QCOMPARE(client.sessionStoreFile(), fileName);
+        QVERIFY(connectFakeBroker(&client, &transport));
+        QSignalSpy receivedSpy(&client, &QMqttClient::messageReceived);
+
+        qos1Id = client.publish(topic, QByteArray("one"), 1);
+        qos2Id = client.publish(topic, QByteArray("two"), 2);
+        const qint32 acknowledgedId = client.publish(topic, QByteArray("three"), 1);
+        QVERIFY(qos1Id > 0 && qos2Id > 0 && acknowledgedId > 0);
+
+        // PUBREC for the QoS 2 message, PUBACK for the last one
+        QByteArray received = createPublishAcknowledge(quint16(qos2Id));
+        received[0] = '\x50';
+        transport.receive(received + createPublishAcknowledge(quint16(acknowledgedId)));
+
+        // Incoming QoS 2 message, the PUBREL is lost with the connection
+        transport.receive(createPublish(2, 7, QByteArray("in")));
+        QCOMPARE(receivedSpy.count(), 1);
+    }
+
+    FakeTransport transport;
+    transport.setKeepWritten(true);
+    QMqttClient client;
+    client.setCleanSession(false);
+    QVERIFY(client.setSessionStoreFile(fileName));
+    QSignalSpy receivedSpy(&client, &QMqttClient::messageReceived);
+    client.setTransport(&transport, QMqttClient::IODevice);
+    client.connectToHost();
+    transport.resetCounters();
+    // Session present
+    transport.receive(QByteArray("\x20\x02\x01\x00", 4));
+    QCOMPARE(client.state(), QMqttClient::Connected);
+
+    // The QoS 1 message with DUP set, then the release of the QoS 2 message
+    QByteArray expected = createPublish(1, quint16(qos1Id), QByteArray("one"));
+    expected[0] = char(expected.at(0) | 0x08);
+    QByteArray release = createPublishAcknowledge(quint16(qos2Id));
+    release[0] = '\x62';
+    expected.append(release);
+    QCOMPARE(transport.written(), expected);
+
+    // The broker sends the unreleased message again, it is not delivered twice
+    transport.resetCounters();
+    transport.receive(createPublish(2, 7, QByteArray("in")));
+    QCOMPARE(receivedSpy.count(), 0);
+    QByteArray receive = createPublishAcknowledge(7);
+    receive[0] = '\x50';
+    QCOMPARE(transport.written(), receive);
+
+    QSignalSpy sentSpy(&client, &QMqttClient::messageSent);
+    QByteArray complete = createPublishAcknowledge(quint16(qos2Id));
+    complete[0] = '\x70';
+    transport.receive(createPublishAcknowledge(quint16(qos1Id)) + complete);
+    QCOMPARE(sentSpy.count(), 2);
+}
+
+void Tst_QMqttConnection::offlineQueue()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    const QMqttTopicName topic(QLatin1String("a/b"));
+
+    // Disabled by default
+    QCOMPARE(client.publish(topic, QByteArray("x"), 0), -1);
+
+    client.setOfflineQueueMemoryLimit(1024);
+    client.setOfflineQueueConflation(QMqttTopicFilter(QLatin1String("state")));
+    for (int i = 0; i < 5; ++i)
+        QCOMPARE(client.publish(topic, QByteArray::number(i), quint8(i % 2)), 0);
+    QCOMPARE(client.publish(QMqttTopicName(QLatin1String("state")), QByteArray("old")), 0);
+    QCOMPARE(client.publish(QMqttTopicName(QLatin1String("state")), QByteArray("new")), 0);
+    QCOMPARE(client.offlineQueueDepth(), 6);
+    QCOMPARE(client.offlineQueueBytes(), qint64(5 * 4 + 8));
+    QCOMPARE(client.offlineQueueDiscarded(), 1);
+
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setKeepWritten(true);
+    // Published while draining, sent after the queued messages
+    QCOMPARE(client.publish(topic, QByteArray("5"), 0), 0);
+    QTRY_COMPARE(client.offlineQueueDepth(), 0);
+
+    QByteArray expected;
+    for (int i = 0; i < 5; ++i)
+        expected.append(createPublish(quint8(i % 2), quint16((i + 1) / 2), QByteArray::number(i)));
+    expected.append(QByteArray("\x30\x0a\x00\x05" "statenew", 12));
+    expected.append(QByteArray("\x30\x06\x00\x03" "a/b5", 8));
+    QCOMPARE(transport.written(), expected);
+
+    // Connected with an empty queue, messages are sent right away
+    QVERIFY(client.publish(topic, QByteArray("x"), 1) > 0);
+    QCOMPARE(client.offlineQueueDepth(), 0);
+}
+
+void Tst_QMqttConnection::offlineQueueDrainRate()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    const QMqttTopicName topic(QLatin1String("a/b"));
+
+    client.setOfflineQueueMemoryLimit(1024 * 1024);
+    client.setOfflineQueueDrainRate(100);
+    for (int i = 0; i < 50; ++i)
+        QCOMPARE(client.publish(topic, QByteArray("x"), 0), 0);
+
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(connectFakeBroker(&client, &transport));
+    QTRY_COMPARE_WITH_TIMEOUT(client.offlineQueueDepth(), 0, 5000);
+    // A burst of 10 messages, the rest at 100 per second
+    QVERIFY(timer.elapsed() >= 300);
+    QCOMPARE(transport.writeCount(), 50);
+}
+
+void Tst_QMqttConnection::reconnectBackoff()
+{
+    quint16 port = 0;
+    {
+        QTcpServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+        port = server.serverPort();
+    }
+
+    QMqttClient client;
+    client.setHostname(QLatin1String("127.0.0.1"));
+    client.setPort(port);
+    client.setAutoReconnect(true);
+    client.setReconnectMinimumInterval(40);
+    client.setReconnectMaximumInterval(160);
+    QElapsedTimer timer;
+    QVector<qint64> attempts;
+    connect(&client, &QMqttClient::stateChanged, [&](QMqttClient::State state) {
+        if (state == QMqttClient::Connecting)
+            attempts.append(timer.elapsed());
+    });
+
+    timer.start();
+    client.connectToHost();
+    QTRY_VERIFY_WITH_TIMEOUT(attempts.size() >= 6, 5000);
+
+    // Jittered between half and all of 40, 80, 160, 160, 160 ms
+    const qint64 backoff[] = {40, 80, 160, 160, 160};
+    for (int i = 0; i < 5; ++i) {
+        const qint64 delay = attempts.at(i + 1) - attempts.at(i);
+        QVERIFY2(delay >= backoff[i] / 2, qPrintable(QString::number(delay)));
+    }
+
+    client.disconnectFromHost();
+    const int count = attempts.size();
+    QTest::qWait(400);
+    QCOMPARE(attempts.size(), count);
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+}
+
+// The subscriptions survive a lost connection and are restored in one packet
+void Tst_QMqttConnection::reconnectResubscribe()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    client.setAutoReconnect(true);
+    client.setReconnectMinimumInterval(10);
+    QVERIFY(connectFakeBroker(&client, &transport));
+
+    QVector<QSharedPointer<QMqttSubscription>> subscriptions;
+    for (int i = 1; i <= 3; ++i) {
+        subscriptions.append(client.subscribe(QString::fromLatin1("a/%1").arg(i), 1));
+        QVERIFY(subscriptions.last());
+        transport.receive(QByteArray("\x90\x03\x00", 3) + char(i) + char(1));
+        QCOMPARE(subscriptions.last()->state(), QMqttSubscription::Subscribed);
+    }
+
+    transport.setKeepWritten(true);
+    transport.close();
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QCOMPARE(subscriptions.at(0)->state(), QMqttSubscription::Subscribed);
+
+    // Reconnects and sends CONNECT
+    QTRY_COMPARE(client.state(), QMqttClient::Connecting);
+    QVERIFY(transport.isOpen());
+    QCOMPARE(quint8(transport.written().at(0)), quint8(0x10));
+
+    transport.resetCounters();
+    transport.receive(QByteArray("\x20\x02\x00\x00", 4));
+    QCOMPARE(client.state(), QMqttClient::Connected);
+    QCOMPARE(transport.writeCount(), 1);
+    QCOMPARE(transport.written(), QByteArray("\x82\x14\x00\x04"
+                                             "\x00\x03" "a/1\x01"
+                                             "\x00\x03" "a/2\x01"
+                                             "\x00\x03" "a/3\x01", 22));
+    for (const auto &sub : qAsConst(subscriptions))
+        QCOMPARE(sub->state(), QMqttSubscription::SubscriptionPending);
+
+    // One SUBACK for all of them, the broker grants QoS 0 for the last one
+    transport.receive(QByteArray("\x90\x05\x00\x04\x01\x01\x00", 7));
+    for (const auto &sub : qAsConst(subscriptions))
+        QCOMPARE(sub->state(), QMqttSubscription::Subscribed);
+    QCOMPARE(subscriptions.at(2)->qos(), quint8(0));
+
+    // The same objects receive messages
+    QSignalSpy messageSpy(subscriptions.at(1).data(), &QMqttSubscription::messageReceived);
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/2x", 8));
+    QCOMPARE(messageSpy.count(), 1);
+}
+
+// Unacknowledged messages are sent again with DUP set after reconnecting
+void Tst_QMqttConnection::reconnectResend()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    client.setCleanSession(false);
+    client.setAutoReconnect(true);
+    client.setReconnectMinimumInterval(10);
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const QMqttTopicName topic(QLatin1String("a/b"));
+
+    transport.setKeepWritten(true);
+    const qint32 qos1Id = client.publish(topic, QByteArray("one"), 1);
+    const qint32 qos2Id = client.publish(topic, QByteArray("two"), 2);
+    const qint32 receivedId = client.publish(topic, QByteArray("three"), 2);
+    QVERIFY(qos1Id > 0 && qos2Id > 0 && receivedId > 0);
+    const QByteArray firstAttempt = createPublish(1, quint16(qos1Id), QByteArray("one"))
+            + createPublish(2, quint16(qos2Id), QByteArray("two"))
+            + createPublish(2, quint16(receivedId), QByteArray("three"));
+    QCOMPARE(transport.written(), firstAttempt);
+
+    // Only the last message has been received by the broker
+    QByteArray received = createPublishAcknowledge(quint16(receivedId));
+    received[0] = '\x50';
+    transport.resetCounters();
+    transport.receive(received);
+
+    transport.close();
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QTRY_COMPARE(client.state(), QMqttClient::Connecting);
+    transport.resetCounters();
+    transport.receive(QByteArray("\x20\x02\x01\x00", 4));
+    QCOMPARE(client.state(), QMqttClient::Connected);
+
+    // The same frames with DUP set, then the release
+    QByteArray expected = createPublish(1, quint16(qos1Id), QByteArray("one"));
+    expected[0] = '\x3A';
+    QByteArray qos2 = createPublish(2, quint16(qos2Id), QByteArray("two"));
+    qos2[0] = '\x3C';
+    expected.append(qos2);
+    QByteArray release = createPublishAcknowledge(quint16(receivedId));
+    release[0] = '\x62';
+    expected.append(release);
+    QCOMPARE(transport.written(), expected);
+
+    // A second reconnect sends the same frames again
+    transport.close();
+    QTRY_COMPARE(client.state(), QMqttClient::Connecting);
+    transport.resetCounters();
+    transport.receive(QByteArray("\x20\x02\x01\x00", 4));
+    QCOMPARE(transport.written(), expected);
+
+    QSignalSpy sentSpy(&client, &QMqttClient::messageSent);
+    QByteArray complete = createPublishAcknowledge(quint16(receivedId));
+    complete[0] = '\x70';
+    transport.receive(createPublishAcknowledge(quint16(qos1Id)) + complete);
+    QCOMPARE(sentSpy.count(), 2);
+}
+
+// Messages queued while the write buffer is full survive a lost connection
+// and are sent for the first time after reconnecting
+void Tst_QMqttConnection::reconnectWriteBufferQueue()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    client.setCleanSession(false);
+    client.setAutoReconnect(true);
+    client.setReconnectMinimumInterval(10);
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setStalled(true);
+    transport.setKeepWritten(true);
+    client.setWriteBufferHighWatermark(500);
+    client.setWriteBufferPolicy(QMqttClient::QueueWhenFull);
+
+    const qint32 writtenId = client.publish(watermarkTopic, watermarkMessage(0), 1);
+    QVERIFY(writtenId > 0);
+    for (int i = 1; i < 5; ++i)
+        QCOMPARE(client.publish(watermarkTopic, watermarkMessage(i)), 0);
+    QVERIFY(client.isWriteBufferFull());
+    QCOMPARE(transport.writeCount(), 5);
+
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(5)), 0);
+    const qint32 queuedId = client.publish(watermarkTopic, watermarkMessage(6), 1);
+    QVERIFY(queuedId > 0);
+    QCOMPARE(transport.writeCount(), 5);
+
+    // The data the transport did not send is lost with the connection
+    transport.close();
+    transport.setStalled(false);
+    transport.drain(transport.bytesToWrite());
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QTRY_COMPARE(client.state(), QMqttClient::Connecting);
+    transport.resetCounters();
+    transport.receive(QByteArray("\x20\x02\x01\x00", 4));
+    QCOMPARE(client.state(), QMqttClient::Connected);
+
+    // The written message is sent again with DUP set, the queued ones for
+    // the first time and in order
+    QByteArray resent = createPublish(1, quint16(writtenId), watermarkMessage(0));
+    resent[0] = '\x3A';
+    const QByteArray expected = resent
+            + createPublish(0, 0, watermarkMessage(5))
+            + createPublish(1, quint16(queuedId), watermarkMessage(6));
+    QCOMPARE(transport.written(), expected);
+    QVERIFY(!client.isWriteBufferFull());
+
+    // Later messages are written directly again
+    transport.resetCounters();
+    QCOMPARE(client.publish(watermarkTopic, watermarkMessage(7)), 0);
+    QCOMPARE(transport.written(), createPublish(0, 0, watermarkMessage(7)));
+
+    QSignalSpy sentSpy(&client, &QMqttClient::messageSent);
+    transport.receive(createPublishAcknowledge(quint16(writtenId))
+                      + createPublishAcknowledge(quint16(queuedId)));
+    QCOMPARE(sentSpy.count(), 2);
+}
+
+void Tst_QMqttConnection::pipelinedConnect()
+{
+    LocalBroker broker;
+    QVERIFY(broker.listen());
+
+    QMqttClient client;
+    client.setHostname(QLatin1String("127.0.0.1"));
+    client.setPort(broker.port());
+    QSignalSpy sentSpy(&client, &QMqttClient::messageSent);
+
+    client.connectToHost();
+    QCOMPARE(client.state(), QMqttClient::Connecting);
+
+    // Kept until the socket is connected, then written together with the CONNECT
+    const auto sub = client.subscribe(QLatin1String("a/b"), 1);
+    QVERIFY(sub);
+    QCOMPARE(sub->state(), QMqttSubscription::SubscriptionPending);
+    QCOMPARE(client.publish(QLatin1String("a/c"), "x", 1), 2);
+
+    QTRY_VERIFY(broker.acceptClient());
+    QTRY_COMPARE(client.state(), QMqttClient::Connected);
+    // Neither is sent again once the broker acknowledged the connection
+    QTRY_COMPARE(broker.received(), QByteArray("\x82\x08\x00\x01\x00\x03" "a/b\x01"
+                                               "\x32\x08\x00\x03" "a/c\x00\x02" "x", 20));
+    QCOMPARE(sub->state(), QMqttSubscription::SubscriptionPending);
+    QCOMPARE(sentSpy.count(), 0);
+}
+
+void Tst_QMqttConnection::pipelinedConnectRejected()
+{
+    FakeTransport transport;
+    transport.setKeepWritten(true);
+    QMqttClient client;
+    QSignalSpy sentSpy(&client, &QMqttClient::messageSent);
+
+    client.setTransport(&transport, QMqttClient::IODevice);
+    client.connectToHost();
+    QCOMPARE(client.state(), QMqttClient::Connecting);
+    // The CONNECT has been sent already, further packets follow right away
+    const auto sub = client.subscribe(QLatin1String("a/b"), 1);
+    QVERIFY(sub);
+    QVERIFY(client.publish(QLatin1String("a/c"), "x", 1) > 0);
+    QCOMPARE(transport.writeCount(), 3);
+
+    QTest::ignoreMessage(QtWarningMsg, "Connection has been rejected");
+    transport.receive(QByteArray("\x20\x02\x00\x05", 4));
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QCOMPARE(sub->state(), QMqttSubscription::Unsubscribed);
+
+    // Nothing of the rejected session is restored
+    QVERIFY(connectFakeBroker(&client, &transport));
+    QCOMPARE(transport.writeCount(), 0);
+    QCOMPARE(sentSpy.count(), 0);
+
+    // The topic can be subscribed again
+    const auto other = client.subscribe(QLatin1String("a/b"), 1);
+    QVERIFY(other);
+    QVERIFY(other != sub);
+}
+
+void Tst_QMqttConnection::subscribeMultiple()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setKeepWritten(true);
+
+    const auto existing = client.subscribe(QLatin1String("a/0"), 0);
+    QVERIFY(existing);
+    transport.resetCounters();
+
+    QList<QPair<QMqttTopicFilter, quint8>> topics;
+    topics << qMakePair(QMqttTopicFilter(QLatin1String("a/1")), quint8(1))
+           << qMakePair(QMqttTopicFilter(QLatin1String("a/#/b")), quint8(1))
+           << qMakePair(QMqttTopicFilter(QLatin1String("a/2")), quint8(2))
+           << qMakePair(QMqttTopicFilter(QLatin1String("a/0")), quint8(1))
+           << qMakePair(QMqttTopicFilter(QLatin1String("a/1")), quint8(1));
+    QTest::ignoreMessage(QtWarningMsg, "Invalid topic filter.");
+    const auto subscriptions = client.subscribe(topics);
+    QCOMPARE(subscriptions.size(), 5);
+    QVERIFY(subscriptions.at(0));
+    QVERIFY(!subscriptions.at(1));
+    QVERIFY(subscriptions.at(2));
+    QCOMPARE(subscriptions.at(3), existing);
+    QCOMPARE(subscriptions.at(4), subscriptions.at(0));
+
+    // One packet for the new topic filters
+    QCOMPARE(transport.writeCount(), 1);
+    QCOMPARE(transport.written(), QByteArray("\x82\x0e\x00\x02"
+                                             "\x00\x03" "a/1\x01"
+                                             "\x00\x03" "a/2\x02", 16));
+
+    // The return codes are applied in order
+    transport.receive(QByteArray("\x90\x04\x00\x02\x01\x80", 6));
+    QCOMPARE(subscriptions.at(0)->state(), QMqttSubscription::Subscribed);
+    QCOMPARE(subscriptions.at(2)->state(), QMqttSubscription::Error);
+
+    transport.resetCounters();
+    QList<QMqttTopicFilter> filters;
+    filters << QMqttTopicFilter(QLatin1String("a/0")) << QMqttTopicFilter(QLatin1String("a/1"));
+    client.unsubscribe(filters);
+    QCOMPARE(transport.writeCount(), 1);
+    QCOMPARE(transport.written(), QByteArray("\xa2\x0c\x00\x03"
+                                             "\x00\x03" "a/0"
+                                             "\x00\x03" "a/1", 14));
+    QCOMPARE(existing->state(), QMqttSubscription::UnsubscriptionPending);
+
+    transport.receive(QByteArray("\xb0\x02\x00\x03", 4));
+    QCOMPARE(existing->state(), QMqttSubscription::Unsubscribed);
+    QCOMPARE(subscriptions.at(0)->state(), QMqttSubscription::Unsubscribed);
+}
+
+void Tst_QMqttConnection::subscribeMultipleBatches()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setKeepWritten(true);
+
+    // About 110 KiB of topic filters, 57 bytes each in a SUBSCRIBE
+    QList<QPair<QMqttTopicFilter, quint8>> topics;
+    for (int i = 0; i < 2000; ++i) {
+        const QString filter = QString::fromLatin1("sensors/building/floor/room/%1/temperature/celsius")
+                .arg(i, 6, 10, QLatin1Char('0'));
+        topics.append(qMakePair(QMqttTopicFilter(filter), quint8(1)));
+    }
+    const auto subscriptions = client.subscribe(topics);
+    QCOMPARE(subscriptions.size(), topics.size());
+    QCOMPARE(transport.writeCount(), 2);
+
+    // The first packet stays within 64 KiB
+    const QByteArray written = transport.written();
+    QCOMPARE(quint8(written.at(0)), quint8(0x82));
+    const int remaining = (quint8(written.at(1)) & 0x7f) + ((quint8(written.at(2)) & 0x7f) << 7)
+            + (quint8(written.at(3)) << 14);
+    QVERIFY(remaining <= 64 * 1024 + 2);
+    const int firstCount = (remaining - 2) / 57;
+    QCOMPARE(firstCount, 1149);
+
+    // Each SUBACK completes the topic filters of its SUBSCRIBE
+    QByteArray subAck("\x90", 1);
+    quint32 ackLength = quint32(firstCount + 2);
+    do {
+        quint8 b = ackLength % 128;
+        ackLength /= 128;
+        if (ackLength > 0)
+            b |= 0x80;
+        subAck.append(char(b));
+    } while (ackLength > 0);
+    subAck.append(QByteArray("\x00\x01", 2));
+    subAck.append(QByteArray(firstCount, '\x01'));
+    transport.receive(subAck);
+
+    QCOMPARE(subscriptions.at(0)->state(), QMqttSubscription::Subscribed);
+    QCOMPARE(subscriptions.at(firstCount - 1)->state(), QMqttSubscription::Subscribed);
+    QCOMPARE(subscriptions.at(firstCount)->state(), QMqttSubscription::SubscriptionPending);
+    QCOMPARE(subscriptions.last()->state(), QMqttSubscription::SubscriptionPending);
+}
+
+void Tst_QMqttConnection::disconnectMode_data()
+{
+    QTest::addColumn<QMqttClient::DisconnectMode>("mode");
+    QTest::addColumn<QByteArray>("written");
+    QTest::addColumn<QMqttSubscription::SubscriptionState>("state");
+
+    QTest::newRow("unsubscribe") << QMqttClient::UnsubscribeAll
+                                 << QByteArray("\xa2\x0c\x00\x02" "\x00\x03" "a/1" "\x00\x03" "a/2"
+                                               "\xe0\x00", 16)
+                                 << QMqttSubscription::Unsubscribed;
+    QTest::newRow("discard") << QMqttClient::DiscardSubscriptions << QByteArray("\xe0\x00", 2)
+                             << QMqttSubscription::Unsubscribed;
+    QTest::newRow("keep") << QMqttClient::KeepSubscriptions << QByteArray("\xe0\x00", 2)
+                          << QMqttSubscription::Subscribed;
+}
+
+void Tst_QMqttConnection::disconnectMode()
+{
+    QFETCH(QMqttClient::DisconnectMode, mode);
+    QFETCH(QByteArray, written);
+    QFETCH(QMqttSubscription::SubscriptionState, state);
+
+    FakeTransport transport;
+    QMqttClient client;
+    client.setCleanSession(false);
+    QVERIFY(connectFakeBroker(&client, &transport));
+    transport.setKeepWritten(true);
+
+    QList<QPair<QMqttTopicFilter, quint8>> topics;
+    topics << qMakePair(QMqttTopicFilter(QLatin1String("a/1")), quint8(1))
+           << qMakePair(QMqttTopicFilter(QLatin1String("a/2")), quint8(1));
+    const auto subscriptions = client.subscribe(topics);
+    transport.receive(QByteArray("\x90\x04\x00\x01\x01\x01", 6));
+    transport.resetCounters();
+
+    client.disconnectFromHost(mode);
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QCOMPARE(transport.written(), written);
+    for (const auto &sub : subscriptions)
+        QCOMPARE(sub->state(), state);
+
+    // The broker kept the session, nothing has to be restored
+    transport.resetCounters();
+    client.connectToHost();
+    transport.receive(QByteArray("\x20\x02\x01\x00", 4));
+    QCOMPARE(client.state(), QMqttClient::Connected);
+    QCOMPARE(transport.writeCount(), 1);
+    QCOMPARE(quint8(transport.written().at(0)), quint8(0x10));
+}
+
+void Tst_QMqttConnection::unsubscribeOffline()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    client.setCleanSession(false);
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto first = client.subscribe(QLatin1String("a/1"), 1);
+    const auto second = client.subscribe(QLatin1String("a/2"), 1);
+    QVERIFY(first && second);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x01" "\x90\x03\x00\x02\x01", 10));
+    QCOMPARE(first->state(), QMqttSubscription::Subscribed);
+
+    client.disconnectFromHost(QMqttClient::KeepSubscriptions);
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    transport.setKeepWritten(true);
+    transport.resetCounters();
+
+    // Nothing to send without a broker, only forgotten locally
+    client.unsubscribe(QLatin1String("a/1"));
+    QCOMPARE(first->state(), QMqttSubscription::Unsubscribed);
+    QCOMPARE(second->state(), QMqttSubscription::Subscribed);
+    QCOMPARE(transport.writeCount(), 0);
+
+    // A broker which lost the session only gets the remaining subscription
+    client.connectToHost();
+    transport.receive(QByteArray("\x20\x02\x00\x00", 4));
+    QCOMPARE(client.state(), QMqttClient::Connected);
+    const QByteArray written = transport.written();
+    QVERIFY(written.contains("a/2"));
+    QVERIFY(!written.contains("a/1"));
+}
+
+// Slots notified about aborted requests may change the subscriptions
+void Tst_QMqttConnection::unsubscribeAborted()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto first = client.subscribe(QLatin1String("a/1"), 1);
+    const auto second = client.subscribe(QLatin1String("a/2"), 1);
+    QVERIFY(first && second);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x01" "\x90\x03\x00\x02\x01", 10));
+
+    client.unsubscribe(QLatin1String("a/1"));
+    QCOMPARE(first->state(), QMqttSubscription::UnsubscriptionPending);
+    connect(first.data(), &QMqttSubscription::stateChanged, [&client](QMqttSubscription::SubscriptionState state) {
+        if (state == QMqttSubscription::Unsubscribed)
+            client.unsubscribe(QLatin1String("a/2"));
+    });
+
+    // The UNSUBACK never arrives, the second one is only forgotten locally
+    transport.setKeepWritten(true);
+    transport.close();
+    QCOMPARE(client.state(), QMqttClient::Disconnected);
+    QCOMPARE(first->state(), QMqttSubscription::Unsubscribed);
+    QCOMPARE(second->state(), QMqttSubscription::Unsubscribed);
+    QVERIFY(transport.written().isEmpty());
+
+    // Nothing is restored after reconnecting
+    client.connectToHost();
+    transport.resetCounters();
+    transport.receive(QByteArray("\x20\x02\x00\x00", 4));
+    QCOMPARE(client.state(), QMqttClient::Connected);
+    QCOMPARE(transport.writeCount(), 0);
+}
+
+void Tst_QMqttConnection::messageHandler()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto sub = client.subscribe(QLatin1String("a/+"), 1);
+    QVERIFY(sub);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x01", 5));
+
+    // Handlers are called before the signals
+    QStringList calls;
+    client.setMessageHandler([&calls](const QMqttMessage &msg) {
+        calls.append(QLatin1String("client ") + msg.topic());
+    });
+    connect(&client, &QMqttClient::messageReceived, [&calls](const QByteArray &, const QString &) {
+        calls.append(QLatin1String("client signal"));
+    });
+    sub->setMessageHandler([&calls](const QMqttMessage &msg) {
+        calls.append(QLatin1String("subscription ") + QString::fromUtf8(msg.payload()));
+    });
+    connect(sub.data(), &QMqttSubscription::messageReceived, [&calls](QMqttMessage) {
+        calls.append(QLatin1String("subscription signal"));
+    });
+
+    transport.receive(QByteArray("\x32\x08\x00\x03" "a/b" "\x00\x07" "x", 10));
+    const QStringList expected = {QLatin1String("client a/b"), QLatin1String("client signal"),
+                                  QLatin1String("subscription x"), QLatin1String("subscription signal")};
+    QCOMPARE(calls, expected);
+
+    // A handler may remove itself
+    calls.clear();
+    sub->setMessageHandler([&sub](const QMqttMessage &) {
+        sub->setMessageHandler(QMqttSubscription::MessageHandler());
+    });
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/c" "y", 8));
+    QVERIFY(!sub->messageHandler());
+    QCOMPARE(calls.size(), 3);
+
+    // The replacement is called from the next message on
+    calls.clear();
+    sub->setMessageHandler([&sub, &calls](const QMqttMessage &) {
+        calls.append(QLatin1String("first"));
+        sub->setMessageHandler([&calls](const QMqttMessage &) { calls.append(QLatin1String("second")); });
+        QVERIFY(sub->messageHandler());
+    });
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/c" "y", 8));
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/c" "z", 8));
+    QCOMPARE(calls.count(QLatin1String("first")), 1);
+    QCOMPARE(calls.count(QLatin1String("second")), 1);
+}
+
+void Tst_QMqttConnection::messageDispatch_data()
+{
+    QTest::addColumn<int>("messageDispatch");
+    QTest::addColumn<int>("clientCount");
+    QTest::addColumn<int>("subscriptionCount");
+
+    QTest::newRow("both") << int(QMqttClient::ClientAndSubscriptions) << 2 << 2;
+    QTest::newRow("client") << int(QMqttClient::ClientOnly) << 2 << 0;
+    QTest::newRow("subscriptions") << int(QMqttClient::SubscriptionsOnly) << 0 << 2;
+}
+
+void Tst_QMqttConnection::messageDispatch()
+{
+    QFETCH(int, messageDispatch);
+    QFETCH(int, clientCount);
+    QFETCH(int, subscriptionCount);
+
+    FakeTransport transport;
+    QMqttClient client;
+    client.setMessageDispatch(QMqttClient::MessageDispatch(messageDispatch));
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto sub = client.subscribe(QLatin1String("a/+"), 1);
+    QVERIFY(sub);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x01", 5));
+
+    int clientReceived = 0;
+    int subscriptionReceived = 0;
+    client.setMessageHandler([&clientReceived](const QMqttMessage &) { clientReceived++; });
+    connect(&client, &QMqttClient::messageReceived, [&clientReceived]() { clientReceived++; });
+    sub->setMessageHandler([&subscriptionReceived](const QMqttMessage &) { subscriptionReceived++; });
+    connect(sub.data(), &QMqttSubscription::messageReceived, [&subscriptionReceived]() { subscriptionReceived++; });
+
+    transport.resetCounters();
+    transport.receive(QByteArray("\x32\x08\x00\x03" "a/b" "\x00\x07" "x", 10));
+    QCOMPARE(clientReceived, clientCount);
+    QCOMPARE(subscriptionReceived, subscriptionCount);
+    // Acknowledged either way
+    QCOMPARE(transport.writeCount(), 1);
+}
+
+void Tst_QMqttConnection::messageBatches()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto sub = client.subscribe(QLatin1String("a/+"), 0);
+    QVERIFY(sub);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x00", 5));
+
+    QVector<QVector<QMqttMessage>> batches;
+    connect(sub.data(), &QMqttSubscription::messagesReceived,
+            [&batches](const QVector<QMqttMessage> &messages) { batches.append(messages); });
+    QSignalSpy messageSpy(sub.data(), &QMqttSubscription::messageReceived);
+    sub->setBatchSize(3);
+
+    // Full batches are delivered right away, the rest once the data is processed
+    QByteArray data;
+    for (char c = '0'; c < '5'; ++c)
+        data.append(QByteArray("\x30\x06\x00\x03" "a/b", 7) + c);
+    transport.receive(data);
+    QCOMPARE(batches.size(), 2);
+    QCOMPARE(batches.at(0).size(), 3);
+    QCOMPARE(batches.at(1).size(), 2);
+    QCOMPARE(batches.at(0).at(0).payload(), QByteArray("0"));
+    QCOMPARE(batches.at(1).at(1).payload(), QByteArray("4"));
+    QCOMPARE(messageSpy.count(), 0);
+
+    // Collected across reads within the interval
+    batches.clear();
+    sub->setBatchInterval(50);
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/b" "5", 8));
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/c" "6", 8));
+    QCOMPARE(batches.size(), 0);
+    QTRY_COMPARE(batches.size(), 1);
+    QCOMPARE(batches.at(0).size(), 2);
+    QCOMPARE(batches.at(0).at(1).topic(), QLatin1String("a/c"));
+
+    // Disabling batching delivers the pending messages
+    batches.clear();
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/b" "7", 8));
+    sub->setBatchSize(0);
+    QCOMPARE(batches.size(), 1);
+    transport.receive(QByteArray("\x30\x06\x00\x03" "a/b" "8", 8));
+    QCOMPARE(messageSpy.count(), 1);
+}
+
+void Tst_QMqttConnection::messageSharing()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto first = client.subscribe(QLatin1String("a/+"), 0);
+    const auto second = client.subscribe(QLatin1String("a/b"), 0);
+    QVERIFY(first && second);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x00" "\x90\x03\x00\x02\x00", 10));
+
+    QVector<QMqttMessage> messages;
+    for (const auto &sub : {first, second}) {
+        connect(sub.data(), &QMqttSubscription::messageReceived,
+                [&messages](QMqttMessage msg) { messages.append(std::move(msg)); });
+    }
+    // Queued connections need the metatype
+    QVector<QMqttMessage> queued;
+    QObject context;
+    connect(first.data(), &QMqttSubscription::messageReceived, &context,
+            [&queued](const QMqttMessage &msg) { queued.append(msg); }, Qt::QueuedConnection);
+
+    transport.receive(QByteArray("\x30\x08\x00\x03" "a/b" "xyz", 10));
+    QCOMPARE(messages.size(), 2);
+    // Both subscriptions share the same payload
+    QCOMPARE(messages.at(0).payload().constData(), messages.at(1).payload().constData());
+    QCOMPARE(messages.at(1).topic(), QLatin1String("a/b"));
+    QTRY_COMPARE(queued.size(), 1);
+    QCOMPARE(queued.at(0).payload(), QByteArray("xyz"));
+
+    // A moved-from message is empty
+    QMqttMessage moved(std::move(messages[0]));
+    QCOMPARE(moved.payload(), QByteArray("xyz"));
+    QVERIFY(messages.at(0).payload().isNull());
+    QVERIFY(messages.at(0).topic().isNull());
+
+    const QVariant variant = QVariant::fromValue(moved);
+    QCOMPARE(variant.value<QMqttMessage>().payload(), QByteArray("xyz"));
+
+    const QMqttMessage empty;
+    QCOMPARE(empty.qos(), quint8(0));
+    QVERIFY(!empty.retain());
+}
+
+void Tst_QMqttConnection::messageTopicUtf8()
+{
+    FakeTransport transport;
+    QMqttClient client;
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto sub = client.subscribe(QLatin1String("#"), 0);
+    QVERIFY(sub);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x00", 5));
+
+    QVector<QMqttMessage> messages;
+    connect(sub.data(), &QMqttSubscription::messageReceived,
+            [&messages](const QMqttMessage &msg) { messages.append(msg); });
+
+    // Topic "ä/b" encoded in UTF-8
+    transport.receive(QByteArray("\x30\x07\x00\x04\xc3\xa4/bx", 9));
+    QCOMPARE(messages.size(), 1);
+    QCOMPARE(messages.at(0).topicUtf8(), QByteArray("\xc3\xa4/b"));
+    QCOMPARE(messages.at(0).topic(), QString(QChar(0xe4)) + QLatin1String("/b"));
+    // Decoded once, later calls return the same string
+    QCOMPARE(messages.at(0).topic().constData(), messages.at(0).topic().constData());
+
+    // Threads sharing a message all get the same decoded topic
+    transport.receive(QByteArray("\x30\x07\x00\x04\xc3\xa4/cx", 9));
+    QCOMPARE(messages.size(), 2);
+    const QMqttMessage shared = messages.at(1);
+    std::vector<const QChar *> decoded(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < decoded.size(); ++i)
+        threads.emplace_back([&decoded, shared, i]() { decoded[i] = shared.topic().constData(); });
+    for (auto &thread : threads)
+        thread.join();
+    for (const QChar *data : decoded)
+        QCOMPARE(data, shared.topic().constData());
+    QCOMPARE(shared.topic(), QString(QChar(0xe4)) + QLatin1String("/c"));
+
+    const QMqttMessage empty;
+    QVERIFY(empty.topicUtf8().isNull());
+    QVERIFY(empty.topic().isNull());
+}
+
+QTEST_MAIN(Tst_QMqttConnection)
+
+#include "tst_qmqttconnection.moc"
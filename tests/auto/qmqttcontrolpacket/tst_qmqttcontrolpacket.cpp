@@ -34,7 +34,12 @@ private Q_SLOTS:
     void initTestCase();
     void cleanupTestCase();
     void header();
+    void dup_data();
+    void dup();
     void append();
+    void serialize_data();
+    void serialize();
+    void maximumSize();
     void simple_data();
     void simple();
 };
@@ -76,6 +81,42 @@ void Tst_QMqttControlPacket::header()
 #endif
 }
 
+void Tst_QMqttControlPacket::dup_data()
+{
+    QTest::addColumn<quint8>("header");
+
+    QTest::newRow("qos1") << quint8(0x32);
+    QTest::newRow("qos2") << quint8(0x34);
+    QTest::newRow("qos1 retain") << quint8(0x33);
+}
+
+void Tst_QMqttControlPacket::dup()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(quint8, header);
+
+    QMqttControlPacket packet(header);
+    packet.append(QByteArray("a/b"));
+    packet.append(quint16(42));
+    QVERIFY(!packet.isDup());
+
+    // Only the DUP flag changes, QoS and retain are kept
+    packet.setDup(true);
+    QVERIFY(packet.isDup());
+    QCOMPARE(packet.header(), quint8(header | 0x08));
+    QCOMPARE(quint8(packet.serialize().at(0)), quint8(header | 0x08));
+
+    packet.setDup(true);
+    QCOMPARE(packet.header(), quint8(header | 0x08));
+
+    packet.setDup(false);
+    QVERIFY(!packet.isDup());
+    QCOMPARE(packet.header(), header);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
 void Tst_QMqttControlPacket::append()
 {
 #ifdef QT_BUILD_INTERNAL
@@ -121,6 +162,102 @@ void Tst_QMqttControlPacket::append()
 #endif
 }
 
+void Tst_QMqttControlPacket::serialize_data()
+{
+    QTest::addColumn<int>("payloadSize");
+    QTest::addColumn<int>("lengthBytes");
+
+    QTest::newRow("empty") << 0 << 1;
+    QTest::newRow("127") << 127 - 7 << 1;
+    QTest::newRow("128") << 128 - 7 << 2;
+    QTest::newRow("16383") << 16383 - 7 << 2;
+    QTest::newRow("16384") << 16384 - 7 << 3;
+    QTest::newRow("2097152") << 2097152 - 7 << 4;
+}
+
+void Tst_QMqttControlPacket::serialize()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, payloadSize);
+    QFETCH(int, lengthBytes);
+
+    // Binary payload, including NUL bytes
+    QByteArray message(payloadSize, '\0');
+    for (int i = 0; i < payloadSize; i += 3)
+        message[i] = char(i);
+
+    QMqttControlPacket packet(QMqttControlPacket::PUBLISH | 0x02);
+    packet.append(QByteArray("a/b"));
+    packet.append(quint16(42));
+    packet.appendRaw(message);
+    QCOMPARE(packet.payload().size(), 7 + payloadSize);
+
+    const QByteArray frame = packet.serialize();
+    QCOMPARE(frame.size(), packet.serializedSize());
+    QCOMPARE(frame.size(), 1 + lengthBytes + 7 + payloadSize);
+    QCOMPARE(quint8(frame.at(0)), quint8(0x32));
+
+    quint32 remainingLength = 0;
+    for (int i = 0; i < lengthBytes; ++i)
+        remainingLength |= quint32(quint8(frame.at(1 + i)) & 127) << (7 * i);
+    QCOMPARE(remainingLength, quint32(7 + payloadSize));
+    QCOMPARE(frame.mid(1 + lengthBytes, 7), QByteArray("\x00\x03" "a/b" "\x00\x2A", 7));
+    QCOMPARE(frame.mid(1 + lengthBytes + 7), message);
+
+    // Header and payload written as separate segments form the same frame
+    QCOMPARE(packet.serializeHeader(), frame.left(1 + lengthBytes + 7));
+    QCOMPARE(packet.rawPayload().constData(), message.constData());
+    QCOMPARE(packet.serializeHeader() + packet.rawPayload(), frame);
+
+    // Data appended after raw data keeps its position
+    packet.append('x');
+    QCOMPARE(packet.payload().right(1), QByteArray("x"));
+    QCOMPARE(packet.serialize().right(payloadSize + 1), message + 'x');
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttControlPacket::maximumSize()
+{
+#ifdef QT_BUILD_INTERNAL
+    const int maximum = int(QMqttControlPacket::maximumRemainingLength);
+    // The payloads are never touched, no memory is committed for them
+    {
+        QMqttControlPacket packet(QMqttControlPacket::PUBLISH | 0x02);
+        packet.append(QByteArray("a/b"));
+        packet.append(quint16(42));
+        packet.appendRaw(QByteArray(maximum - 7, Qt::Uninitialized));
+        QCOMPARE(packet.remainingLength(), QMqttControlPacket::maximumRemainingLength);
+        QVERIFY(!packet.exceedsMaximumSize());
+        QCOMPARE(packet.serializedSize(), 1 + 4 + maximum);
+        QCOMPARE(packet.serializeHeader(), QByteArray("\x32\xff\xff\xff\x7f" "\x00\x03" "a/b" "\x00\x2A", 12));
+    }
+    {
+        QMqttControlPacket packet(QMqttControlPacket::PUBLISH | 0x02);
+        packet.append(QByteArray("a/b"));
+        packet.append(quint16(42));
+        packet.appendRaw(QByteArray(maximum - 6, Qt::Uninitialized));
+        QCOMPARE(packet.remainingLength(), QMqttControlPacket::maximumRemainingLength + 1);
+
+        // Would need a fifth length byte, nothing is written
+        const char *warning = "Publishing a message bigger than maximum size!";
+        QTest::ignoreMessage(QtWarningMsg, warning);
+        QVERIFY(packet.exceedsMaximumSize());
+        QTest::ignoreMessage(QtWarningMsg, warning);
+        QVERIFY(packet.serialize().isEmpty());
+        QTest::ignoreMessage(QtWarningMsg, warning);
+        QVERIFY(packet.serializeHeader().isEmpty());
+        QByteArray buffer("abc");
+        QTest::ignoreMessage(QtWarningMsg, warning);
+        QVERIFY(!packet.serializeInto(&buffer));
+        QCOMPARE(buffer, QByteArray("abc"));
+    }
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
 void Tst_QMqttControlPacket::simple_data()
 {
     QTest::addColumn<QString>("data");
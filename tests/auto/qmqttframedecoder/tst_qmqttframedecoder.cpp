@@ -0,0 +1,380 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttframedecoder_p.h>
+
+static QByteArray createBody(int length)
+{
+    QByteArray body;
+    for (int i = 0; i < length; ++i)
+        body.append(char('a' + i % 26));
+    return body;
+}
+
+static QByteArray createFrame(quint8 header, const QByteArray &body)
+{
+    QByteArray frame;
+    frame.append(char(header));
+    quint32 remaining = body.size();
+    do {
+        quint8 b = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0)
+            b |= 0x80;
+        frame.append(char(b));
+    } while (remaining > 0);
+    frame.append(body);
+    return frame;
+}
+
+static QByteArray createFrame(quint8 header, int length)
+{
+    return createFrame(header, createBody(length));
+}
+
+static QByteArray createPublish(quint8 qos, const QByteArray &topic, quint16 id, int payloadLength)
+{
+    QByteArray body;
+    body.append(char(topic.size() >> 8));
+    body.append(char(topic.size() & 0xFF));
+    body.append(topic);
+    if (qos > 0) {
+        body.append(char(id >> 8));
+        body.append(char(id & 0xFF));
+    }
+    body.append(createBody(payloadLength));
+    return createFrame(quint8(0x30 | (qos << 1)), body);
+}
+
+class ChunkedDevice : public QIODevice
+{
+public:
+    ChunkedDevice(const QByteArray &data, int chunkSize)
+        : m_data(data), m_chunkSize(chunkSize)
+    {
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override
+    {
+        return qMin<qint64>(m_available, m_data.size() - m_pos);
+    }
+    // Simulates the arrival of the next chunk on a socket
+    void receiveChunk() { m_available += m_chunkSize; }
+    bool atEnd() const override { return m_pos == m_data.size(); }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const qint64 size = qMin(maxSize, qMin<qint64>(m_available, m_data.size() - m_pos));
+        memcpy(data, m_data.constData() + m_pos, size);
+        m_pos += size;
+        m_available -= size;
+        return size;
+    }
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    QByteArray m_data;
+    qint64 m_pos{0};
+    qint64 m_available{0};
+    int m_chunkSize;
+};
+
+class Tst_QMqttFrameDecoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttFrameDecoder();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void splitPoints_data();
+    void splitPoints();
+    void partialRead();
+    void invalidLength();
+    void publish_data();
+    void publish();
+    void publishDirectRead();
+    void publishAnnouncedLength();
+    void publishStream();
+};
+
+Tst_QMqttFrameDecoder::Tst_QMqttFrameDecoder()
+{
+}
+
+void Tst_QMqttFrameDecoder::initTestCase()
+{
+}
+
+void Tst_QMqttFrameDecoder::cleanupTestCase()
+{
+}
+
+void Tst_QMqttFrameDecoder::splitPoints_data()
+{
+    QTest::addColumn<int>("chunkSize");
+    // Covers splits inside the fixed header, every byte of a multi byte
+    // remaining length and inside the frame body.
+    for (int i = 1; i <= 20; ++i)
+        QTest::newRow(qPrintable(QString::number(i))) << i;
+    QTest::newRow("mtu") << 1460;
+    QTest::newRow("all") << 0;
+}
+
+void Tst_QMqttFrameDecoder::splitPoints()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, chunkSize);
+
+    QVector<QPair<quint8, int>> frames;
+    frames << qMakePair(quint8(0x20), 2)        // CONNACK
+           << qMakePair(quint8(0xD0), 0)        // PINGRESP
+           << qMakePair(quint8(0x90), 200)      // 2 byte remaining length
+           << qMakePair(quint8(0x40), 2)        // PUBACK
+           << qMakePair(quint8(0x90), 20000)    // 3 byte remaining length
+           << qMakePair(quint8(0x90), 3);       // SUBACK
+
+    QByteArray stream;
+    for (const auto &f : qAsConst(frames))
+        stream.append(createFrame(f.first, f.second));
+
+    QMqttFrameDecoder decoder;
+    int received = 0;
+    if (chunkSize == 0)
+        chunkSize = stream.size();
+    for (int pos = 0; pos < stream.size(); pos += chunkSize) {
+        decoder.append(stream.mid(pos, chunkSize));
+        while (decoder.nextFrame()) {
+            QVERIFY(received < frames.size());
+            QCOMPARE(decoder.header(), frames.at(received).first);
+            QCOMPARE(int(decoder.remainingLength()), frames.at(received).second);
+            QVERIFY(decoder.buffer().size() >= frames.at(received).second);
+            received++;
+        }
+        QVERIFY(!decoder.hasError());
+    }
+    QCOMPARE(received, frames.size());
+    QVERIFY(decoder.buffer().isEmpty());
+    QCOMPARE(decoder.state(), QMqttFrameDecoder::FixedHeader);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttFrameDecoder::partialRead()
+{
+#ifdef QT_BUILD_INTERNAL
+    QMqttFrameDecoder decoder;
+    decoder.append(createFrame(0x90, 10) + createFrame(0x40, 2));
+
+    QVERIFY(decoder.nextFrame());
+    QCOMPARE(decoder.buffer().read(3), QByteArray("abc"));
+
+    // Unread bytes of the previous frame are skipped
+    QVERIFY(decoder.nextFrame());
+    QCOMPARE(decoder.header(), quint8(0x40));
+    QCOMPARE(decoder.buffer().read(2), QByteArray("ab"));
+    QVERIFY(!decoder.nextFrame());
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttFrameDecoder::invalidLength()
+{
+#ifdef QT_BUILD_INTERNAL
+    QMqttFrameDecoder decoder;
+    decoder.append(QByteArray("\x30\xFF\xFF\xFF\xFF\x01", 6));
+    QVERIFY(!decoder.nextFrame());
+    QVERIFY(decoder.hasError());
+
+    decoder.clear();
+    QVERIFY(!decoder.hasError());
+    decoder.append(createFrame(0xD0, 0));
+    QVERIFY(decoder.nextFrame());
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttFrameDecoder::publish_data()
+{
+    QTest::addColumn<int>("qos");
+    QTest::addColumn<int>("payloadLength");
+    QTest::addColumn<int>("chunkSize");
+
+    const int chunkSizes[] = {1, 3, 7, 1460, 0};
+    for (int chunkSize : chunkSizes) {
+        for (int qos = 0; qos < 3; ++qos) {
+            QTest::newRow(qPrintable(QString::fromLatin1("empty/%1/%2").arg(qos).arg(chunkSize)))
+                    << qos << 0 << chunkSize;
+            QTest::newRow(qPrintable(QString::fromLatin1("big/%1/%2").arg(qos).arg(chunkSize)))
+                    << qos << 20000 << chunkSize;
+        }
+    }
+}
+
+void Tst_QMqttFrameDecoder::publish()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, qos);
+    QFETCH(int, payloadLength);
+    QFETCH(int, chunkSize);
+
+    const QByteArray topic("some/topic");
+    const QByteArray stream = createPublish(quint8(qos), topic, 42, payloadLength)
+            + createFrame(0xD0, 0)
+            + createPublish(quint8(qos), topic, 43, 5);
+
+    QMqttFrameDecoder decoder;
+    int received = 0;
+    if (chunkSize == 0)
+        chunkSize = stream.size();
+    for (int pos = 0; pos < stream.size(); pos += chunkSize) {
+        decoder.append(stream.mid(pos, chunkSize));
+        while (decoder.nextFrame()) {
+            if (decoder.state() == QMqttFrameDecoder::PublishHeader)
+                continue;
+            if (received == 1) {
+                QCOMPARE(decoder.header(), quint8(0xD0));
+            } else {
+                QCOMPARE(decoder.header() & 0xF0, 0x30);
+                QCOMPARE(decoder.publishTopic(), topic);
+                QCOMPARE(int(decoder.publishId()), qos > 0 ? 42 + received / 2 : 0);
+                QCOMPARE(decoder.publishPayload(), createBody(received == 0 ? payloadLength : 5));
+            }
+            received++;
+        }
+        QVERIFY(!decoder.hasError());
+    }
+    QCOMPARE(received, 3);
+    QVERIFY(decoder.buffer().isEmpty());
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttFrameDecoder::publishDirectRead()
+{
+#ifdef QT_BUILD_INTERNAL
+    const int payloadLength = 4 * 1024 * 1024;
+    const int chunkSize = 16 * 1024;
+    ChunkedDevice device(createPublish(1, "camera/frame", 1, payloadLength), chunkSize);
+
+    QMqttFrameDecoder decoder;
+    int received = 0;
+    while (!device.atEnd()) {
+        device.receiveChunk();
+        decoder.readFrom(&device);
+        while (decoder.nextFrame()) {
+            if (decoder.state() != QMqttFrameDecoder::PublishPayload)
+                continue;
+            QCOMPARE(decoder.publishPayload().size(), payloadLength);
+            QCOMPARE(decoder.publishPayload(), createBody(payloadLength));
+            received++;
+        }
+    }
+    QCOMPARE(received, 1);
+    // Only the payload bytes of the first chunk are copied out of the read buffer
+    QVERIFY(decoder.copiedPayloadBytes() < quint64(chunkSize));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttFrameDecoder::publishAnnouncedLength()
+{
+#ifdef QT_BUILD_INTERNAL
+    // The largest payload possible is announced, but never sent
+    QMqttFrameDecoder decoder;
+    decoder.append(QByteArray("\x30\xFF\xFF\xFF\x7F\x00\x01" "a" "xyz", 11));
+    QVERIFY(decoder.nextFrame());
+    QCOMPARE(decoder.state(), QMqttFrameDecoder::PublishHeader);
+    QCOMPARE(decoder.publishPayloadLength(), 268435455 - 3);
+
+    // Only memory for the data which might arrive next is reserved
+    QVERIFY(!decoder.nextFrame());
+    QCOMPARE(decoder.state(), QMqttFrameDecoder::PublishPayload);
+    QCOMPARE(decoder.publishPayloadRemaining(), 268435455 - 6);
+    QVERIFY(decoder.publishPayload().size() <= 64 * 1024 + 3);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttFrameDecoder::publishStream()
+{
+#ifdef QT_BUILD_INTERNAL
+    const int payloadLength = 1024 * 1024;
+    const int chunkSize = 16 * 1024;
+    ChunkedDevice device(createPublish(2, "firmware/blob", 7, payloadLength)
+                         + createPublish(0, "small", 0, 0)
+                         + createFrame(0xD0, 0), chunkSize);
+
+    QMqttFrameDecoder decoder;
+    QByteArray streamed;
+    int chunks = 0;
+    int finished = 0;
+    while (!device.atEnd()) {
+        device.receiveChunk();
+        decoder.readFrom(&device);
+        while (decoder.nextFrame()) {
+            switch (decoder.state()) {
+            case QMqttFrameDecoder::PublishHeader:
+                QCOMPARE(decoder.publishPayload(), QByteArray());
+                decoder.setStreamPayload(true);
+                break;
+            case QMqttFrameDecoder::PublishStream:
+                QVERIFY(decoder.publishPayload().size() <= chunkSize);
+                streamed.append(decoder.publishPayload());
+                chunks++;
+                if (decoder.publishPayloadRemaining() == 0)
+                    finished++;
+                break;
+            case QMqttFrameDecoder::PublishPayload:
+                QFAIL("Payload has not been streamed");
+                break;
+            default:
+                QCOMPARE(decoder.header(), quint8(0xD0));
+                break;
+            }
+        }
+    }
+    // The empty payload is reported as one empty chunk
+    QCOMPARE(finished, 2);
+    QVERIFY(chunks > payloadLength / chunkSize);
+    QCOMPARE(streamed, createBody(payloadLength));
+    QCOMPARE(decoder.copiedPayloadBytes(), quint64(0));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttFrameDecoder)
+
+#include "tst_qmqttframedecoder.moc"
@@ -0,0 +1,246 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QDir>
+#include <QtCore/QString>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttofflinequeue_p.h>
+
+static QMqttTopicName topic(int index)
+{
+    return QMqttTopicName(QString::fromLatin1("sensors/%1").arg(index));
+}
+
+static QByteArray message(int index)
+{
+    return QByteArray::number(index).rightJustified(16, '0');
+}
+
+class Tst_QMqttOfflineQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttOfflineQueue();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void memory();
+    void conflation();
+    void expiry();
+    void spill();
+    void recover();
+};
+
+Tst_QMqttOfflineQueue::Tst_QMqttOfflineQueue()
+{
+}
+
+void Tst_QMqttOfflineQueue::initTestCase()
+{
+}
+
+void Tst_QMqttOfflineQueue::cleanupTestCase()
+{
+}
+
+void Tst_QMqttOfflineQueue::memory()
+{
+#ifdef QT_BUILD_INTERNAL
+    QMqttOfflineQueue queue;
+    QVERIFY(!queue.isEnabled());
+    QVERIFY(!queue.enqueue(topic(0), message(0), 0, false));
+
+    // Topic and message take 25 bytes
+    queue.setMemoryLimit(100);
+    for (int i = 0; i < 4; ++i)
+        QVERIFY(queue.enqueue(topic(i), message(i), quint8(i % 3), i == 1));
+    QVERIFY(!queue.enqueue(topic(4), message(4), 0, false));
+    QCOMPARE(queue.depth(), 4);
+    QCOMPARE(queue.bytes(), qint64(100));
+
+    QMqttOfflineQueue::Message entry;
+    for (int i = 0; i < 4; ++i) {
+        QVERIFY(queue.dequeue(&entry));
+        QCOMPARE(entry.topic, topic(i));
+        QCOMPARE(entry.message, message(i));
+        QCOMPARE(entry.qos, quint8(i % 3));
+        QCOMPARE(entry.retain, i == 1);
+    }
+    QVERIFY(!queue.dequeue(&entry));
+    QVERIFY(queue.isEmpty());
+    QCOMPARE(queue.bytes(), qint64(0));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttOfflineQueue::conflation()
+{
+#ifdef QT_BUILD_INTERNAL
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QMqttOfflineQueue queue;
+    queue.setMemoryLimit(50);
+    QVERIFY(queue.setDirectory(dir.path()));
+    queue.setConflation("sensors/+", true);
+
+    // Replaced in memory, in the log and across both
+    for (int i = 0; i < 10; ++i)
+        QVERIFY(queue.enqueue(topic(i % 2), message(i), 1, false));
+    QVERIFY(queue.enqueue(QMqttTopicName(QLatin1String("other")), message(10), 1, false));
+    QCOMPARE(queue.depth(), 3);
+    QCOMPARE(queue.discarded(), 8);
+
+    QMqttOfflineQueue::Message entry;
+    QVERIFY(queue.dequeue(&entry));
+    QCOMPARE(entry.message, message(8));
+    QVERIFY(queue.dequeue(&entry));
+    QCOMPARE(entry.message, message(9));
+    QVERIFY(queue.dequeue(&entry));
+    QCOMPARE(entry.message, message(10));
+    QVERIFY(!queue.dequeue(&entry));
+    QCOMPARE(queue.depth(), 0);
+    QCOMPARE(queue.diskBytes(), qint64(0));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttOfflineQueue::expiry()
+{
+#ifdef QT_BUILD_INTERNAL
+    QMqttOfflineQueue queue;
+    queue.setMemoryLimit(1000);
+    queue.setExpiry("sensors/#", 50);
+    queue.setExpiry("sensors/1", 10000);
+
+    QVERIFY(queue.enqueue(topic(0), message(0), 0, false));
+    QVERIFY(queue.enqueue(topic(1), message(1), 0, false));
+    QVERIFY(queue.enqueue(QMqttTopicName(QLatin1String("other")), message(2), 0, false));
+    QTest::qWait(100);
+
+    // The shortest expiry applies
+    QMqttOfflineQueue::Message entry;
+    QVERIFY(queue.dequeue(&entry));
+    QCOMPARE(entry.message, message(2));
+    QVERIFY(!queue.dequeue(&entry));
+    QCOMPARE(queue.discarded(), 2);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+// Messages beyond the memory limit go to segment files, order is kept
+void Tst_QMqttOfflineQueue::spill()
+{
+#ifdef QT_BUILD_INTERNAL
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QMqttOfflineQueue queue;
+    queue.setMemoryLimit(250);
+    queue.setSegmentSize(1000);
+    queue.setDiskLimit(5000);
+    QVERIFY(queue.setDirectory(dir.path()));
+
+    // Ten messages fit into memory
+    int count = 0;
+    for (; count < 60; ++count)
+        QVERIFY(queue.enqueue(topic(count), message(count), 1, false));
+    QCOMPARE(queue.depth(), count);
+    QCOMPARE(queue.memoryBytes(), qint64(250));
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files).size() > 1);
+
+    // Draining the memory part does not move messages back into it
+    QMqttOfflineQueue::Message entry;
+    for (int i = 0; i < 5; ++i) {
+        QVERIFY(queue.dequeue(&entry));
+        QCOMPARE(entry.message, message(i));
+    }
+    while (queue.enqueue(topic(count), message(count), 1, false))
+        ++count;
+    QCOMPARE(queue.memoryBytes(), qint64(125));
+    QVERIFY(queue.diskBytes() <= 5000);
+    QVERIFY(queue.diskBytes() > 4900);
+
+    for (int i = 5; i < count; ++i) {
+        QVERIFY(queue.dequeue(&entry));
+        QCOMPARE(entry.topic, topic(i));
+        QCOMPARE(entry.message, message(i));
+    }
+    QVERIFY(!queue.dequeue(&entry));
+    QCOMPARE(queue.diskBytes(), qint64(0));
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files).isEmpty());
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+// The log of a previous run is picked up
+void Tst_QMqttOfflineQueue::recover()
+{
+#ifdef QT_BUILD_INTERNAL
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    {
+        QMqttOfflineQueue queue;
+        queue.setSegmentSize(200);
+        QVERIFY(queue.setDirectory(dir.path()));
+        queue.setConflation("sensors/0", true);
+        for (int i = 0; i < 20; ++i)
+            QVERIFY(queue.enqueue(topic(i % 5), message(i), 1, false));
+        QCOMPARE(queue.depth(), 17);
+    }
+
+    // A record written partially is dropped
+    const QStringList segments = QDir(dir.path()).entryList(QDir::Files, QDir::Name);
+    QFile last(dir.filePath(segments.last()));
+    QVERIFY(last.open(QIODevice::Append));
+    QVERIFY(last.write("\0\0\0", 3) == 3);
+    last.close();
+
+    QMqttOfflineQueue queue;
+    queue.setSegmentSize(200);
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression(QLatin1String("is truncated")));
+    QVERIFY(queue.setDirectory(dir.path()));
+    QCOMPARE(queue.depth(), 17);
+    QVERIFY(queue.enqueue(topic(1), message(20), 1, false));
+
+    QVector<QByteArray> messages;
+    QMqttOfflineQueue::Message entry;
+    while (queue.dequeue(&entry))
+        messages.append(entry.message);
+    QCOMPARE(messages.size(), 18);
+    QCOMPARE(messages.first(), message(1));
+    QCOMPARE(messages.at(3), message(4));
+    QCOMPARE(messages.last(), message(20));
+    QVERIFY(!messages.contains(message(10)));
+    QVERIFY(messages.contains(message(15)));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+QTEST_MAIN(Tst_QMqttOfflineQueue)
+
+#include "tst_qmqttofflinequeue.moc"
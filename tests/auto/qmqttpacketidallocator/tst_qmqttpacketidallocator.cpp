@@ -0,0 +1,160 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttpacketidallocator_p.h>
+
+#include <memory>
+
+class Tst_QMqttPacketIdAllocator : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttPacketIdAllocator();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void allocateAll();
+    void release();
+    void roundRobin();
+    void churn();
+};
+
+Tst_QMqttPacketIdAllocator::Tst_QMqttPacketIdAllocator()
+{
+}
+
+void Tst_QMqttPacketIdAllocator::initTestCase()
+{
+}
+
+void Tst_QMqttPacketIdAllocator::cleanupTestCase()
+{
+}
+
+void Tst_QMqttPacketIdAllocator::allocateAll()
+{
+#ifdef QT_BUILD_INTERNAL
+    std::unique_ptr<QMqttPacketIdAllocator> allocator(new QMqttPacketIdAllocator);
+    QSet<quint16> ids;
+    ids.reserve(QMqttPacketIdAllocator::MaximumId);
+    for (int i = 0; i < QMqttPacketIdAllocator::MaximumId; ++i) {
+        const quint16 id = allocator->allocate();
+        QVERIFY(id != 0);
+        QVERIFY(!ids.contains(id));
+        ids.insert(id);
+    }
+    QVERIFY(allocator->isFull());
+    QCOMPARE(allocator->allocatedCount(), int(QMqttPacketIdAllocator::MaximumId));
+    // Exhausted
+    QCOMPARE(allocator->allocate(), quint16(0));
+
+    allocator->clear();
+    QCOMPARE(allocator->allocatedCount(), 0);
+    QCOMPARE(allocator->allocate(), quint16(1));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttPacketIdAllocator::release()
+{
+#ifdef QT_BUILD_INTERNAL
+    std::unique_ptr<QMqttPacketIdAllocator> allocator(new QMqttPacketIdAllocator);
+    const quint16 id = allocator->allocate();
+    QVERIFY(allocator->isAllocated(id));
+    QVERIFY(allocator->release(id));
+    QVERIFY(!allocator->isAllocated(id));
+    // Double release and the reserved identifier
+    QVERIFY(!allocator->release(id));
+    QVERIFY(!allocator->release(0));
+    QVERIFY(!allocator->release(4711));
+    QCOMPARE(allocator->allocatedCount(), 0);
+
+    // A released identifier is handed out once all others are in use
+    while (!allocator->isFull())
+        allocator->allocate();
+    QVERIFY(allocator->release(32768));
+    QCOMPARE(allocator->allocate(), quint16(32768));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttPacketIdAllocator::roundRobin()
+{
+#ifdef QT_BUILD_INTERNAL
+    std::unique_ptr<QMqttPacketIdAllocator> allocator(new QMqttPacketIdAllocator);
+    QCOMPARE(allocator->allocate(), quint16(1));
+    QCOMPARE(allocator->allocate(), quint16(2));
+    QVERIFY(allocator->release(1));
+    QVERIFY(allocator->release(2));
+    QCOMPARE(allocator->allocate(), quint16(3));
+
+    // Wraps around and skips identifiers still in use
+    for (int id = 4; id <= 65535; ++id)
+        QCOMPARE(allocator->allocate(), quint16(id));
+    QCOMPARE(allocator->allocate(), quint16(1));
+    QCOMPARE(allocator->allocate(), quint16(2));
+    QCOMPARE(allocator->allocate(), quint16(0));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+// Keeps up to 60000 identifiers in flight while releasing random ones
+void Tst_QMqttPacketIdAllocator::churn()
+{
+#ifdef QT_BUILD_INTERNAL
+    std::unique_ptr<QMqttPacketIdAllocator> allocator(new QMqttPacketIdAllocator);
+    QVector<quint16> inFlight;
+    QVector<bool> used(65536, false);
+    qsrand(42);
+
+    for (int round = 0; round < 500000; ++round) {
+        if (inFlight.size() < 60000 && qrand() % 3) {
+            const quint16 id = allocator->allocate();
+            QVERIFY(id != 0);
+            QVERIFY(!used.at(id));
+            used[id] = true;
+            inFlight.append(id);
+        } else if (!inFlight.isEmpty()) {
+            const int index = qrand() % inFlight.size();
+            const quint16 id = inFlight.at(index);
+            inFlight[index] = inFlight.last();
+            inFlight.removeLast();
+            QVERIFY(allocator->release(id));
+            used[id] = false;
+        }
+    }
+    QCOMPARE(allocator->allocatedCount(), inFlight.size());
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttPacketIdAllocator)
+
+#include "tst_qmqttpacketidallocator.moc"
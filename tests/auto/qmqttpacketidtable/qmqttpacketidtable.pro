@@ -0,0 +1,9 @@
+CONFIG += testcase
+QT       += testlib mqtt
+QT       -= gui
+QT_PRIVATE += mqtt-private
+
+TARGET = tst_qmqttpacketidtable
+
+SOURCES += \
+    tst_qmqttpacketidtable.cpp
@@ -0,0 +1,126 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttpacketidtable_p.h>
+
+class Tst_QMqttPacketIdTable : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttPacketIdTable();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void insertTake();
+    void remove();
+    void compareToMap();
+};
+
+Tst_QMqttPacketIdTable::Tst_QMqttPacketIdTable()
+{
+}
+
+void Tst_QMqttPacketIdTable::initTestCase()
+{
+}
+
+void Tst_QMqttPacketIdTable::cleanupTestCase()
+{
+}
+
+void Tst_QMqttPacketIdTable::insertTake()
+{
+    QMqttPacketIdTable<QString> table;
+    QVERIFY(table.isEmpty());
+    QVERIFY(!table.contains(1));
+    QVERIFY(!table.find(1));
+
+    table.insert(1, QLatin1String("one"));
+    table.insert(256, QLatin1String("page"));
+    table.insert(65535, QLatin1String("last"));
+    QCOMPARE(table.size(), 3);
+    QVERIFY(table.contains(65535));
+    QCOMPARE(*table.find(256), QLatin1String("page"));
+
+    // Replacing keeps the size
+    table.insert(1, QLatin1String("first"));
+    QCOMPARE(table.size(), 3);
+    QCOMPARE(table.take(1), QLatin1String("first"));
+    QVERIFY(!table.contains(1));
+    QCOMPARE(table.take(1), QString());
+    QCOMPARE(table.size(), 2);
+
+    table.clear();
+    QVERIFY(table.isEmpty());
+    QVERIFY(!table.contains(256));
+}
+
+void Tst_QMqttPacketIdTable::remove()
+{
+    QMqttPacketIdTable<QString> table;
+    QVERIFY(!table.remove(7));
+    table.insert(7, QLatin1String("seven"));
+    table.insert(8, QLatin1String("eight"));
+    QVERIFY(table.remove(7));
+    QVERIFY(!table.remove(7));
+    QCOMPARE(*table.find(8), QLatin1String("eight"));
+    // Removing the last entry of a page and filling it again
+    QVERIFY(table.remove(8));
+    QVERIFY(table.isEmpty());
+    table.insert(9, QLatin1String("nine"));
+    QCOMPARE(table.take(9), QLatin1String("nine"));
+}
+
+// Random operations must have the same result as on a QMap
+void Tst_QMqttPacketIdTable::compareToMap()
+{
+    QMqttPacketIdTable<int> table;
+    QMap<quint16, int> map;
+    qsrand(42);
+
+    for (int i = 0; i < 200000; ++i) {
+        const quint16 id = quint16(qrand() % 2048);
+        switch (qrand() % 3) {
+        case 0:
+            table.insert(id, i);
+            map.insert(id, i);
+            break;
+        case 1:
+            QCOMPARE(table.remove(id), map.remove(id) > 0);
+            break;
+        default:
+            QCOMPARE(table.take(id), map.take(id));
+            break;
+        }
+        QCOMPARE(table.size(), map.size());
+    }
+    for (auto it = map.cbegin(); it != map.cend(); ++it)
+        QCOMPARE(*table.find(it.key()), it.value());
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttPacketIdTable)
+
+#include "tst_qmqttpacketidtable.moc"
@@ -0,0 +1,249 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QFile>
+#include <QtCore/QString>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttcontrolpacket_p.h>
+#include <QtMqtt/private/qmqttsessionstore_p.h>
+
+static QMqttControlPacket createPublish(quint16 id, int payloadSize)
+{
+    QMqttControlPacket packet(QMqttControlPacket::PUBLISH | 0x02);
+    packet.append(QByteArray("a/b"));
+    packet.append(id);
+    packet.appendRaw(QByteArray(payloadSize, char('a' + id % 26)));
+    return packet;
+}
+
+class Tst_QMqttSessionStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttSessionStore();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void storeRestore();
+    void compaction();
+    void compactionFailure();
+    void truncated();
+    void oversized();
+
+private:
+    QTemporaryDir m_dir;
+};
+
+Tst_QMqttSessionStore::Tst_QMqttSessionStore()
+{
+}
+
+void Tst_QMqttSessionStore::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+}
+
+void Tst_QMqttSessionStore::cleanupTestCase()
+{
+}
+
+void Tst_QMqttSessionStore::storeRestore()
+{
+#ifdef QT_BUILD_INTERNAL
+    const QString fileName = m_dir.filePath(QLatin1String("storeRestore"));
+    {
+        QMqttSessionStore store;
+        QVERIFY(store.open(fileName));
+        QVERIFY(store.outgoing().isEmpty());
+        for (quint16 id = 1; id <= 10; ++id)
+            QVERIFY(store.storePublish(id, createPublish(id, 100)));
+        QVERIFY(store.storeRelease(3));
+        QVERIFY(store.storeComplete(5));
+        QVERIFY(!store.storeComplete(5));
+        QVERIFY(store.storeReceived(7));
+        QVERIFY(store.storeReceived(8));
+        QVERIFY(store.storeIncomingComplete(7));
+    }
+
+    QMqttSessionStore store;
+    QVERIFY(store.open(fileName));
+    const QVector<QMqttSessionStore::Message> outgoing = store.outgoing();
+    QCOMPARE(outgoing.size(), 9);
+    QCOMPARE(outgoing.at(0).id, quint16(1));
+    QCOMPARE(outgoing.at(0).frame, createPublish(1, 100).serialize());
+    QVERIFY(!outgoing.at(0).released);
+    QCOMPARE(outgoing.at(2).id, quint16(3));
+    QVERIFY(outgoing.at(2).released);
+    QCOMPARE(outgoing.at(4).id, quint16(6));
+    QCOMPARE(store.incoming(), QVector<quint16>() << 8);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttSessionStore::compaction()
+{
+#ifdef QT_BUILD_INTERNAL
+    const QString fileName = m_dir.filePath(QLatin1String("compaction"));
+    QMqttSessionStore store;
+    QVERIFY(store.open(fileName));
+    QVERIFY(store.storePublish(1, createPublish(1, 100)));
+    const qint64 initialSize = store.fileSize();
+
+    // Acknowledged messages are dropped instead of growing the file
+    for (int i = 0; i < 2000; ++i) {
+        const quint16 id = quint16(100 + i % 50);
+        QVERIFY(store.storePublish(id, createPublish(id, 500)));
+        QVERIFY(store.storeComplete(id));
+    }
+    QCOMPARE(store.fileSize(), initialSize);
+    QVERIFY(!QFile::exists(fileName + QLatin1String(".compact")));
+
+    // Grows if the messages stay in flight
+    for (quint16 id = 200; id < 400; ++id)
+        QVERIFY(store.storePublish(id, createPublish(id, 1000)));
+    QVERIFY(store.fileSize() > initialSize);
+    QCOMPARE(store.outgoing().size(), 201);
+
+    store.close();
+    QVERIFY(store.open(fileName));
+    const QVector<QMqttSessionStore::Message> outgoing = store.outgoing();
+    QCOMPARE(outgoing.size(), 201);
+    QCOMPARE(outgoing.first().id, quint16(1));
+    QCOMPARE(outgoing.last().id, quint16(399));
+    QCOMPARE(outgoing.last().frame, createPublish(399, 1000).serialize());
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+// The store keeps working if the compacted file cannot replace the old one
+void Tst_QMqttSessionStore::compactionFailure()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(Q_OS_UNIX)
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    struct PermissionsRestorer {
+        ~PermissionsRestorer() { QFile::setPermissions(path, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner); }
+        QString path;
+    } restorer{dir.path()};
+
+    const QString fileName = dir.filePath(QLatin1String("session"));
+    QMqttSessionStore store;
+    QVERIFY(store.open(fileName));
+    QVERIFY(store.storePublish(1, createPublish(1, 100)));
+    const qint64 initialSize = store.fileSize();
+
+    // The compacted file can be written, but the old one cannot be removed
+    QFile compactFile(fileName + QLatin1String(".compact"));
+    QVERIFY(compactFile.open(QIODevice::WriteOnly));
+    compactFile.close();
+    QVERIFY(QFile::setPermissions(dir.path(), QFile::ReadOwner | QFile::ExeOwner));
+    if (QFile(dir.filePath(QLatin1String("probe"))).open(QIODevice::WriteOnly))
+        QSKIP("Directory permissions are not enforced for this user.");
+
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression(QLatin1String("Could not replace session store")));
+    for (int i = 0; store.fileSize() == initialSize && i < 1000; ++i) {
+        const quint16 id = quint16(100 + i % 50);
+        QVERIFY(store.storePublish(id, createPublish(id, 500)));
+        QVERIFY(store.storeComplete(id));
+    }
+    QVERIFY(store.fileSize() > initialSize);
+    QVERIFY(store.isOpen());
+    QVERIFY(store.storePublish(2, createPublish(2, 100)));
+
+    store.close();
+    QVERIFY(store.open(fileName));
+    const QVector<QMqttSessionStore::Message> outgoing = store.outgoing();
+    QCOMPARE(outgoing.size(), 2);
+    QCOMPARE(outgoing.at(0).frame, createPublish(1, 100).serialize());
+    QCOMPARE(outgoing.at(1).frame, createPublish(2, 100).serialize());
+#else
+    QSKIP("This test requires a Qt -developer-build on Unix.");
+#endif
+}
+
+// A record written partially when the process died is dropped
+void Tst_QMqttSessionStore::truncated()
+{
+#ifdef QT_BUILD_INTERNAL
+    const QString fileName = m_dir.filePath(QLatin1String("truncated"));
+    qint64 end = 0;
+    {
+        QMqttSessionStore store;
+        QVERIFY(store.open(fileName));
+        QVERIFY(store.storePublish(1, createPublish(1, 100)));
+        QVERIFY(store.storePublish(2, createPublish(2, 100)));
+        end = store.usedSize();
+    }
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.seek(end - 5));
+    QVERIFY(file.putChar('\x55'));
+    file.close();
+
+    QMqttSessionStore store;
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression(QLatin1String("is truncated")));
+    QVERIFY(store.open(fileName));
+    QCOMPARE(store.outgoing().size(), 1);
+    QCOMPARE(store.outgoing().at(0).id, quint16(1));
+
+    // Appending continues after the last valid record
+    QVERIFY(store.storePublish(3, createPublish(3, 10)));
+    store.close();
+    QVERIFY(store.open(fileName));
+    QCOMPARE(store.outgoing().size(), 2);
+    QCOMPARE(store.outgoing().at(1).id, quint16(3));
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+// A frame too big to be encoded is not written into the mapping
+void Tst_QMqttSessionStore::oversized()
+{
+#ifdef QT_BUILD_INTERNAL
+    const QString fileName = m_dir.filePath(QLatin1String("oversized"));
+    QMqttSessionStore store;
+    QVERIFY(store.open(fileName));
+    QVERIFY(store.storePublish(1, createPublish(1, 100)));
+    const qint64 end = store.usedSize();
+
+    QMqttControlPacket packet(QMqttControlPacket::PUBLISH | 0x02);
+    packet.append(QByteArray("a/b"));
+    packet.append(quint16(2));
+    packet.appendRaw(QByteArray(int(QMqttControlPacket::maximumRemainingLength) - 6, Qt::Uninitialized));
+    QTest::ignoreMessage(QtWarningMsg, "Publishing a message bigger than maximum size!");
+    QVERIFY(!store.storePublish(2, packet));
+    QCOMPARE(store.usedSize(), end);
+    QCOMPARE(store.outgoing().size(), 1);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttSessionStore)
+
+#include "tst_qmqttsessionstore.moc"
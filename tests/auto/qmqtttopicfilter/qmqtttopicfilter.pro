@@ -0,0 +1,8 @@
+CONFIG += testcase
+QT       += testlib mqtt
+QT       -= gui
+
+TARGET = tst_qmqtttopicfilter
+
+SOURCES += \
+    tst_qmqtttopicfilter.cpp
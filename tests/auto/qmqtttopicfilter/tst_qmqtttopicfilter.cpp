@@ -0,0 +1,174 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/QMqttTopicFilter>
+
+class Tst_QMqttTopicFilter : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttTopicFilter();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void getSetCheck();
+    void validity_data();
+    void validity();
+    void match_data();
+    void match();
+    void compare();
+};
+
+Tst_QMqttTopicFilter::Tst_QMqttTopicFilter()
+{
+}
+
+void Tst_QMqttTopicFilter::initTestCase()
+{
+}
+
+void Tst_QMqttTopicFilter::cleanupTestCase()
+{
+}
+
+void Tst_QMqttTopicFilter::getSetCheck()
+{
+    QMqttTopicFilter filter(QLatin1String("Qt/+/b"));
+    QCOMPARE(filter.filter(), QLatin1String("Qt/+/b"));
+    QCOMPARE(filter.toUtf8(), QByteArray("Qt/+/b"));
+    QCOMPARE(filter.levelCount(), 3);
+    QVERIFY(filter.hasWildcards());
+
+    const QMqttTopicFilter copy = filter;
+    filter.setFilter(QString::fromUtf8("Qt/\xc3\xa4"));
+    QCOMPARE(filter.toUtf8(), QByteArray("Qt/\xc3\xa4"));
+    QCOMPARE(filter.levelCount(), 2);
+    QVERIFY(!filter.hasWildcards());
+    // Copies are not affected
+    QCOMPARE(copy.filter(), QLatin1String("Qt/+/b"));
+
+    QMqttTopicFilter empty;
+    QVERIFY(!empty.isValid());
+    QCOMPARE(empty.levelCount(), 0);
+
+    // A moved-from filter can be assigned again
+    QMqttTopicFilter moved(std::move(filter));
+    QCOMPARE(moved.toUtf8(), QByteArray("Qt/\xc3\xa4"));
+    filter = copy;
+    QCOMPARE(filter.filter(), QLatin1String("Qt/+/b"));
+}
+
+void Tst_QMqttTopicFilter::validity_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<bool>("valid");
+    QTest::addColumn<int>("levels");
+
+    QTest::newRow("empty") << QString() << false << 0;
+    QTest::newRow("simple") << "Qt" << true << 1;
+    QTest::newRow("levels") << "Qt/a/b" << true << 3;
+    QTest::newRow("empty levels") << "/Qt//" << true << 4;
+    QTest::newRow("/") << "/" << true << 2;
+    QTest::newRow("#") << "#" << true << 1;
+    QTest::newRow("+") << "+" << true << 1;
+    QTest::newRow("+/+/#") << "+/+/#" << true << 3;
+    QTest::newRow("# not last") << "Qt/#/a" << false << 0;
+    QTest::newRow("# in level") << "Qt/a#" << false << 0;
+    QTest::newRow("+ in level") << "Qt/a+/b" << false << 0;
+    QTest::newRow("null character") << QString(QLatin1String("Qt/a")) + QChar(0) << false << 0;
+    QTest::newRow("too long") << QString(65536, QLatin1Char('a')) << false << 0;
+    QTest::newRow("maximum length") << QString(65535, QLatin1Char('a')) << true << 1;
+}
+
+void Tst_QMqttTopicFilter::validity()
+{
+    QFETCH(QString, filter);
+    QFETCH(bool, valid);
+    QFETCH(int, levels);
+
+    const QMqttTopicFilter topicFilter(filter);
+    QCOMPARE(topicFilter.isValid(), valid);
+    QCOMPARE(topicFilter.levelCount(), levels);
+}
+
+void Tst_QMqttTopicFilter::match_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QString>("topic");
+    QTest::addColumn<bool>("match");
+
+    QTest::newRow("exact") << "Qt/a/b" << "Qt/a/b" << true;
+    QTest::newRow("exact mismatch") << "Qt/a/b" << "Qt/a/c" << false;
+    QTest::newRow("exact prefix") << "Qt/a" << "Qt/a/b" << false;
+    QTest::newRow("+") << "Qt/+/b" << "Qt/a/b" << true;
+    QTest::newRow("+ empty level") << "Qt/+/b" << "Qt//b" << true;
+    QTest::newRow("+ too deep") << "Qt/+" << "Qt/a/b" << false;
+    QTest::newRow("+ too short") << "Qt/a/+" << "Qt/a" << false;
+    QTest::newRow("+ trailing slash") << "Qt/a/+" << "Qt/a/" << true;
+    QTest::newRow("# parent") << "Qt/#" << "Qt" << true;
+    QTest::newRow("# child") << "Qt/#" << "Qt/a/b/c" << true;
+    QTest::newRow("# mismatch") << "Qt/#" << "Qtx/a" << false;
+    QTest::newRow("+/#") << "+/a/#" << "Qt/a/b" << true;
+    QTest::newRow("+/# mismatch") << "+/a/#" << "Qt/b/a" << false;
+    QTest::newRow("# $SYS") << "#" << "$SYS/uptime" << false;
+    QTest::newRow("+ $SYS") << "+/uptime" << "$SYS/uptime" << false;
+    QTest::newRow("$SYS") << "$SYS/#" << "$SYS/uptime" << true;
+    QTest::newRow("utf8") << QString::fromUtf8("Qt/+/\xc3\xa4") << QString::fromUtf8("Qt/a/\xc3\xa4") << true;
+    QTest::newRow("empty topic") << "#" << "" << false;
+    QTest::newRow("invalid") << "Qt/#/a" << "Qt/b/a" << false;
+}
+
+void Tst_QMqttTopicFilter::match()
+{
+    QFETCH(QString, filter);
+    QFETCH(QString, topic);
+    QFETCH(bool, match);
+
+    const QMqttTopicFilter topicFilter(filter);
+    QCOMPARE(topicFilter.match(topic), match);
+    QCOMPARE(topicFilter.matchUtf8(topic.toUtf8()), match);
+}
+
+void Tst_QMqttTopicFilter::compare()
+{
+    const QMqttTopicFilter a(QLatin1String("Qt/+/b"));
+    const QMqttTopicFilter b(QString::fromLatin1("Qt/+/b"));
+    const QMqttTopicFilter c(QLatin1String("Qt/#"));
+
+    QVERIFY(a == b);
+    QVERIFY(a != c);
+    QCOMPARE(qHash(a), qHash(b));
+
+    QSet<QMqttTopicFilter> filters;
+    filters << a << b << c;
+    QCOMPARE(filters.size(), 2);
+
+    const QVariant variant = QVariant::fromValue(c);
+    QCOMPARE(variant.value<QMqttTopicFilter>(), c);
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttTopicFilter)
+
+#include "tst_qmqtttopicfilter.moc"
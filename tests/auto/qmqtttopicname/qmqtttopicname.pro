@@ -0,0 +1,8 @@
+CONFIG += testcase
+QT       += testlib mqtt
+QT       -= gui
+
+TARGET = tst_qmqtttopicname
+
+SOURCES += \
+    tst_qmqtttopicname.cpp
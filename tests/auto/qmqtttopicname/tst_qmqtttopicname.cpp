@@ -0,0 +1,142 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/QMqttTopicFilter>
+#include <QtMqtt/QMqttTopicName>
+
+class Tst_QMqttTopicName : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttTopicName();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void getSetCheck();
+    void validity_data();
+    void validity();
+    void compare();
+    void matchFilter();
+};
+
+Tst_QMqttTopicName::Tst_QMqttTopicName()
+{
+}
+
+void Tst_QMqttTopicName::initTestCase()
+{
+}
+
+void Tst_QMqttTopicName::cleanupTestCase()
+{
+}
+
+void Tst_QMqttTopicName::getSetCheck()
+{
+    QMqttTopicName name(QLatin1String("Qt/a/b"));
+    QCOMPARE(name.name(), QLatin1String("Qt/a/b"));
+    QCOMPARE(name.toUtf8(), QByteArray("Qt/a/b"));
+    QCOMPARE(name.levelCount(), 3);
+
+    const QMqttTopicName copy = name;
+    name.setName(QString::fromUtf8("Qt/\xc3\xa4"));
+    QCOMPARE(name.toUtf8(), QByteArray("Qt/\xc3\xa4"));
+    QCOMPARE(name.levelCount(), 2);
+    // Copies are not affected
+    QCOMPARE(copy.name(), QLatin1String("Qt/a/b"));
+
+    QMqttTopicName empty;
+    QVERIFY(!empty.isValid());
+    QCOMPARE(empty.levelCount(), 0);
+
+    // A moved-from name can be assigned again
+    QMqttTopicName moved(std::move(name));
+    QCOMPARE(moved.toUtf8(), QByteArray("Qt/\xc3\xa4"));
+    name = copy;
+    QCOMPARE(name.name(), QLatin1String("Qt/a/b"));
+}
+
+void Tst_QMqttTopicName::validity_data()
+{
+    QTest::addColumn<QString>("name");
+    QTest::addColumn<bool>("valid");
+    QTest::addColumn<int>("levels");
+
+    QTest::newRow("empty") << QString() << false << 0;
+    QTest::newRow("simple") << "Qt" << true << 1;
+    QTest::newRow("levels") << "Qt/a/b" << true << 3;
+    QTest::newRow("empty levels") << "/Qt//" << true << 4;
+    QTest::newRow("/") << "/" << true << 2;
+    QTest::newRow("space") << "Qt/a b" << true << 2;
+    QTest::newRow("$SYS") << "$SYS/uptime" << true << 2;
+    QTest::newRow("#") << "Qt/#" << false << 0;
+    QTest::newRow("+") << "Qt/+/b" << false << 0;
+    QTest::newRow("+ in level") << "Qt/a+" << false << 0;
+    QTest::newRow("null character") << QString(QLatin1String("Qt/a")) + QChar(0) << false << 0;
+    QTest::newRow("too long") << QString(65536, QLatin1Char('a')) << false << 0;
+    QTest::newRow("maximum length") << QString(65535, QLatin1Char('a')) << true << 1;
+}
+
+void Tst_QMqttTopicName::validity()
+{
+    QFETCH(QString, name);
+    QFETCH(bool, valid);
+    QFETCH(int, levels);
+
+    const QMqttTopicName topicName(name);
+    QCOMPARE(topicName.isValid(), valid);
+    QCOMPARE(topicName.levelCount(), levels);
+}
+
+void Tst_QMqttTopicName::compare()
+{
+    const QMqttTopicName a(QLatin1String("Qt/a"));
+    const QMqttTopicName b(QString::fromLatin1("Qt/a"));
+    const QMqttTopicName c(QLatin1String("Qt/b"));
+
+    QVERIFY(a == b);
+    QVERIFY(a != c);
+    QCOMPARE(qHash(a), qHash(b));
+
+    QSet<QMqttTopicName> names;
+    names << a << b << c;
+    QCOMPARE(names.size(), 2);
+
+    const QVariant variant = QVariant::fromValue(c);
+    QCOMPARE(variant.value<QMqttTopicName>(), c);
+}
+
+void Tst_QMqttTopicName::matchFilter()
+{
+    const QMqttTopicFilter filter(QLatin1String("Qt/+/b"));
+    QVERIFY(filter.match(QMqttTopicName(QLatin1String("Qt/a/b"))));
+    QVERIFY(!filter.match(QMqttTopicName(QLatin1String("Qt/a/c"))));
+    // An invalid name never matches
+    QVERIFY(!QMqttTopicFilter(QLatin1String("#")).match(QMqttTopicName(QLatin1String("Qt/+"))));
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttTopicName)
+
+#include "tst_qmqtttopicname.moc"
@@ -0,0 +1,178 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqtttopictrie_p.h>
+
+static QStringList matches(const QMqttTopicTrie<QString> &trie, const QByteArray &topic)
+{
+    QStringList result = trie.match(topic).toList();
+    result.sort();
+    return result;
+}
+
+class Tst_QMqttTopicTrie : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttTopicTrie();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void match_data();
+    void match();
+    void remove();
+    void manyFilters();
+};
+
+Tst_QMqttTopicTrie::Tst_QMqttTopicTrie()
+{
+}
+
+void Tst_QMqttTopicTrie::initTestCase()
+{
+}
+
+void Tst_QMqttTopicTrie::cleanupTestCase()
+{
+}
+
+void Tst_QMqttTopicTrie::match_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QStringList>("matching");
+    QTest::addColumn<QStringList>("notMatching");
+
+    QTest::newRow("exact") << "Qt/a/b"
+                           << (QStringList() << "Qt/a/b")
+                           << (QStringList() << "Qt/a" << "Qt/a/b/c" << "Qt/a/b/" << "qt/a/b");
+    QTest::newRow("+") << "Qt/+/b"
+                       << (QStringList() << "Qt/a/b" << "Qt//b" << "Qt/xyz/b")
+                       << (QStringList() << "Qt/b" << "Qt/a/c/b" << "Qt/a/b/c");
+    QTest::newRow("+ last") << "Qt/a/+"
+                            << (QStringList() << "Qt/a/b" << "Qt/a/")
+                            << (QStringList() << "Qt/a" << "Qt/a/b/c");
+    QTest::newRow("#") << "Qt/#"
+                       << (QStringList() << "Qt" << "Qt/a" << "Qt/a/b/c/d/e/f" << "Qt/")
+                       << (QStringList() << "Qtx" << "qt/a" << "a/Qt");
+    QTest::newRow("+/#") << "+/a/#"
+                         << (QStringList() << "Qt/a" << "x/a/b/c")
+                         << (QStringList() << "Qt/b" << "a" << "$SYS/a/b");
+    QTest::newRow("# only") << "#"
+                            << (QStringList() << "Qt" << "/" << "a/b/c")
+                            << (QStringList() << "$SYS/uptime");
+    QTest::newRow("+ only") << "+"
+                            << (QStringList() << "Qt")
+                            << (QStringList() << "Qt/a" << "/" << "$SYS");
+    QTest::newRow("$SYS") << "$SYS/#"
+                          << (QStringList() << "$SYS" << "$SYS/broker/uptime")
+                          << (QStringList() << "SYS/broker");
+    QTest::newRow("empty levels") << "/+/"
+                                  << (QStringList() << "/a/" << "//")
+                                  << (QStringList() << "/a" << "a/a/");
+    QTest::newRow("utf8") << QString::fromUtf8("Qt/\xc3\xa4/+")
+                          << (QStringList() << QString::fromUtf8("Qt/\xc3\xa4/b"))
+                          << (QStringList() << "Qt/a/b");
+}
+
+void Tst_QMqttTopicTrie::match()
+{
+    QFETCH(QString, filter);
+    QFETCH(QStringList, matching);
+    QFETCH(QStringList, notMatching);
+
+    QMqttTopicTrie<QString> trie;
+    trie.insert(filter.toUtf8(), filter);
+    QCOMPARE(trie.size(), 1);
+
+    for (const QString &topic : qAsConst(matching))
+        QVERIFY2(trie.match(topic.toUtf8()) == QVector<QString>() << filter, qPrintable(topic));
+    for (const QString &topic : qAsConst(notMatching))
+        QVERIFY2(trie.match(topic.toUtf8()).isEmpty(), qPrintable(topic));
+}
+
+void Tst_QMqttTopicTrie::remove()
+{
+    QMqttTopicTrie<QString> trie;
+    const QStringList filters = QStringList() << "Qt/a/b" << "Qt/+/b" << "Qt/#" << "#"
+                                              << "+/+" << "Qt/a/+/c";
+    for (const QString &filter : filters)
+        trie.insert(filter.toUtf8(), filter);
+    QCOMPARE(trie.size(), filters.size());
+
+    QCOMPARE(matches(trie, "Qt/a/b"), QStringList() << "#" << "+/+" << "Qt/#" << "Qt/+/b" << "Qt/a/b");
+
+    // Replacing a value does not add another entry
+    trie.insert("Qt/a/b", QLatin1String("Qt/a/b"));
+    QCOMPARE(trie.size(), filters.size());
+
+    QVERIFY(trie.remove("Qt/+/b"));
+    QVERIFY(!trie.remove("Qt/+/b"));
+    QVERIFY(!trie.remove("Qt/a"));
+    QVERIFY(!trie.remove("Qt/a/#"));
+    QCOMPARE(matches(trie, "Qt/a/b"), QStringList() << "#" << "+/+" << "Qt/#" << "Qt/a/b");
+
+    QVERIFY(trie.remove("Qt/#"));
+    QVERIFY(trie.remove("#"));
+    QCOMPARE(matches(trie, "Qt/a/b"), QStringList() << "+/+" << "Qt/a/b");
+    QCOMPARE(matches(trie, "Qt/a/x/c"), QStringList() << "Qt/a/+/c");
+
+    // Removing a leaf keeps the filters sharing its levels
+    QVERIFY(trie.remove("Qt/a/+/c"));
+    QCOMPARE(matches(trie, "Qt/a/b"), QStringList() << "+/+" << "Qt/a/b");
+
+    QVERIFY(trie.remove("Qt/a/b"));
+    QVERIFY(trie.remove("+/+"));
+    QVERIFY(trie.isEmpty());
+    QVERIFY(trie.match("Qt/a/b").isEmpty());
+
+    trie.insert("Qt/a", QLatin1String("Qt/a"));
+    trie.clear();
+    QVERIFY(trie.isEmpty());
+    QVERIFY(trie.match("Qt/a").isEmpty());
+}
+
+void Tst_QMqttTopicTrie::manyFilters()
+{
+    // Each topic is matched by its own filter, the shared '+' filter and '#'
+    QMqttTopicTrie<QString> trie;
+    for (int i = 0; i < 20000; ++i) {
+        const QString filter = QString::fromLatin1("devices/%1/status").arg(i);
+        trie.insert(filter.toUtf8(), filter);
+    }
+    trie.insert("devices/+/status", QLatin1String("devices/+/status"));
+    trie.insert("devices/#", QLatin1String("devices/#"));
+    QCOMPARE(trie.size(), 20002);
+
+    for (int i = 0; i < 20000; i += 997) {
+        const QByteArray topic = QString::fromLatin1("devices/%1/status").arg(i).toUtf8();
+        QCOMPARE(matches(trie, topic), QStringList() << "devices/#" << "devices/+/status"
+                                                     << QString::fromUtf8(topic));
+    }
+    QCOMPARE(matches(trie, "devices/20000/status"), QStringList() << "devices/#" << "devices/+/status");
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttTopicTrie)
+
+#include "tst_qmqtttopictrie.moc"
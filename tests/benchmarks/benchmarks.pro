@@ -1,3 +1,7 @@
 TEMPLATE = subdirs
-SUBDIRS += qmqttclient
-
+SUBDIRS += qmqttclient \
+           qmqttconnection \
+           qmqttcontrolpacket \
+           qmqttframedecoder \
+           qmqttpacketidtable \
+           qmqttreadbuffer
@@ -0,0 +1,14 @@
+CONFIG += benchmark
+QT       += testlib mqtt
+QT       -= gui
+
+TARGET = tst_qmqttconnection
+
+SOURCES += \
+    tst_qmqttconnection.cpp
+
+HEADERS += \
+    $$PWD/../../common/fake_transport.h
+
+INCLUDEPATH += \
+    $$PWD/../../common
@@ -0,0 +1,157 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include "fake_transport.h"
+
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/QMqttClient>
+#include <QtMqtt/QMqttSubscription>
+#include <QtMqtt/QMqttTopicName>
+
+class Tst_QMqttConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttConnection();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void publishThroughput_data();
+    void publishThroughput();
+    void dispatch_data();
+    void dispatch();
+};
+
+Tst_QMqttConnection::Tst_QMqttConnection()
+{
+}
+
+void Tst_QMqttConnection::initTestCase()
+{
+}
+
+void Tst_QMqttConnection::cleanupTestCase()
+{
+}
+
+void Tst_QMqttConnection::publishThroughput_data()
+{
+    QTest::addColumn<int>("qos");
+    QTest::addColumn<bool>("coalescing");
+
+    QTest::newRow("qos0") << 0 << false;
+    QTest::newRow("qos0/coalescing") << 0 << true;
+    QTest::newRow("qos1") << 1 << false;
+    QTest::newRow("qos1/coalescing") << 1 << true;
+}
+
+// Publishes a burst of messages within one event loop iteration. For QoS 1
+// the fake broker acknowledges the whole burst afterwards.
+void Tst_QMqttConnection::publishThroughput()
+{
+    QFETCH(int, qos);
+    QFETCH(bool, coalescing);
+
+    const int messageCount = 1000;
+
+    FakeTransport transport;
+    QMqttClient client;
+    client.setWriteCoalescing(coalescing);
+    QVERIFY(connectFakeBroker(&client, &transport));
+
+    const QMqttTopicName topic(QLatin1String("sensors/temperature/0001"));
+    const QByteArray message(64, 'x');
+    QByteArray acknowledges;
+    acknowledges.reserve(messageCount * 4);
+
+    QBENCHMARK {
+        transport.resetCounters();
+        acknowledges.clear();
+        for (int i = 0; i < messageCount; ++i) {
+            const qint32 id = client.publish(topic, message, quint8(qos));
+            if (qos)
+                acknowledges.append(createPublishAcknowledge(quint16(id)));
+        }
+        QCoreApplication::processEvents();
+        if (qos)
+            transport.receive(acknowledges);
+    }
+
+    QCOMPARE(transport.writeCount(), coalescing ? 1 : messageCount);
+    QVERIFY(transport.bytesWrittenTotal() > messageCount * message.size());
+}
+
+void Tst_QMqttConnection::dispatch_data()
+{
+    QTest::addColumn<bool>("handler");
+    QTest::addColumn<int>("messageDispatch");
+
+    QTest::newRow("signal") << false << int(QMqttClient::ClientAndSubscriptions);
+    QTest::newRow("signal/subscriptions only") << false << int(QMqttClient::SubscriptionsOnly);
+    QTest::newRow("handler") << true << int(QMqttClient::ClientAndSubscriptions);
+    QTest::newRow("handler/subscriptions only") << true << int(QMqttClient::SubscriptionsOnly);
+}
+
+// Receives a burst of messages for one subscription, which are counted either
+// by a lambda connected to messageReceived() or by a message handler. Nothing
+// is connected to QMqttClient::messageReceived().
+void Tst_QMqttConnection::dispatch()
+{
+    QFETCH(bool, handler);
+    QFETCH(int, messageDispatch);
+
+    const int messageCount = 1000;
+
+    FakeTransport transport;
+    QMqttClient client;
+    client.setMessageDispatch(QMqttClient::MessageDispatch(messageDispatch));
+    QVERIFY(connectFakeBroker(&client, &transport));
+    const auto sub = client.subscribe(QLatin1String("sensors/+/0001"));
+    QVERIFY(sub);
+    transport.receive(QByteArray("\x90\x03\x00\x01\x00", 5));
+
+    int received = 0;
+    if (handler)
+        sub->setMessageHandler([&received](const QMqttMessage &) { received++; });
+    else
+        connect(sub.data(), &QMqttSubscription::messageReceived, [&received](QMqttMessage) { received++; });
+
+    const QByteArray publish = QByteArray("\x30\x40\x00\x18", 4) + QByteArray("sensors/temperature/0001")
+            + QByteArray(38, 'x');
+    QByteArray burst;
+    burst.reserve(publish.size() * messageCount);
+    for (int i = 0; i < messageCount; ++i)
+        burst.append(publish);
+
+    QBENCHMARK {
+        transport.receive(burst);
+    }
+
+    QVERIFY(received >= messageCount);
+    QCOMPARE(received % messageCount, 0);
+}
+
+QTEST_MAIN(Tst_QMqttConnection)
+
+#include "tst_qmqttconnection.moc"
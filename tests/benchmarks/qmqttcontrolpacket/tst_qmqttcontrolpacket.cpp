@@ -0,0 +1,210 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttcontrolpacket_p.h>
+
+#include <cstdlib>
+
+#if defined(Q_OS_LINUX) && defined(__GLIBC__)
+#  define COUNT_ALLOCATIONS
+#endif
+
+static QAtomicInteger<quint64> allocationCount;
+
+#ifdef COUNT_ALLOCATIONS
+// Count every heap allocation of the process by interposing the allocator
+// of glibc. operator new ends up in malloc() as well.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size) __THROW
+{
+    allocationCount.fetchAndAddRelaxed(1);
+    return __libc_malloc(size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW
+{
+    allocationCount.fetchAndAddRelaxed(1);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+// The frame layout used before, kept as reference: the frame is grown byte
+// by byte and the payload is appended to the packet and to the frame.
+static QByteArray serializeReference(quint8 header, const QByteArray &topic, quint16 id,
+                                     const QByteArray &message)
+{
+    QByteArray payload;
+    const quint16 topicLength = qToBigEndian<quint16>(quint16(topic.size()));
+    payload.append(reinterpret_cast<const char *>(&topicLength)[0]);
+    payload.append(reinterpret_cast<const char *>(&topicLength)[1]);
+    payload.append(topic);
+    if (id) {
+        const quint16 idBigEndian = qToBigEndian<quint16>(id);
+        payload.append(reinterpret_cast<const char *>(&idBigEndian)[0]);
+        payload.append(reinterpret_cast<const char *>(&idBigEndian)[1]);
+    }
+    payload.append(message);
+
+    QByteArray data;
+    data.append(char(header));
+    quint32 msgSize = payload.size();
+    do {
+        quint8 b = msgSize % 128;
+        msgSize /= 128;
+        if (msgSize > 0)
+            b |= 0x80;
+        data.append(char(b));
+    } while (msgSize > 0);
+    data.append(payload);
+    return data;
+}
+
+// Builds a PUBLISH the same way QMqttConnection::sendControlPublish() does
+static QByteArray serializePublish(quint8 header, const QByteArray &topic, quint16 id,
+                                   const QByteArray &message)
+{
+    auto packet = QSharedPointer<QMqttControlPacket>::create(header);
+    packet->append(topic);
+    if (id)
+        packet->append(id);
+    packet->appendRaw(message);
+    return packet->serialize();
+}
+
+class Tst_QMqttControlPacket : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttControlPacket();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void serialize_data();
+    void serialize();
+    void allocations_data();
+    void allocations();
+};
+
+Tst_QMqttControlPacket::Tst_QMqttControlPacket()
+{
+}
+
+void Tst_QMqttControlPacket::initTestCase()
+{
+}
+
+void Tst_QMqttControlPacket::cleanupTestCase()
+{
+}
+
+void Tst_QMqttControlPacket::serialize_data()
+{
+    QTest::addColumn<int>("qos");
+    QTest::addColumn<int>("payloadSize");
+    QTest::addColumn<bool>("reference");
+
+    const int payloadSizes[] = {16, 1024, 64 * 1024, 1024 * 1024};
+    for (int payloadSize : payloadSizes) {
+        for (int qos = 0; qos < 2; ++qos) {
+            QTest::newRow(qPrintable(QString::fromLatin1("qos%1/%2").arg(qos).arg(payloadSize)))
+                    << qos << payloadSize << false;
+            QTest::newRow(qPrintable(QString::fromLatin1("qos%1/%2/reference").arg(qos).arg(payloadSize)))
+                    << qos << payloadSize << true;
+        }
+    }
+}
+
+void Tst_QMqttControlPacket::serialize()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, qos);
+    QFETCH(int, payloadSize);
+    QFETCH(bool, reference);
+
+    const quint8 header = quint8(QMqttControlPacket::PUBLISH | (qos << 1));
+    const quint16 id = qos ? 1 : 0;
+    const QByteArray topic("sensors/temperature/0001");
+    const QByteArray message(payloadSize, 'x');
+
+    QCOMPARE(serializePublish(header, topic, id, message), serializeReference(header, topic, id, message));
+
+    QByteArray frame;
+    if (reference) {
+        QBENCHMARK {
+            frame = serializeReference(header, topic, id, message);
+        }
+    } else {
+        QBENCHMARK {
+            frame = serializePublish(header, topic, id, message);
+        }
+    }
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttControlPacket::allocations_data()
+{
+    serialize_data();
+}
+
+// Reports the heap allocations needed to create and serialize one PUBLISH
+void Tst_QMqttControlPacket::allocations()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(COUNT_ALLOCATIONS)
+    QFETCH(int, qos);
+    QFETCH(int, payloadSize);
+    QFETCH(bool, reference);
+
+    const quint8 header = quint8(QMqttControlPacket::PUBLISH | (qos << 1));
+    const quint16 id = qos ? 1 : 0;
+    const QByteArray topic("sensors/temperature/0001");
+    const QByteArray message(payloadSize, 'x');
+
+    quint64 allocations = 0;
+    quint64 publishes = 0;
+    QBENCHMARK {
+        const quint64 before = allocationCount.load();
+        const QByteArray frame = reference ? serializeReference(header, topic, id, message)
+                                           : serializePublish(header, topic, id, message);
+        allocations += allocationCount.load() - before;
+        publishes++;
+        Q_UNUSED(frame);
+    }
+    QTest::setBenchmarkResult(qreal(allocations) / publishes, QTest::Events);
+#elif !defined(COUNT_ALLOCATIONS)
+    QSKIP("Counting allocations is only supported with glibc.");
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttControlPacket)
+
+#include "tst_qmqttcontrolpacket.moc"
@@ -0,0 +1,9 @@
+CONFIG += benchmark
+QT       += testlib mqtt
+QT       -= gui
+QT_PRIVATE += mqtt-private
+
+TARGET = tst_qmqttframedecoder
+
+SOURCES += \
+    tst_qmqttframedecoder.cpp
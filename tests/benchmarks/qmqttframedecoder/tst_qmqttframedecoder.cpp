@@ -0,0 +1,212 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttframedecoder_p.h>
+
+// Canned stream of QoS 1 PUBLISH frames followed by a PUBACK each.
+static QByteArray createStream(int messageCount, int payloadSize)
+{
+    const QByteArray topic("sensors/temperature/0001");
+    const QByteArray payload(payloadSize, 'x');
+
+    QByteArray publish;
+    publish.append(char(0x32));
+    quint32 remaining = 2 + topic.size() + 2 + payload.size();
+    do {
+        quint8 b = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0)
+            b |= 0x80;
+        publish.append(char(b));
+    } while (remaining > 0);
+    publish.append(char(0));
+    publish.append(char(topic.size()));
+    publish.append(topic);
+    publish.append(char(0));
+    publish.append(char(1));
+    publish.append(payload);
+    publish.append(QByteArray("\x40\x02\x00\x01", 4));
+
+    QByteArray stream;
+    stream.reserve(messageCount * publish.size());
+    for (int i = 0; i < messageCount; ++i)
+        stream.append(publish);
+    return stream;
+}
+
+// Hands out data in chunks of fixed size, like a socket receiving segments.
+class ChunkedDevice : public QIODevice
+{
+public:
+    ChunkedDevice(const QByteArray &data, int chunkSize)
+        : m_data(data), m_chunkSize(chunkSize)
+    {
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override
+    {
+        return qMin<qint64>(m_available, m_data.size() - m_pos);
+    }
+    void receiveChunk() { m_available += m_chunkSize; }
+    bool atEnd() const override { return m_pos == m_data.size(); }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const qint64 size = qMin(maxSize, bytesAvailable());
+        memcpy(data, m_data.constData() + m_pos, size);
+        m_pos += size;
+        m_available -= size;
+        return size;
+    }
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    QByteArray m_data;
+    qint64 m_pos{0};
+    qint64 m_available{0};
+    int m_chunkSize;
+};
+
+class Tst_QMqttFrameDecoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttFrameDecoder();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void decode_data();
+    void decode();
+    void payloadCopies_data();
+    void payloadCopies();
+};
+
+Tst_QMqttFrameDecoder::Tst_QMqttFrameDecoder()
+{
+}
+
+void Tst_QMqttFrameDecoder::initTestCase()
+{
+}
+
+void Tst_QMqttFrameDecoder::cleanupTestCase()
+{
+}
+
+void Tst_QMqttFrameDecoder::decode_data()
+{
+    QTest::addColumn<int>("messageCount");
+    QTest::addColumn<int>("payloadSize");
+    QTest::addColumn<int>("chunkSize");
+
+    // Small chunks resemble heavily fragmented reads on cellular links
+    const int chunkSizes[] = {1, 7, 536, 1460, 65536};
+    for (int chunkSize : chunkSizes) {
+        QTest::newRow(qPrintable(QString::fromLatin1("100000x16/%1").arg(chunkSize)))
+                << 100000 << 16 << chunkSize;
+        QTest::newRow(qPrintable(QString::fromLatin1("1000x4096/%1").arg(chunkSize)))
+                << 1000 << 4096 << chunkSize;
+    }
+    QTest::newRow("100000x16/all") << 100000 << 16 << 0;
+}
+
+void Tst_QMqttFrameDecoder::decode()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, messageCount);
+    QFETCH(int, payloadSize);
+    QFETCH(int, chunkSize);
+
+    const QByteArray stream = createStream(messageCount, payloadSize);
+    QVector<QByteArray> chunks;
+    if (chunkSize == 0)
+        chunkSize = stream.size();
+    for (int pos = 0; pos < stream.size(); pos += chunkSize)
+        chunks.append(stream.mid(pos, chunkSize));
+
+    int frames = 0;
+    QBENCHMARK {
+        QMqttFrameDecoder decoder;
+        frames = 0;
+        for (const QByteArray &chunk : qAsConst(chunks)) {
+            decoder.append(chunk);
+            while (decoder.nextFrame()) {
+                if (decoder.state() != QMqttFrameDecoder::PublishHeader)
+                    frames++;
+            }
+        }
+    }
+    QCOMPARE(frames, 2 * messageCount);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttFrameDecoder::payloadCopies_data()
+{
+    QTest::addColumn<int>("messageCount");
+    QTest::addColumn<int>("payloadSize");
+
+    QTest::newRow("1000x1K") << 1000 << 1024;
+    QTest::newRow("100x64K") << 100 << 64 * 1024;
+    QTest::newRow("10x1M") << 10 << 1024 * 1024;
+    QTest::newRow("2x16M") << 2 << 16 * 1024 * 1024;
+}
+
+// Reports the payload bytes copied out of the read buffer per delivered
+// message. For big payloads this stays below the size of a single read, as
+// the rest of the payload is read from the device into its final location.
+void Tst_QMqttFrameDecoder::payloadCopies()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, messageCount);
+    QFETCH(int, payloadSize);
+
+    ChunkedDevice device(createStream(messageCount, payloadSize), 16 * 1024);
+    QMqttFrameDecoder decoder;
+    int messages = 0;
+    while (!device.atEnd()) {
+        device.receiveChunk();
+        while (device.bytesAvailable() > 0) {
+            decoder.readFrom(&device);
+            while (decoder.nextFrame()) {
+                if (decoder.state() == QMqttFrameDecoder::PublishPayload)
+                    messages++;
+            }
+        }
+    }
+    QCOMPARE(messages, messageCount);
+    QTest::setBenchmarkResult(qreal(decoder.copiedPayloadBytes()) / messages, QTest::Events);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttFrameDecoder)
+
+#include "tst_qmqttframedecoder.moc"
@@ -0,0 +1,232 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QMap>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttcontrolpacket_p.h>
+#include <QtMqtt/private/qmqttpacketidtable_p.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+#if defined(Q_OS_LINUX) && defined(__GLIBC__)
+#  define COUNT_ALLOCATIONS
+#endif
+
+static QAtomicInteger<quint64> allocatedBytes;
+
+#ifdef COUNT_ALLOCATIONS
+// Sum up the size of every heap allocation of the process by interposing
+// the allocator of glibc. operator new ends up in malloc() as well.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size) __THROW
+{
+    allocatedBytes.fetchAndAddRelaxed(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW
+{
+    allocatedBytes.fetchAndAddRelaxed(size);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+#ifdef QT_BUILD_INTERNAL
+static QMqttControlPacket createPublish(quint16 id, const QByteArray &message)
+{
+    QMqttControlPacket packet(QMqttControlPacket::PUBLISH | 0x02);
+    packet.append(QByteArray("sensors/temperature/0001"));
+    packet.append(id);
+    packet.appendRaw(message);
+    return packet;
+}
+
+// The messages in flight as stored before, kept as reference
+typedef QMap<quint16, QSharedPointer<QMqttControlPacket>> ReferenceTable;
+typedef QMqttPacketIdTable<QMqttControlPacket> Table;
+
+static void insert(ReferenceTable *table, quint16 id, const QByteArray &message)
+{
+    table->insert(id, QSharedPointer<QMqttControlPacket>::create(createPublish(id, message)));
+}
+
+static void insert(Table *table, quint16 id, const QByteArray &message)
+{
+    table->insert(id, createPublish(id, message));
+}
+
+// Same lookups as QMqttConnection::finalize_pubAckRecComp()
+static bool acknowledge(ReferenceTable *table, quint16 id)
+{
+    return !table->take(id).isNull();
+}
+
+static bool acknowledge(Table *table, quint16 id)
+{
+    if (!table->contains(id))
+        return false;
+    table->take(id);
+    return true;
+}
+#endif
+
+class Tst_QMqttPacketIdTable : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttPacketIdTable();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void acknowledge_data();
+    void acknowledge();
+    void memory_data();
+    void memory();
+
+private:
+#ifdef QT_BUILD_INTERNAL
+    template <typename T>
+    void runAcknowledge(int inFlight);
+    template <typename T>
+    void runMemory(int inFlight);
+#endif
+};
+
+Tst_QMqttPacketIdTable::Tst_QMqttPacketIdTable()
+{
+}
+
+void Tst_QMqttPacketIdTable::initTestCase()
+{
+}
+
+void Tst_QMqttPacketIdTable::cleanupTestCase()
+{
+}
+
+void Tst_QMqttPacketIdTable::acknowledge_data()
+{
+    QTest::addColumn<int>("inFlight");
+    QTest::addColumn<bool>("reference");
+
+    const int inFlightCounts[] = {10000, 60000};
+    for (int inFlight : inFlightCounts) {
+        QTest::newRow(qPrintable(QString::number(inFlight))) << inFlight << false;
+        QTest::newRow(qPrintable(QString::fromLatin1("%1/reference").arg(inFlight))) << inFlight << true;
+    }
+}
+
+#ifdef QT_BUILD_INTERNAL
+template <typename T>
+void Tst_QMqttPacketIdTable::runAcknowledge(int inFlight)
+{
+    const QByteArray message(64, 'x');
+    T table;
+    QVector<quint16> ids;
+    for (int i = 1; i <= inFlight; ++i) {
+        insert(&table, quint16(i), message);
+        ids.append(quint16(i));
+    }
+    // Brokers acknowledge in any order
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(42));
+
+    // Every message is acknowledged and replaced by a new one, which keeps
+    // the number of messages in flight constant.
+    QBENCHMARK {
+        for (quint16 id : qAsConst(ids)) {
+            if (!acknowledge(&table, id))
+                QFAIL("Message not in flight");
+            insert(&table, id, message);
+        }
+    }
+    QCOMPARE(table.size(), inFlight);
+}
+#endif
+
+void Tst_QMqttPacketIdTable::acknowledge()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, inFlight);
+    QFETCH(bool, reference);
+
+    if (reference)
+        runAcknowledge<ReferenceTable>(inFlight);
+    else
+        runAcknowledge<Table>(inFlight);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttPacketIdTable::memory_data()
+{
+    acknowledge_data();
+}
+
+#ifdef QT_BUILD_INTERNAL
+template <typename T>
+void Tst_QMqttPacketIdTable::runMemory(int inFlight)
+{
+    const QByteArray message(64, 'x');
+    quint64 bytes = 0;
+    quint64 runs = 0;
+    QBENCHMARK {
+        T table;
+        const quint64 before = allocatedBytes.load();
+        for (int i = 1; i <= inFlight; ++i)
+            insert(&table, quint16(i), message);
+        bytes += allocatedBytes.load() - before;
+        runs++;
+    }
+    QTest::setBenchmarkResult(qreal(bytes) / runs / inFlight, QTest::BytesAllocated);
+}
+#endif
+
+// Reports the heap memory allocated per message in flight
+void Tst_QMqttPacketIdTable::memory()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(COUNT_ALLOCATIONS)
+    QFETCH(int, inFlight);
+    QFETCH(bool, reference);
+
+    if (reference)
+        runMemory<ReferenceTable>(inFlight);
+    else
+        runMemory<Table>(inFlight);
+#elif !defined(COUNT_ALLOCATIONS)
+    QSKIP("Counting allocations is only supported with glibc.");
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttPacketIdTable)
+
+#include "tst_qmqttpacketidtable.moc"
@@ -0,0 +1,149 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QString>
+#include <QtCore/QtEndian>
+#include <QtTest/QtTest>
+#include <QtMqtt/private/qmqttreadbuffer_p.h>
+
+// Each message mimics a QoS 0 PUBLISH: fixed header, remaining length,
+// topic length, topic and payload.
+static QByteArray createBacklog(int messageCount)
+{
+    const QByteArray topic("sensors/temperature/0001");
+    const QByteArray payload(16, 'x');
+    const quint16 topicLength = qToBigEndian<quint16>(quint16(topic.size()));
+
+    QByteArray backlog;
+    backlog.reserve(messageCount * (4 + topic.size() + payload.size()));
+    for (int i = 0; i < messageCount; ++i) {
+        backlog.append(char(0x30));
+        backlog.append(char(2 + topic.size() + payload.size()));
+        backlog.append(reinterpret_cast<const char *>(&topicLength), 2);
+        backlog.append(topic);
+        backlog.append(payload);
+    }
+    return backlog;
+}
+
+class Tst_QMqttReadBuffer : public QObject
+{
+    Q_OBJECT
+
+public:
+    Tst_QMqttReadBuffer();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void consumeBacklog_data();
+    void consumeBacklog();
+    void consumeBacklogMid_data();
+    void consumeBacklogMid();
+};
+
+Tst_QMqttReadBuffer::Tst_QMqttReadBuffer()
+{
+}
+
+void Tst_QMqttReadBuffer::initTestCase()
+{
+}
+
+void Tst_QMqttReadBuffer::cleanupTestCase()
+{
+}
+
+void Tst_QMqttReadBuffer::consumeBacklog_data()
+{
+    QTest::addColumn<int>("messageCount");
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("10000") << 10000;
+    QTest::newRow("100000") << 100000;
+}
+
+// The time per message needs to stay constant for all rows.
+void Tst_QMqttReadBuffer::consumeBacklog()
+{
+#ifdef QT_BUILD_INTERNAL
+    QFETCH(int, messageCount);
+    const QByteArray backlog = createBacklog(messageCount);
+
+    int received = 0;
+    QBENCHMARK {
+        QMqttReadBuffer buffer;
+        buffer.append(backlog);
+        received = 0;
+        while (!buffer.isEmpty()) {
+            quint8 header;
+            quint8 remaining;
+            quint16 topicLength;
+            buffer.read(reinterpret_cast<char *>(&header), 1);
+            buffer.read(reinterpret_cast<char *>(&remaining), 1);
+            buffer.read(reinterpret_cast<char *>(&topicLength), 2);
+            topicLength = qFromBigEndian<quint16>(topicLength);
+            const QByteArray topic = buffer.read(topicLength);
+            const QByteArray payload = buffer.read(remaining - topicLength - 2);
+            received++;
+        }
+    }
+    QCOMPARE(received, messageCount);
+#else
+    QSKIP("This test requires a Qt -developer-build.");
+#endif
+}
+
+void Tst_QMqttReadBuffer::consumeBacklogMid_data()
+{
+    QTest::addColumn<int>("messageCount");
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("10000") << 10000;
+    // Bigger backlogs take too long to complete
+}
+
+// Reference for the previous approach of dropping consumed data with mid()
+void Tst_QMqttReadBuffer::consumeBacklogMid()
+{
+    QFETCH(int, messageCount);
+    const QByteArray backlog = createBacklog(messageCount);
+
+    int received = 0;
+    QBENCHMARK {
+        QByteArray buffer = backlog;
+        received = 0;
+        while (!buffer.isEmpty()) {
+            const quint8 remaining = quint8(buffer.at(1));
+            buffer = buffer.mid(2);
+            const quint16 topicLength = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(buffer.constData()));
+            buffer = buffer.mid(2);
+            const QByteArray topic = buffer.left(topicLength);
+            buffer = buffer.mid(topicLength);
+            const QByteArray payload = buffer.left(remaining - topicLength - 2);
+            buffer = buffer.mid(remaining - topicLength - 2);
+            received++;
+        }
+    }
+    QCOMPARE(received, messageCount);
+}
+
+QTEST_APPLESS_MAIN(Tst_QMqttReadBuffer)
+
+#include "tst_qmqttreadbuffer.moc"
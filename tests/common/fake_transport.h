@@ -0,0 +1,125 @@
+/******************************************************************************
+**
+** Copyright (C) 2017 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the QtMqtt module.
+**
+** $QT_BEGIN_LICENSE:COMM$
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** $QT_END_LICENSE$
+**
+******************************************************************************/
+
+#include <QtCore/QByteArray>
+#include <QtCore/QIODevice>
+#include <QtCore/QtEndian>
+#include <QtMqtt/QMqttClient>
+
+// In-memory transport standing in for a broker connection. Everything the
+// client writes is counted, data passed to receive() is read by the client
+// like data arriving from the network.
+class FakeTransport : public QIODevice
+{
+public:
+    FakeTransport()
+    {
+        open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override
+    {
+        return m_inbound.size() - m_inboundPos + QIODevice::bytesAvailable();
+    }
+    qint64 bytesToWrite() const override
+    {
+        return m_unsent.size() + QIODevice::bytesToWrite();
+    }
+
+    void receive(const QByteArray &data)
+    {
+        m_inbound.append(data);
+        emit readyRead();
+    }
+
+    // Keeps the written data for inspection, otherwise it is only counted
+    void setKeepWritten(bool keep) { m_keepWritten = keep; }
+    QByteArray written() const { return m_written; }
+
+    // Simulates a slow link: written data stays unsent until drain() is called
+    void setStalled(bool stalled) { m_stalled = stalled; }
+    void drain(qint64 size)
+    {
+        size = qMin<qint64>(size, m_unsent.size());
+        m_unsent.remove(0, int(size));
+        emit bytesWritten(size);
+    }
+
+    int writeCount() const { return m_writeCount; }
+    qint64 bytesWrittenTotal() const { return m_bytesWritten; }
+    void resetCounters()
+    {
+        m_writeCount = 0;
+        m_bytesWritten = 0;
+        m_written.clear();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const qint64 size = qMin<qint64>(maxSize, m_inbound.size() - m_inboundPos);
+        memcpy(data, m_inbound.constData() + m_inboundPos, size_t(size));
+        m_inboundPos += int(size);
+        if (m_inboundPos == m_inbound.size()) {
+            m_inbound.clear();
+            m_inboundPos = 0;
+        }
+        return size;
+    }
+
+    qint64 writeData(const char *data, qint64 size) override
+    {
+        m_writeCount++;
+        m_bytesWritten += size;
+        if (m_keepWritten)
+            m_written.append(data, int(size));
+        if (m_stalled)
+            m_unsent.append(data, int(size));
+        return size;
+    }
+
+private:
+    QByteArray m_inbound;
+    int m_inboundPos{0};
+    QByteArray m_written;
+    bool m_keepWritten{false};
+    QByteArray m_unsent;
+    bool m_stalled{false};
+    int m_writeCount{0};
+    qint64 m_bytesWritten{0};
+};
+
+// Connects client via transport by answering its CONNECT with a CONNACK
+inline bool connectFakeBroker(QMqttClient *client, FakeTransport *transport)
+{
+    client->setTransport(transport, QMqttClient::IODevice);
+    client->connectToHost();
+    transport->receive(QByteArray("\x20\x02\x00\x00", 4));
+    transport->resetCounters();
+    return client->state() == QMqttClient::Connected;
+}
+
+inline QByteArray createPublishAcknowledge(quint16 id)
+{
+    const quint16 idBigEndian = qToBigEndian<quint16>(id);
+    return QByteArray("\x40\x02", 2) + QByteArray(reinterpret_cast<const char *>(&idBigEndian), 2);
+}